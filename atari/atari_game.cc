@@ -206,6 +206,14 @@ void AtariGame::_fill_state(GameState& state) {
     _copy_screen(state);
 }
 
+// Fused gathers for the actor and train key sets requested by game.py.
+static FusedGatherRegistrar<AIComm, FieldId<AIComm>, FieldState, FieldLastReward, FieldLastTerminal>
+    _actor_gather({"id", "s", "last_r", "last_terminal"});
+
+static FusedGatherRegistrar<AIComm, FieldReplyVersion<AIComm>, FieldId<AIComm>, FieldPolicy, FieldState,
+    FieldAction, FieldReward, FieldValue, FieldSeq<AIComm>, FieldTerminal>
+    _train_gather({"rv", "id", "pi", "s", "a", "r", "V", "seq", "terminal"});
+
 bool CustomFieldFunc(int batchsize, const std::string& key,
     const std::string& v, SizeType *sz, FieldBase<AIComm> **p) {
     // Note that ptr and stride will be set after the memory are initialized in the Python side.
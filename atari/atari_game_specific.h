@@ -53,7 +53,7 @@ class FieldState : public FieldT<AIComm, float> {
 public:
     void ToPtr(int batch_idx, const AIComm& ai_comm) override {
         const auto &info = ai_comm.newest(this->_hist_loc);
-        std::copy(info.data.buf.begin(), info.data.buf.end(), this->addr(batch_idx));
+        this->CopyRow(batch_idx, info.data.buf);
     }
 };
 
@@ -0,0 +1,550 @@
+/**
+* Copyright (c) 2017-present, Facebook, Inc.
+* All rights reserved.
+*
+* This source code is licensed under the BSD-style license found in the
+* LICENSE file in the root directory of this source tree. An additional grant
+* of patent rights can be found in the PATENTS file in the same directory.
+*/
+
+//File: benchmark-comm.cpp
+// Benchmark of the comm layer (CommT/StateCollectorT/BatchExchangeT) alone: synthetic games send a
+// record of data_size floats and wait for a reply of reply_size ints, while a C++ consumer loop
+// calls Wait()/Steps() and fills the replies. No Python and no simulator is involved.
+//
+// Every option but warmup and duration takes a comma separated list of integers, and all
+// combinations are run. warmup and duration are in seconds, and may be fractional:
+//   make && ./benchmark-comm.bin --num_games=64,256 --batchsize=32,128 --num_collectors=1,2 --T=1,4
+//     --wait_per_group=0,1 --duration=5 --output=comm.json
+// wait_policy is 0 (park), 1 (spin_then_park, for up to wait_spin_usec) or 2 (spin).
+// With latency_budget_usec > 0 under steady load (game_usec = 0, T = 1 and at least batchsize games
+// per collector), the batch fill has to stay above kMinSteadyFill, otherwise the adaptive target
+// of the deadline policy collapsed. This counts as an error.
+// children > 0 makes each game spawn that many AIComm children, which send in turn after the game
+// at the same seq (as the leaves of MCTSAI do). Replies echo the last float of the record, so a
+// child that gets the record of another one (e.g., through a staging pool) counts as an error.
+//
+// stop_cycles > 0 adds a shutdown stress loop: after the timed run, the context is started and
+// stopped that many more times, with at least 2 buffers, after runs of 0 to 19 ms. Stop() races
+// with games that are sending or waiting for replies then. If Stop() does not return within
+// kStopTimeoutSec, the benchmark prints where it is and exits with status 3:
+//   ./benchmark-comm.bin --num_games=16 --batchsize=4 --num_collectors=2 --num_groups=2 --T=3
+//     --num_buffers=2 --warmup=0 --duration=0.2 --stop_cycles=200
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "json.hpp"
+#include "elf/comm_template.h"
+
+using json = nlohmann::json;
+using Clock = std::chrono::steady_clock;
+
+struct BenchOptions { };
+
+struct BenchData {
+  std::vector<float> f;
+};
+
+struct BenchReply {
+  // Stays empty if no collector picked up the record.
+  std::vector<int> a;
+  void Clear() { a.clear(); }
+};
+
+using Context = ContextT<BenchOptions, BenchData, BenchReply>;
+using AIComm = Context::AIComm;
+using DataAddr = Context::DataAddr;
+
+class FieldData : public FieldT<AIComm, float> {
+public:
+  void ToPtr(int batch_idx, const AIComm &ai_comm) override {
+    this->CopyRow(batch_idx, ai_comm.newest(this->_hist_loc).data.f);
+  }
+};
+
+class FieldReply : public FieldT<AIComm, int> {
+public:
+  void FromPtr(int batch_idx, AIComm &ai_comm) const override {
+    const int *p = this->addr(batch_idx);
+    ai_comm.newest(this->_hist_loc).reply.a.assign(p, p + this->_stride);
+  }
+};
+
+// {"f", "id"} takes the fused gather path. Adding "seq" to the input keys falls back to the virtual one.
+static FusedGatherRegistrar<AIComm, FieldData, FieldId<AIComm>> _fused_gather({"f", "id"});
+
+// One point of the sweep.
+using Config = std::map<std::string, int>;
+
+// Options in seconds, the same for every point.
+static const std::vector<std::string> kSeconds = { "warmup", "duration" };
+
+static const int kStopTimeoutSec = 30;
+
+static const double kMinSteadyFill = 0.5;
+
+// Records of child k of a game end with game_idx + (k + 1) * kChildTag (exact in a float).
+static const int kChildTag = 1 << 16;
+
+static const std::vector<std::pair<std::string, std::string>> kDefaults = {
+  {"num_games", "64"},
+  {"batchsize", "32"},
+  {"num_collectors", "1"},
+  {"num_groups", "1"},
+  {"T", "1"},
+  {"wait_per_group", "0"},
+  {"data_size", "1024"},
+  {"reply_size", "1"},
+  {"game_usec", "0"},
+  {"fused", "1"},
+  {"staged", "0"},
+  {"children", "0"},
+  {"lock_free_exchange", "0"},
+  {"num_buffers", "1"},
+  {"collector_gather", "0"},
+  {"fan_out", "0"},
+  {"wait_policy", "0"},
+  {"wait_spin_usec", "50"},
+  {"latency_budget_usec", "0"},
+  {"min_fill", "1"},
+  {"stop_cycles", "0"},
+  {"warmup", "1"},
+  {"duration", "3"},
+};
+
+static std::vector<int> parse_list(const std::string &key, const std::string &s) {
+  std::vector<int> values;
+  std::stringstream ss(s);
+  std::string item;
+  while (std::getline(ss, item, ',')) {
+    size_t end = 0;
+    try {
+      values.push_back(std::stoi(item, &end));
+    } catch (const std::exception &) {
+      end = 0;
+    }
+    if (end == 0 || end != item.size()) throw std::invalid_argument("Bad value for --" + key + ": " + s);
+  }
+  if (values.empty()) throw std::invalid_argument("Empty value for --" + key);
+  return values;
+}
+
+static double parse_seconds(const std::string &key, const std::string &s) {
+  size_t end = 0;
+  double value = -1.0;
+  try {
+    value = std::stod(s, &end);
+  } catch (const std::exception &) {
+    end = 0;
+  }
+  if (end == 0 || end != s.size() || ! (value >= 0.0)) {
+    throw std::invalid_argument("Bad value for --" + key + " (seconds): " + s);
+  }
+  return value;
+}
+
+static void expand(const std::vector<std::pair<std::string, std::vector<int>>> &axes, size_t i,
+    Config *config, std::vector<Config> *configs) {
+  if (i == axes.size()) {
+    configs->push_back(*config);
+    return;
+  }
+  for (int v : axes[i].second) {
+    (*config)[axes[i].first] = v;
+    expand(axes, i + 1, config, configs);
+  }
+}
+
+static double percentile(const std::vector<float> &sorted, double p) {
+  if (sorted.empty()) return 0.0;
+  size_t idx = std::min(sorted.size() - 1, (size_t)(p * sorted.size()));
+  return sorted[idx];
+}
+
+static json to_json(const LatencyStats &stats) {
+  return {
+    {"count", stats.count},
+    {"mean", stats.mean_usec},
+    {"p50", stats.p50_usec},
+    {"p90", stats.p90_usec},
+    {"p99", stats.p99_usec},
+    {"max", stats.max_usec},
+  };
+}
+
+// Stop() cannot be interrupted, so if it hangs we report it and exit.
+static void stop_or_exit(Context *context, const Config &c) {
+  std::mutex mutex;
+  std::condition_variable cv;
+  bool stopped = false;
+  std::thread watchdog([&]() {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (cv.wait_for(lock, std::chrono::seconds(kStopTimeoutSec), [&]() { return stopped; })) return;
+    json config;
+    for (const auto &kv : c) config[kv.first] = kv.second;
+    std::cerr << "Stop() did not return within " << kStopTimeoutSec << " sec, config: " << config.dump() << std::endl;
+    std::_Exit(3);
+  });
+  context->Stop();
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopped = true;
+  }
+  cv.notify_one();
+  watchdog.join();
+}
+
+static void spin_for(int usec) {
+  if (usec <= 0) return;
+  auto until = Clock::now() + std::chrono::microseconds(usec);
+  while (Clock::now() < until) { }
+}
+
+// Tensors for one (group, collector, buffer) exchange, laid out the way Python allocates them.
+struct Slot {
+  std::vector<std::vector<int64_t>> input;
+  std::vector<std::vector<int64_t>> reply;
+  const int *id = nullptr;
+  // Either the rows of f, or (staged) their row indices into the staging pool.
+  const float *f = nullptr;
+  const int *row = nullptr;
+  int *a = nullptr;
+};
+
+static void bind(const Config &c, DataAddr &addr, Slot *slot) {
+  const std::string bs = std::to_string(c.at("batchsize"));
+  const std::string T = std::to_string(c.at("T"));
+  typename DataAddr::DataAddrService::DescType input_desc{{"id", ""}, {"_batchsize", bs}, {"_T", T}};
+  input_desc[c.at("staged") ? "&f" : "f"] = "";
+  if (! c.at("fused")) input_desc["seq"] = "";
+
+  auto alloc = [](std::vector<typename DataAddr::AddrEntry> &entries, std::vector<std::vector<int64_t>> *storage) {
+    storage->clear();
+    for (auto &entry : entries) {
+      int n = 1;
+      for (int d : entry.entry_info.sz) n *= d;
+      int stride = n / entry.entry_info.sz[0];
+      // int64_t storage is large and aligned enough for any field type.
+      storage->emplace_back(n);
+      entry.Set((int64_t)storage->back().data(), stride);
+    }
+  };
+
+  auto &input = addr.GetInputService();
+  input.Create(input_desc);
+  alloc(input.entries(), &slot->input);
+  for (size_t i = 0; i < input.entries().size(); ++i) {
+    const auto &info = input.entries()[i].entry_info;
+    if (info.hist_loc_for_py != c.at("T") - 1) continue;
+    if (info.key == "id") slot->id = (const int *)slot->input[i].data();
+    if (info.key == "f") slot->f = (const float *)slot->input[i].data();
+    if (info.key == "&f") slot->row = (const int *)slot->input[i].data();
+  }
+
+  auto &reply = addr.GetReplyService();
+  reply.Create({{"a", ""}, {"_batchsize", bs}, {"_T", "1"}});
+  alloc(reply.entries(), &slot->reply);
+  slot->a = (int *)slot->reply[0].data();
+}
+
+static json run(const Config &c, double warmup, double duration) {
+  const int data_size = c.at("data_size");
+  const int reply_size = c.at("reply_size");
+  const int num_groups = c.at("num_groups");
+  const int num_collectors = c.at("num_collectors");
+  const int num_buffers = c.at("num_buffers");
+  const int batchsize = c.at("batchsize");
+  const int game_usec = c.at("game_usec");
+  const int num_children = c.at("children");
+
+  ContextOptions co;
+  co.num_games = c.at("num_games");
+  co.T = c.at("T");
+  co.max_num_threads = num_children;
+  co.wait_per_group = c.at("wait_per_group") != 0;
+  co.lock_free_exchange = c.at("lock_free_exchange") != 0;
+  co.num_buffers = num_buffers;
+  co.collector_gather = c.at("collector_gather") != 0;
+  co.fan_out = c.at("fan_out") != 0;
+  static const std::vector<std::string> kWaitPolicies = { "park", "spin_then_park", "spin" };
+  co.wait_policy = kWaitPolicies.at(c.at("wait_policy"));
+  co.wait_spin_usec = c.at("wait_spin_usec");
+
+  auto field_func = [data_size, reply_size](int bs, const std::string &key, const std::string &,
+      SizeType *sz, FieldBase<AIComm> **p) {
+    if (key == "f") {
+      *sz = SizeType{bs, data_size};
+      *p = new FieldData();
+    } else if (key == "a") {
+      *sz = SizeType{bs, reply_size};
+      *p = new FieldReply();
+    } else return false;
+    return true;
+  };
+
+  // Declared before the context so that the tensors outlive it.
+  std::vector<Slot> slots(num_groups * num_collectors * num_buffers);
+  std::vector<float> pool;
+  std::vector<std::vector<float>> latencies(co.num_games);
+  std::atomic_bool measuring(false);
+  std::atomic<int64_t> errors(0);
+
+  Context context(co, BenchOptions(), field_func);
+  for (int g = 0; g < num_groups; ++g) {
+    context.AddCollectors(batchsize, co.T, num_collectors, c.at("latency_budget_usec"), c.at("min_fill"));
+  }
+  if (c.at("staged")) {
+    const EntryInfo &info = context.CreateStagingPool("f", co.T);
+    pool.resize(info.sz[0] * info.sz[1]);
+    context.SetStagingPoolAddr("f", (int64_t)pool.data(), info.sz[1]);
+  }
+  auto slot_of = [&](int gid, int id_in_group, int buffer) -> Slot & {
+    return slots[(gid * num_buffers + buffer) * num_collectors + id_in_group];
+  };
+  for (int g = 0; g < num_groups; ++g) {
+    for (int i = 0; i < num_collectors; ++i) {
+      for (int b = 0; b < num_buffers; ++b) bind(c, context.GetDataAddr(g, i, b), &slot_of(g, i, b));
+    }
+  }
+
+  context.Start([&](int game_idx, const BenchOptions &, const std::atomic_bool &done, AIComm *comm) {
+    auto &lat = latencies[game_idx];
+    std::vector<std::unique_ptr<AIComm>> children;
+    for (int k = 0; k < num_children; ++k) children.emplace_back(comm->Spawn(k));
+    while (! done.load()) {
+      spin_for(game_usec);
+      // The game itself, then its children.
+      for (int k = -1; k < num_children && ! done.load(); ++k) {
+        AIComm *sender = k < 0 ? comm : children[k].get();
+        const int tag = game_idx + (k + 1) * kChildTag;
+        sender->Prepare();
+        auto &f = sender->GetData()->f;
+        f.assign(data_size, (float)game_idx);
+        f.back() = (float)tag;
+        auto t0 = Clock::now();
+        if (! sender->SendDataWaitReply()) continue;
+        // With T > 1, a group only takes every (T - 1)-th record, the others return at once.
+        const auto &a = sender->newest().reply.a;
+        if (a.empty() || ! measuring.load(std::memory_order_relaxed)) continue;
+        lat.push_back(std::chrono::duration<float, std::micro>(Clock::now() - t0).count());
+        if (a[0] != tag + 1) errors ++;
+      }
+    }
+  });
+
+  std::atomic<int64_t> num_samples(0), num_batches(0);
+  std::atomic_bool consuming(true);
+
+  auto consume = [&](int group_id) {
+    const int timeout_usec = 1000;
+    while (consuming.load()) {
+      auto infos = group_id < 0 ? context.Wait(timeout_usec) : context.WaitGroup(group_id, timeout_usec);
+      if (infos.collector == nullptr) continue;
+      const Slot &slot = slot_of(infos.gid, infos.id_in_group, infos.buffer);
+      for (int i = 0; i < infos.batchsize; ++i) {
+        int id = slot.id[i];
+        const float *f = slot.row != nullptr ? &pool[slot.row[i] * data_size] : &slot.f[i * data_size];
+        if (f[0] != (float)id) errors ++;
+        std::fill(slot.a + i * reply_size, slot.a + (i + 1) * reply_size, (int)f[data_size - 1] + 1);
+      }
+      if (measuring.load(std::memory_order_relaxed)) {
+        num_samples += infos.batchsize;
+        num_batches ++;
+      }
+      context.Steps(infos);
+    }
+  };
+
+  // With wait_per_group, batches of a group only show up in WaitGroup(gid), so each group gets its own consumer.
+  std::vector<std::thread> consumers;
+  if (co.wait_per_group) {
+    for (int g = 0; g < num_groups; ++g) consumers.emplace_back(consume, g);
+  } else {
+    consumers.emplace_back(consume, -1);
+  }
+
+  std::this_thread::sleep_for(std::chrono::duration<double>(warmup));
+  context.ResetCommStats();
+  measuring = true;
+  auto t0 = Clock::now();
+  std::this_thread::sleep_for(std::chrono::duration<double>(duration));
+  measuring = false;
+  CommLayerStats stats = context.GetCommStats();
+  double elapsed = std::chrono::duration<double>(Clock::now() - t0).count();
+
+  consuming = false;
+  for (auto &t : consumers) t.join();
+
+  // Keep the chatter of Stop() out of the JSON on stdout.
+  std::stringstream sink;
+  auto *old = std::cout.rdbuf(sink.rdbuf());
+  stop_or_exit(&context, c);
+  std::cout.rdbuf(old);
+
+  std::vector<float> all;
+  for (const auto &lat : latencies) all.insert(all.end(), lat.begin(), lat.end());
+  std::sort(all.begin(), all.end());
+  double mean = 0.0;
+  for (float l : all) mean += l;
+  if (! all.empty()) mean /= all.size();
+
+  json result;
+  for (const auto &kv : c) result["config"][kv.first] = kv.second;
+  result["config"]["warmup"] = warmup;
+  result["config"]["duration"] = duration;
+  result["elapsed_sec"] = elapsed;
+  result["samples"] = num_samples.load();
+  result["batches"] = num_batches.load();
+  result["samples_per_sec"] = num_samples.load() / elapsed;
+  result["batches_per_sec"] = num_batches.load() / elapsed;
+  result["batch_fill_ratio"] = num_batches.load() > 0 ? (double)num_samples.load() / (num_batches.load() * batchsize) : 0.0;
+  result["round_trip_usec"] = {
+    {"count", all.size()},
+    {"mean", mean},
+    {"p50", percentile(all, 0.50)},
+    {"p90", percentile(all, 0.90)},
+    {"p99", percentile(all, 0.99)},
+    {"p999", percentile(all, 0.999)},
+    {"max", all.empty() ? 0.0 : all.back()},
+  };
+  // Stage breakdown from the comm layer's own histograms (log2 buckets, so percentiles are coarse).
+  result["comm_stats"]["send_wait_reply"] = to_json(stats.send_wait_reply);
+  result["comm_stats"]["collectors"] = json::array();
+  for (const auto &cs : stats.collectors) {
+    result["comm_stats"]["collectors"].push_back({
+      {"id", cs.id},
+      {"gid", cs.gid},
+      {"num_batches", cs.num_batches},
+      {"num_samples", cs.num_samples},
+      {"send_to_select", to_json(cs.send_to_select)},
+      {"full_to_wait", to_json(cs.full_to_wait)},
+      {"consumer_hold", to_json(cs.consumer_hold)},
+      {"steps_to_reply", to_json(cs.steps_to_reply)},
+    });
+  }
+  result["errors"] = errors.load();
+  return result;
+}
+
+// Whether every collector can always fill its batch.
+static bool steady_load(const Config &c) {
+  return c.at("game_usec") == 0 && c.at("T") == 1 && c.at("num_games") >= c.at("batchsize") * c.at("num_collectors");
+}
+
+// The shutdown stress loop. Returns the errors of its runs.
+static json stress_stop(const Config &c) {
+  Config stress = c;
+  stress["num_buffers"] = std::max(c.at("num_buffers"), 2);
+  int64_t errors = 0;
+  for (int i = 0; i < c.at("stop_cycles"); ++i) {
+    errors += run(stress, 0.0, 1e-3 * (i % 20))["errors"].get<int64_t>();
+  }
+  return {
+    {"cycles", c.at("stop_cycles")},
+    {"num_buffers", stress["num_buffers"]},
+    {"errors", errors},
+  };
+}
+
+int main(int argc, char **argv) {
+  std::map<std::string, std::string> args(kDefaults.begin(), kDefaults.end());
+  std::string output = "-";
+
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    size_t eq = arg.find('=');
+    if (arg.compare(0, 2, "--") != 0 || eq == std::string::npos) {
+      std::cerr << "Usage: " << argv[0] << " [--output=file.json]";
+      for (const auto &kv : kDefaults) {
+        const bool seconds = std::find(kSeconds.begin(), kSeconds.end(), kv.first) != kSeconds.end();
+        std::cerr << " [--" << kv.first << "=" << kv.second << (seconds ? "]" : "[,...]]");
+      }
+      std::cerr << std::endl;
+      return 1;
+    }
+    std::string key = arg.substr(2, eq - 2);
+    std::string value = arg.substr(eq + 1);
+    if (key == "output") {
+      output = value;
+    } else if (args.find(key) == args.end()) {
+      std::cerr << "Unknown option --" << key << std::endl;
+      return 1;
+    } else {
+      args[key] = value;
+    }
+  }
+
+  std::vector<Config> configs;
+  double warmup = 0.0, duration = 0.0;
+  try {
+    warmup = parse_seconds("warmup", args["warmup"]);
+    duration = parse_seconds("duration", args["duration"]);
+    std::vector<std::pair<std::string, std::vector<int>>> axes;
+    for (const auto &kv : kDefaults) {
+      if (std::find(kSeconds.begin(), kSeconds.end(), kv.first) != kSeconds.end()) continue;
+      axes.emplace_back(kv.first, parse_list(kv.first, args[kv.first]));
+    }
+    Config config;
+    expand(axes, 0, &config, &configs);
+  } catch (const std::invalid_argument &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+
+  json report;
+  report["benchmark"] = "comm";
+#ifdef GIT_COMMIT_HASH
+#define STRINGIFY(x) #x
+#define TOSTRING(x) STRINGIFY(x)
+  report["version"] = TOSTRING(GIT_COMMIT_HASH) "_" TOSTRING(GIT_UNSTAGED);
+#else
+  report["version"] = "";
+#endif
+  report["results"] = json::array();
+
+  int64_t errors = 0;
+  for (size_t i = 0; i < configs.size(); ++i) {
+    json result = run(configs[i], warmup, duration);
+    if (configs[i].at("latency_budget_usec") > 0 && steady_load(configs[i])) {
+      const double fill = result["batch_fill_ratio"].get<double>();
+      result["steady_fill_ok"] = fill >= kMinSteadyFill;
+      if (fill < kMinSteadyFill) {
+        std::cerr << "Batch fill " << fill << " under steady load, below " << kMinSteadyFill << std::endl;
+        result["errors"] = result["errors"].get<int64_t>() + 1;
+      }
+    }
+    if (configs[i].at("stop_cycles") > 0) {
+      result["stop_cycles"] = stress_stop(configs[i]);
+      result["errors"] = result["errors"].get<int64_t>() + result["stop_cycles"]["errors"].get<int64_t>();
+    }
+    std::cerr << "[" << i + 1 << "/" << configs.size() << "] " << result["config"].dump()
+      << " samples/sec: " << result["samples_per_sec"].get<double>()
+      << " fill: " << result["batch_fill_ratio"].get<double>()
+      << " p50/p99 usec: " << result["round_trip_usec"]["p50"].get<double>()
+      << "/" << result["round_trip_usec"]["p99"].get<double>() << std::endl;
+    errors += result["errors"].get<int64_t>();
+    report["results"].push_back(result);
+  }
+
+  if (output == "-") {
+    std::cout << report.dump(2) << std::endl;
+  } else {
+    std::ofstream f(output);
+    f << report.dump(2) << std::endl;
+  }
+  return errors == 0 ? 0 : 2;
+}
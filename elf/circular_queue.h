@@ -24,10 +24,6 @@ private:
         v ++;
         if (v >= (int)_q.size()) v = 0;
     }
-    inline void _proj(int &v) const {
-        while (v >= (int)_q.size()) v -= (int)_q.size();
-        while (v < 0) v += (int)_q.size();
-    }
 
 public:
     CircularQueue(int hist_len) : _q(hist_len) { clear(); }
@@ -58,17 +54,17 @@ public:
 
     const T &get_from_push(int i) const {
         // i == 0 is the object we just pushed.
-        // Note that it does not check out of bound!
+        // Note that it does not check out of bound! For 0 <= i < maxlen(), one wrap is enough.
         int idx = _tail - 1 - i;
-        _proj(idx);
+        if (idx < 0) idx += (int)_q.size();
         return _q[idx];
     }
 
     T &get_from_push(int i) {
         // i == 0 is the object we just pushed.
-        // Note that it does not check out of bound!
+        // Note that it does not check out of bound! For 0 <= i < maxlen(), one wrap is enough.
         int idx = _tail - 1 - i;
-        _proj(idx);
+        if (idx < 0) idx += (int)_q.size();
         return _q[idx];
     }
 
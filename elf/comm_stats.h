@@ -0,0 +1,138 @@
+/**
+* Copyright (c) 2017-present, Facebook, Inc.
+* All rights reserved.
+*
+* This source code is licensed under the BSD-style license found in the
+* LICENSE file in the root directory of this source tree. An additional grant
+* of patent rights can be found in the PATENTS file in the same directory.
+*/
+
+//File: comm_stats.h
+
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#include "pybind_helper.h"
+
+// Snapshot of a LatencyHistogram, readable from Python.
+// buckets[0] counts samples below 1us, buckets[i] counts samples in [2^(i-1), 2^i) us,
+// and the last bucket also takes everything above. Percentiles are the upper
+// bound of the bucket they fall in (capped by max_usec).
+struct LatencyStats {
+    int64_t count = 0;
+    int64_t sum_usec = 0;
+    int64_t max_usec = 0;
+    double mean_usec = 0.0;
+    int64_t p50_usec = 0;
+    int64_t p90_usec = 0;
+    int64_t p99_usec = 0;
+    std::vector<int64_t> buckets;
+
+    REGISTER_PYBIND_FIELDS(count, sum_usec, max_usec, mean_usec, p50_usec, p90_usec, p99_usec, buckets);
+};
+
+// Always-on log2 histogram of durations. Record() is a few relaxed atomic adds,
+// so it can be called from any thread on the hot path.
+class LatencyHistogram {
+public:
+    using Clock = std::chrono::steady_clock;
+    static constexpr int kNumBuckets = 32;
+
+private:
+    std::atomic<int64_t> _buckets[kNumBuckets];
+    std::atomic<int64_t> _sum, _max;
+
+    static int bucket(int64_t usec) {
+        int b = 0;
+        while (usec > 0 && b < kNumBuckets - 1) {
+            usec >>= 1;
+            b ++;
+        }
+        return b;
+    }
+
+    int64_t percentile(const std::vector<int64_t> &buckets, int64_t count, double p, int64_t max_usec) const {
+        if (count == 0) return 0;
+        const int64_t rank = static_cast<int64_t>(p * count);
+        int64_t seen = 0;
+        for (int b = 0; b < kNumBuckets; ++b) {
+            seen += buckets[b];
+            if (seen > rank) return std::min(max_usec, (int64_t)1 << b);
+        }
+        return max_usec;
+    }
+
+public:
+    LatencyHistogram() { Reset(); }
+
+    void Record(int64_t usec) {
+        if (usec < 0) usec = 0;
+        _buckets[bucket(usec)].fetch_add(1, std::memory_order_relaxed);
+        _sum.fetch_add(usec, std::memory_order_relaxed);
+        int64_t prev = _max.load(std::memory_order_relaxed);
+        while (usec > prev && ! _max.compare_exchange_weak(prev, usec, std::memory_order_relaxed)) { }
+    }
+
+    void Record(Clock::time_point since) {
+        Record(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - since).count());
+    }
+
+    // Samples recorded concurrently with Reset() may land in either interval.
+    void Reset() {
+        for (auto &b : _buckets) b.store(0, std::memory_order_relaxed);
+        _sum.store(0, std::memory_order_relaxed);
+        _max.store(0, std::memory_order_relaxed);
+    }
+
+    LatencyStats Get() const {
+        LatencyStats stats;
+        stats.buckets.resize(kNumBuckets);
+        int64_t count = 0;
+        for (int b = 0; b < kNumBuckets; ++b) {
+            stats.buckets[b] = _buckets[b].load(std::memory_order_relaxed);
+            count += stats.buckets[b];
+        }
+        stats.count = count;
+        stats.sum_usec = _sum.load(std::memory_order_relaxed);
+        stats.max_usec = _max.load(std::memory_order_relaxed);
+        stats.mean_usec = count > 0 ? (double)stats.sum_usec / count : 0.0;
+        stats.p50_usec = percentile(stats.buckets, count, 0.50, stats.max_usec);
+        stats.p90_usec = percentile(stats.buckets, count, 0.90, stats.max_usec);
+        stats.p99_usec = percentile(stats.buckets, count, 0.99, stats.max_usec);
+        return stats;
+    }
+};
+
+// Per-collector counters and stage latencies.
+//   send_to_select: game's SendData() -> the collector picks the sample for a batch.
+//   full_to_wait:   batch ready -> Wait()/WaitGroup() returns it to the consumer.
+//   consumer_hold:  Wait() returns -> Steps() is called.
+//   steps_to_reply: Steps() -> each game has saved its reply.
+struct CollectorStats {
+    int id = -1;
+    int gid = -1;
+    int id_in_group = -1;
+    int max_batchsize = 0;
+    int64_t num_batches = 0;
+    int64_t num_samples = 0;
+    LatencyStats send_to_select;
+    LatencyStats full_to_wait;
+    LatencyStats consumer_hold;
+    LatencyStats steps_to_reply;
+
+    REGISTER_PYBIND_FIELDS(id, gid, id_in_group, max_batchsize, num_batches, num_samples,
+        send_to_select, full_to_wait, consumer_hold, steps_to_reply);
+};
+
+// Stats of the whole comm layer.
+//   send_wait_reply: wall time of SendDataWaitReply() on the game side, for records taken by any group.
+struct CommLayerStats {
+    LatencyStats send_wait_reply;
+    std::vector<CollectorStats> collectors;
+
+    REGISTER_PYBIND_FIELDS(send_wait_reply, collectors);
+};
@@ -133,6 +133,7 @@ public:
     using Infos = typename SyncSignal::Infos;
     using TaskSignal = typename SyncSignal::TaskSignal;
     using CustomFieldFunc = typename DataAddr::CustomFieldFunc;
+    using StagingPools = typename DataAddr::StagingPools;
 
 private:
     struct Stat {
@@ -152,11 +153,24 @@ private:
 
     std::unique_ptr<SyncSignal> _signal;
     CommStats _stats;
+    LatencyHistogram _send_wait_reply;
 
     // Key -> index.
     std::unordered_map<Key, Stat> _map;
     bool _verbose;
     CustomFieldFunc _field_func;
+    StagingPools _pools;
+
+    // Ends a round trip started by SyncSignal::begin_send(), on every return.
+    struct EndSend {
+        SyncSignal *signal;
+        ~EndSend() { signal->end_send(); }
+    };
+
+    Infos received(const Infos &infos) {
+        if (infos.collector != nullptr) infos.collector->BatchReceived(infos.buffer);
+        return infos;
+    }
 
     // First register query_key then add collectors.
     void register_query_key(const Key& key) {
@@ -180,19 +194,30 @@ public:
                 }
             }
         }
-        _signal.reset(new SyncSignal(_map.size()));
+        _signal.reset(new SyncSignal(_map.size(), WaitPolicy::FromOptions(_context_options)));
     }
 
     int GetT() const { return _context_options.T; }
 
-    int AddCollectors(int batchsize, int hist_len, int num_collectors) {
+    int AddCollectors(int batchsize, int hist_len, int num_collectors,
+        int latency_budget_usec = 0, int min_fill = 1) {
         _groups.emplace_back(
             new CollectorGroup(_total_collectors, _groups.size(), batchsize, hist_len, num_collectors,
-                  _field_func, _signal.get(), _context_options.verbose_collector));
+                  _field_func, &_pools, _signal.get(), BatchPolicy(latency_budget_usec, min_fill), _context_options));
         _total_collectors += num_collectors;
         return _groups.size() - 1;
     }
 
+    // Create the staging pool for key, before the tensors that refer to it ("&key").
+    const EntryInfo &CreateStagingPool(const std::string &key, int depth) {
+        return _pools.Create(key, depth, _context_options.num_games, _context_options.max_num_threads, _field_func);
+    }
+    void SetStagingPoolAddr(const std::string &key, int64_t p, int stride) {
+        auto *pool = _pools.Get(key);
+        if (pool == nullptr) throw std::range_error("No staging pool for key " + key);
+        pool->Set(p, stride);
+    }
+
     CollectorGroup &GetCollectorGroup(int gid) { return *_groups[gid]; }
     int num_groups() const { return _groups.size(); }
 
@@ -202,18 +227,40 @@ public:
         }
     }
 
+    // Fan-out mode: one rendezvous per step instead of NUM_TASK_CMD signals per group.
+    // The record is staged once. Each group that takes it copies it into its batch on
+    // the collector thread, and its reply is saved into it on the consumer thread.
+    // We sleep until all of them have replied. Return false if no group took the record.
+    bool SendDataFanOut(int idx, Value& value) {
+        _signal->stage(idx, &value);
+        int num_groups = 0;
+        for (auto &g : _groups) {
+            if (g->SendData(idx, value.hist_size(), value.game_counter(), value.seq())) num_groups ++;
+        }
+        if (num_groups == 0) return false;
+        _signal->wait_replies(idx, num_groups);
+        return true;
+    }
+
     // Agent side.
     bool SendDataWaitReply(const Key& key, Value& value) {
-        if (_signal->GetDoneNotif().get()) {
+        if (! _signal->begin_send()) {
             V_PRINT(_verbose, "[" << key << "] Enter done mode. ");
             std::this_thread::sleep_for(std::chrono::milliseconds(10));
             return false;
         }
+        EndSend end_send{_signal.get()};
 
         auto it = _map.find(key);
         if (it == _map.end()) return false;
+        const auto t_start = LatencyHistogram::Clock::now();
         int idx = it->second.idx;
         it->second.freq ++;
+
+        if (_context_options.fan_out) {
+            if (SendDataFanOut(idx, value)) _send_wait_reply.Record(t_start);
+            return true;
+        }
         // _stats.Feed(it->second.freq, _g);
         //
         V_PRINT(_verbose, "[k=" << key << "] Start sending data ... idx = " << idx);
@@ -228,6 +275,8 @@ public:
         // Wait for all the collector ids.
         // std::cout << "[" << key << "] wait for all collector ... #collectors = " << data.num_collectors << std::endl;
         std::vector<int> batch_data(_groups.size());
+        // Collectors that selected us and have not replied yet.
+        std::vector<TaskSignal> selected(_groups.size());
         TaskSignal cmd;
         const int total_task = NUM_TASK_CMD * num_groups;
         for (int i = 0; i < total_task; ++i) {
@@ -244,29 +293,36 @@ public:
             if (cmd.type == SELECTED_IN_BATCH) {
                 V_PRINT(_verbose, "[k=" << key << ",c=" << cid  << ",g=" << gid << "] Wake from BatchSelect " << i << "/" << total_task);
                 // Then we have the batch for a collector.
-                batch_data[gid] = c.CopyToInput(idx, value);
+                batch_data[gid] = c.CopyToInput(cmd.buffer, idx, value);
+                selected[gid] = cmd;
                 V_PRINT(_verbose, "[k=" << key << ",c=" << cid << ",g=" << gid << "] done with CopyToInput. " << i << "/" << total_task);
             } else {
                 V_PRINT(_verbose, "[k=" << key << ",c=" << cid << ",g=" << gid << "] Reply arrived " << i << "/" << total_task);
-                c.CopyToReply(batch_data[gid], value);
+                // Other collectors may still be reading our record.
+                for (const auto &s : selected) {
+                    if (s.collector != nullptr && s.collector != &c) s.collector->WaitGathered(s.buffer);
+                }
+                c.CopyToReply(cmd.buffer, batch_data[gid], value);
+                selected[gid].collector = nullptr;
                 V_PRINT(_verbose, "[k=" << key << ",c=" << cid << ",g=" << gid << "] Done with CopyToReply " << i << "/" << total_task);
             }
         }
 
         V_PRINT(_verbose, "[k=" << key << "] Done with SendDataWaitReply");
+        if (num_groups > 0) _send_wait_reply.Record(t_start);
 
         return true;
     }
 
     // Daemon side.
-    Infos WaitBatchData(int time_usec = 0) { return _signal->wait_batch(-1, time_usec); }
-    Infos WaitGroupBatchData(int group_id, int time_usec = 0) { return _signal->wait_batch(group_id, time_usec); }
+    Infos WaitBatchData(int time_usec = 0) { return received(_signal->wait_batch(-1, time_usec)); }
+    Infos WaitGroupBatchData(int group_id, int time_usec = 0) { return received(_signal->wait_batch(group_id, time_usec)); }
 
     // Tell the collector that a reply was sent.
     bool Steps(const Infos& infos, int future_timeout_usec = 0) {
         // The batch is invalid, skip.
         if (infos.collector == nullptr) return false;
-        infos.collector->SignalBatchUsed(future_timeout_usec);
+        infos.collector->SignalBatchUsed(infos.buffer, future_timeout_usec);
         return true;
     }
 
@@ -274,6 +330,18 @@ public:
         for (const auto &g : _groups) g->PrintSummary();
     }
 
+    CommLayerStats GetStats() const {
+        CommLayerStats stats;
+        stats.send_wait_reply = _send_wait_reply.Get();
+        for (const auto &g : _groups) g->GetStats(&stats.collectors);
+        return stats;
+    }
+
+    void ResetStats() {
+        _send_wait_reply.Reset();
+        for (auto &g : _groups) g->ResetStats();
+    }
+
     void Stop() {
         Notif &done = _signal->GetDoneNotif();
         done.set();
@@ -422,6 +490,8 @@ private:
     ctpl::thread_pool _pool;
     Notif _done;
     bool _game_started = false;
+    // Kept alive for the game threads, which run it after Start() returns.
+    GameStartFunc _game_start_func;
 
 public:
     ContextT(const ContextOptions &context_options, const Options& options, CustomFieldFunc field_func = nullptr)
@@ -429,19 +499,21 @@ public:
           _context_options(context_options), _pool(context_options.num_games) {
     }
 
-    int AddCollectors(int batchsize, int hist_len, int num_collectors) {
-        return _comm.AddCollectors(batchsize, hist_len, num_collectors);
+    int AddCollectors(int batchsize, int hist_len, int num_collectors,
+        int latency_budget_usec = 0, int min_fill = 1) {
+        return _comm.AddCollectors(batchsize, hist_len, num_collectors, latency_budget_usec, min_fill);
     }
 
     void Start(GameStartFunc game_start_func) {
         _comm.CollectorsReady();
+        _game_start_func = game_start_func;
 
         _ai_comms.resize(_pool.size());
         for (int i = 0; i < _pool.size(); ++i) {
             _ai_comms[i].reset(new AIComm{i, &_comm});
-            _pool.push([i, this, &game_start_func](int){
+            _pool.push([i, this](int){
                 const std::atomic_bool &done = _done.flag();
-                game_start_func(i, _options, done, _ai_comms[i].get());
+                _game_start_func(i, _options, done, _ai_comms[i].get());
                 // std::cout << "G[" << i << "] is ending" << std::endl;
                 _done.notify();
             });
@@ -459,11 +531,16 @@ public:
     const MetaInfo &meta(int i) const { return _ai_comms[i]->GetMeta(); }
     int size() const { return _ai_comms.size(); }
 
-    DataAddr &GetDataAddr(int gid, int id_within_group) {
-        return _comm.GetCollectorGroup(gid).GetCollector(id_within_group).GetDataAddr();
+    EntryInfo CreateStagingPool(const std::string &key, int depth) { return _comm.CreateStagingPool(key, depth); }
+    void SetStagingPoolAddr(const std::string &key, int64_t p, int stride) { _comm.SetStagingPoolAddr(key, p, stride); }
+
+    DataAddr &GetDataAddr(int gid, int id_within_group, int buffer = 0) {
+        return _comm.GetCollectorGroup(gid).GetCollector(id_within_group).GetDataAddr(buffer);
     }
 
     void PrintSummary() const { _comm.PrintSummary(); }
+    CommLayerStats GetCommStats() const { return _comm.GetStats(); }
+    void ResetCommStats() { _comm.ResetStats(); }
 
     std::string Version() const {
 #ifdef GIT_COMMIT_HASH
@@ -21,6 +21,12 @@ class ContextArgs:
                 ("T", 6),
                 ("eval", dict(action="store_true")),
                 ("wait_per_group", dict(action="store_true")),
+                ("lock_free_exchange", dict(action="store_true")),
+                ("num_buffers", 1),
+                ("collector_gather", dict(action="store_true")),
+                ("fan_out", dict(action="store_true")),
+                ("wait_policy", dict(type=str, choices=["park", "spin_then_park", "spin"], default="park")),
+                ("wait_spin_usec", 50),
                 ("verbose_comm", dict(action="store_true")),
                 ("verbose_collector", dict(action="store_true"))
             ],
@@ -42,6 +48,12 @@ class ContextArgs:
         co.num_games = args.num_games
         co.T = args.T
         co.wait_per_group = args.wait_per_group
+        co.lock_free_exchange = args.lock_free_exchange
+        co.num_buffers = args.num_buffers
+        co.collector_gather = args.collector_gather
+        co.fan_out = args.fan_out
+        co.wait_policy = args.wait_policy
+        co.wait_spin_usec = args.wait_spin_usec
         co.verbose_comm = args.verbose_comm
         co.verbose_collector = args.verbose_collector
 
@@ -13,6 +13,17 @@
 #include <string>
 #include <map>
 #include <sstream>
+#include <tuple>
+#include <memory>
+#include <functional>
+#include <algorithm>
+#include <cstdint>
+#include <atomic>
+#include <thread>
+#include <stdexcept>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 #include "pybind_helper.h"
 
 template <typename T>
@@ -28,13 +39,43 @@ TYPE_DESC(double);
 TYPE_DESC(int64_t);
 TYPE_DESC(unsigned char);
 
+// Copy a row into the batch tensor. If streaming is on, long float rows are written
+// with non-temporal stores, since the writer never reads them back.
+template <typename T>
+inline void copy_row(const T *src, size_t n, T *dst, bool streaming) {
+    (void)streaming;
+    std::copy(src, src + n, dst);
+}
+
+template <>
+inline void copy_row<float>(const float *src, size_t n, float *dst, bool streaming) {
+#if defined(__SSE2__)
+    if (streaming && n >= 64) {
+        for (; n > 0 && (reinterpret_cast<uintptr_t>(dst) & 15); --n) *dst++ = *src++;
+        for (; n >= 4; n -= 4, src += 4, dst += 4) _mm_stream_ps(dst, _mm_loadu_ps(src));
+    }
+#else
+    (void)streaming;
+#endif
+    std::copy(src, src + n, dst);
+}
+
+// Make streaming stores visible to other threads.
+inline void copy_row_fence() {
+#if defined(__SSE2__)
+    _mm_sfence();
+#endif
+}
+
 template <typename AIComm>
 class FieldBase {
 protected:
     int _hist_loc;
+    bool _streaming = false;
 
 public:
     void SetHistLoc(int hist_loc) { _hist_loc = hist_loc; }
+    void SetStreaming(bool streaming) { _streaming = streaming; }
 
     virtual bool valid() const = 0;
     virtual std::string desc() const = 0;
@@ -65,6 +106,8 @@ protected:
     T *addr(int idx) { return _p + idx * _stride; }
     const T *addr(int idx) const { return _p + idx * _stride; }
 
+    void CopyRow(int idx, const std::vector<T> &v) { copy_row(v.data(), v.size(), addr(idx), this->_streaming); }
+
 public:
     using value_type = T;
 
@@ -140,6 +183,238 @@ struct AddrEntryT {
     void Set(int64_t p, int stride) { addr->Set(p, stride); }
 };
 
+// Staging pool.
+// When several groups take the same game step (e.g. an actor group and a learner group
+// with a longer history), each of them would copy the same observation into its own batch.
+// Instead, a pool keeps one row per (AIComm, step) for a key. The first group that needs a
+// step copies it in, and every group batch only holds row indices into the pool (key "&key").
+// Rows are keyed by the AIComm, i.e., by (MetaInfo::id, MetaInfo::thread_id): children spawned
+// by a game share its id and its seq, and have rows of their own. The row of an AIComm at
+// seq s is slot * depth + s % depth. Since an AIComm waits for all its replies, the steps
+// referenced by any batch in flight are the last T ones, so depth >= max T is enough.
+template <typename AIComm>
+class StagingPoolT {
+public:
+    using CustomFunc = std::function<bool (int batchsize, const std::string& key, const std::string& v, SizeType *, FieldBase<AIComm> **)>;
+
+private:
+    static constexpr int64_t kBusy = -2;
+
+    const int _depth;
+    const int _num_games;
+    // AIComms per game: the game itself (thread_id -1) and max_num_threads children.
+    const int _comms_per_game;
+    EntryInfo _info;
+    // One field per history slot, all pointing to the pool memory.
+    std::vector<std::unique_ptr<FieldBase<AIComm>>> _fields;
+    // Step held by each row, (game_counter << 32 | seq), -1 if none, kBusy while it is written.
+    std::unique_ptr<std::atomic<int64_t>[]> _tags;
+
+public:
+    StagingPoolT(const std::string &key, int depth, int num_games, int max_num_threads, CustomFunc func)
+        : _depth(depth), _num_games(num_games), _comms_per_game(max_num_threads + 1) {
+        const int num_rows = num_games * _comms_per_game * depth;
+        for (int t = 0; t < depth; ++t) {
+            FieldBase<AIComm> *p = nullptr;
+            if (func == nullptr || ! func(num_rows, key, "", &_info.sz, &p) || p == nullptr)
+                throw std::range_error("Unknown key in StagingPool: " + key);
+            p->SetHistLoc(t);
+            _fields.emplace_back(p);
+        }
+        _info.key = key;
+        _info.hist_loc_for_py = 0;
+        _info.type = _fields[0]->desc();
+        _tags.reset(new std::atomic<int64_t>[num_rows]);
+        for (int i = 0; i < num_rows; ++i) _tags[i] = -1;
+    }
+
+    const EntryInfo &info() const { return _info; }
+    void Set(int64_t p, int stride) {
+        for (auto &field : _fields) field->Set(p, stride);
+    }
+
+    // Return the row holding the step of ai_comm at hist_loc, copying it in if no group has.
+    int Stage(int hist_loc, const AIComm &ai_comm) {
+        if (hist_loc >= _depth) throw std::range_error("StagingPool: hist_loc beyond depth for " + _info.key);
+        const auto &meta = ai_comm.GetMeta();
+        if (meta.id < 0 || meta.id >= _num_games || meta.thread_id < -1 || meta.thread_id + 1 >= _comms_per_game) {
+            throw std::range_error("StagingPool: no row for game " + std::to_string(meta.id) + " thread "
+                + std::to_string(meta.thread_id) + " in " + _info.key);
+        }
+        const auto &info = ai_comm.newest(hist_loc);
+        const int slot = meta.id * _comms_per_game + meta.thread_id + 1;
+        const int row = slot * _depth + info.seq % _depth;
+        const int64_t tag = (static_cast<int64_t>(info.game_counter) << 32) | static_cast<uint32_t>(info.seq);
+
+        std::atomic<int64_t> &state = _tags[row];
+        int64_t curr = state.load(std::memory_order_acquire);
+        while (curr != tag) {
+            if (curr == kBusy) {
+                // Another group is copying this step right now.
+                std::this_thread::yield();
+                curr = state.load(std::memory_order_acquire);
+            } else if (state.compare_exchange_weak(curr, kBusy, std::memory_order_acquire)) {
+                _fields[hist_loc]->ToPtr(row, ai_comm);
+                state.store(tag, std::memory_order_release);
+                break;
+            }
+        }
+        return row;
+    }
+};
+
+template <typename AIComm>
+class StagingPoolsT {
+public:
+    using StagingPool = StagingPoolT<AIComm>;
+    using CustomFunc = typename StagingPool::CustomFunc;
+
+private:
+    std::map<std::string, std::unique_ptr<StagingPool>> _pools;
+
+public:
+    const EntryInfo &Create(const std::string &key, int depth, int num_games, int max_num_threads, CustomFunc func) {
+        _pools[key].reset(new StagingPool(key, depth, num_games, max_num_threads, func));
+        return _pools[key]->info();
+    }
+
+    StagingPool *Get(const std::string &key) {
+        auto it = _pools.find(key);
+        return it == _pools.end() ? nullptr : it->second.get();
+    }
+};
+
+// Row index into a staging pool, for key "&key".
+template <typename AIComm>
+class FieldStagedRow : public FieldT<AIComm, int> {
+private:
+    StagingPoolT<AIComm> *_pool;
+
+public:
+    FieldStagedRow(StagingPoolT<AIComm> *pool) : _pool(pool) { }
+    void ToPtr(int batch_idx, const AIComm& ai_comm) override {
+      *this->addr(batch_idx) = _pool->Stage(this->_hist_loc, ai_comm);
+    }
+};
+
+// Fused gather.
+// The default GetInput() makes one virtual ToPtr() call per entry (key x history slot) per sample.
+// For key sets known at compile time, FusedGatherT binds the entries to their concrete field
+// types once in Create(), and GetInput() then runs one straight-line routine whose ToPtr()
+// calls are non-virtual and can be inlined.
+template <typename AIComm>
+class GatherBase {
+public:
+    virtual void Gather(int batch_idx, const AIComm &ai_comm) = 0;
+    virtual ~GatherBase() { }
+};
+
+template <typename AIComm, typename Tuple, size_t I = 0, size_t N = std::tuple_size<Tuple>::value>
+struct FusedGatherApply {
+    using Field = typename std::remove_pointer<typename std::tuple_element<I, Tuple>::type>::type;
+
+    static bool Bind(const std::vector<AddrEntryT<AIComm>> &entries, const std::vector<std::string> &keys,
+        int hist_loc_for_py, Tuple *fields) {
+        Field *f = nullptr;
+        for (const auto &entry : entries) {
+            if (entry.entry_info.key == keys[I] && entry.entry_info.hist_loc_for_py == hist_loc_for_py) {
+                f = dynamic_cast<Field *>(entry.addr.get());
+                break;
+            }
+        }
+        if (f == nullptr) return false;
+        std::get<I>(*fields) = f;
+        return FusedGatherApply<AIComm, Tuple, I + 1, N>::Bind(entries, keys, hist_loc_for_py, fields);
+    }
+
+    static inline void ToPtr(const Tuple &fields, int batch_idx, const AIComm &ai_comm) {
+        Field *f = std::get<I>(fields);
+        if (f->Field::valid()) f->Field::ToPtr(batch_idx, ai_comm);
+        FusedGatherApply<AIComm, Tuple, I + 1, N>::ToPtr(fields, batch_idx, ai_comm);
+    }
+};
+
+template <typename AIComm, typename Tuple, size_t N>
+struct FusedGatherApply<AIComm, Tuple, N, N> {
+    static bool Bind(const std::vector<AddrEntryT<AIComm>> &, const std::vector<std::string> &, int, Tuple *) {
+        return true;
+    }
+    static inline void ToPtr(const Tuple &, int, const AIComm &) { }
+};
+
+template <typename AIComm, typename... Fields>
+class FusedGatherT : public GatherBase<AIComm> {
+public:
+    using Tuple = std::tuple<Fields *...>;
+    using Apply = FusedGatherApply<AIComm, Tuple>;
+
+private:
+    // One tuple of fields for each history slot.
+    std::vector<Tuple> _slots;
+
+public:
+    bool Bind(const std::vector<AddrEntryT<AIComm>> &entries, const std::vector<std::string> &keys, int T) {
+        if (keys.size() != sizeof...(Fields) || entries.size() != T * keys.size()) return false;
+        _slots.resize(T);
+        for (int t = 0; t < T; ++t) {
+            if (! Apply::Bind(entries, keys, T - t - 1, &_slots[t])) return false;
+        }
+        return true;
+    }
+
+    void Gather(int batch_idx, const AIComm &ai_comm) override {
+        for (const auto &fields : _slots) Apply::ToPtr(fields, batch_idx, ai_comm);
+    }
+};
+
+// Key set -> fused gather for a given AIComm. Populated by FusedGatherRegistrar at static initialization.
+template <typename AIComm>
+class FusedGatherRegistryT {
+public:
+    using Factory = std::function<GatherBase<AIComm> *(const std::vector<AddrEntryT<AIComm>> &, int T)>;
+
+private:
+    std::map<std::string, Factory> _factories;
+
+    static std::string signature(std::vector<std::string> keys) {
+        std::sort(keys.begin(), keys.end());
+        std::string s;
+        for (const auto &key : keys) s += key + ",";
+        return s;
+    }
+
+public:
+    static FusedGatherRegistryT &Get() {
+        static FusedGatherRegistryT registry;
+        return registry;
+    }
+
+    void Add(const std::vector<std::string> &keys, Factory factory) { _factories[signature(keys)] = factory; }
+
+    // Return nullptr if no fused gather matches, so that the caller falls back to the virtual path.
+    GatherBase<AIComm> *Create(const std::vector<std::string> &keys,
+        const std::vector<AddrEntryT<AIComm>> &entries, int T) const {
+        auto it = _factories.find(signature(keys));
+        if (it == _factories.end()) return nullptr;
+        return it->second(entries, T);
+    }
+};
+
+// Usage (in a .cc file):
+//   static FusedGatherRegistrar<AIComm, FieldId<AIComm>, FieldState> _gather({"id", "s"});
+// Keys are listed in the same order as the field types.
+template <typename AIComm, typename... Fields>
+struct FusedGatherRegistrar {
+    FusedGatherRegistrar(const std::vector<std::string> &keys) {
+        FusedGatherRegistryT<AIComm>::Get().Add(keys,
+            [keys](const std::vector<AddrEntryT<AIComm>> &entries, int T) -> GatherBase<AIComm> * {
+                std::unique_ptr<FusedGatherT<AIComm, Fields...>> gather(new FusedGatherT<AIComm, Fields...>());
+                if (! gather->Bind(entries, keys, T)) return nullptr;
+                return gather.release();
+            });
+    }
+};
+
 // DataAddr service
 template <typename AIComm>
 class DataAddrServiceT {
@@ -152,12 +427,19 @@ public:
 private:
     std::vector<AddrEntry> _entries;
     CustomFunc _func = (CustomFunc)nullptr;
+    StagingPoolsT<AIComm> *_pools = nullptr;
+    std::unique_ptr<GatherBase<AIComm>> _gather;
+    bool _streaming = false;
 
 public:
     void RegCustomFunc(CustomFunc func) { _func = func; }
+    void RegStagingPools(StagingPoolsT<AIComm> *pools) { _pools = pools; }
+    // Fields created from now on write their rows with streaming stores (see copy_row()).
+    void SetStreaming(bool streaming) { _streaming = streaming; }
 
     int Create(const DescType &desc) {
         _entries.clear();
+        _gather.reset();
 
         // Check special entries.
         int T = 1;
@@ -191,6 +473,11 @@ public:
                     // reply version
                     sz = SizeType{batchsize};
                     p = new FieldReplyVersion<AIComm>();
+                } else if (key[0] == '&') {
+                    StagingPoolT<AIComm> *pool = _pools != nullptr ? _pools->Get(key.substr(1)) : nullptr;
+                    if (pool == nullptr) throw std::range_error("No staging pool for key in Create(): " + key);
+                    sz = SizeType{batchsize};
+                    p = new FieldStagedRow<AIComm>(pool);
                 } else if (_func != nullptr) {
                     if (! _func(batchsize, key, it->second, &sz, &p))
                       continue;
@@ -198,6 +485,7 @@ public:
 
                 if (p == nullptr) throw std::range_error("Unknown key in Create(): "  + key);
                 p->SetHistLoc(t);
+                p->SetStreaming(_streaming);
 
                 _entries.emplace_back();
                 _entries.back().entry_info.key = key;
@@ -207,6 +495,13 @@ public:
                 _entries.back().addr.reset(p);
             }
         }
+
+        // Pick a fused gather if the created key set has one.
+        std::vector<std::string> keys;
+        for (const auto &entry : _entries) {
+            if (entry.entry_info.hist_loc_for_py == T - 1) keys.push_back(entry.entry_info.key);
+        }
+        _gather.reset(FusedGatherRegistryT<AIComm>::Get().Create(keys, _entries, T));
         return _entries.size();
     }
 
@@ -220,17 +515,20 @@ public:
 
     std::vector<AddrEntry> &entries() { return _entries; }
     const std::vector<AddrEntry> &entries() const { return _entries; }
+    GatherBase<AIComm> *gather() { return _gather.get(); }
 };
 
 // Finally DataAddr
 template <typename AIComm>
 class DataAddrT {
 public:
+    using Comm = AIComm;
     using DataAddrService = DataAddrServiceT<AIComm>;
     using CustomFunc = typename DataAddrService::CustomFunc;
     using AddrEntry = typename DataAddrService::AddrEntry;
     using AddrType = typename AddrEntry::AddrType;
     using CustomFieldFunc = typename DataAddrService::CustomFunc;
+    using StagingPools = StagingPoolsT<AIComm>;
 
 private:
     DataAddrService _input_addrs;
@@ -245,13 +543,42 @@ public:
         _reply_addrs.RegCustomFunc(func);
     }
 
+    // Pooled keys only make sense for inputs.
+    void RegStagingPools(StagingPools *pools) { _input_addrs.RegStagingPools(pools); }
+    // Set before Create() if the collector gathers the inputs (GatherInput()): it writes the
+    // batch tensors without reading them back.
+    void SetCollectorGather(bool collector_gather) { _input_addrs.SetStreaming(collector_gather); }
+
     void GetInput(int batch_idx, const AIComm& ai_comm) {
+        GatherBase<AIComm> *gather = _input_addrs.gather();
+        if (gather != nullptr) {
+            gather->Gather(batch_idx, ai_comm);
+            return;
+        }
         // Copy stuff to input
         for (auto &entry : _input_addrs.entries()) {
             if (entry.addr->valid()) entry.addr->ToPtr(batch_idx, ai_comm);
         }
     }
 
+    // Collector side. Assemble the whole batch on a single thread: with the fused gather
+    // if the key set has one, otherwise field by field, so that each destination tensor
+    // is written contiguously.
+    void GatherInput(const std::vector<const AIComm *> &samples, int n) {
+        GatherBase<AIComm> *gather = _input_addrs.gather();
+        if (gather != nullptr) {
+            for (int batch_idx = 0; batch_idx < n; ++batch_idx) gather->Gather(batch_idx, *samples[batch_idx]);
+        } else {
+            for (auto &entry : _input_addrs.entries()) {
+                if (! entry.addr->valid()) continue;
+                for (int batch_idx = 0; batch_idx < n; ++batch_idx) {
+                    entry.addr->ToPtr(batch_idx, *samples[batch_idx]);
+                }
+            }
+        }
+        copy_row_fence();
+    }
+
     void PutReply(int batch_idx, AIComm &ai_comm) {
         for (const auto &entry : _reply_addrs.entries()) {
             if (entry.addr->valid()) entry.addr->FromPtr(batch_idx, ai_comm);
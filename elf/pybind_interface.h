@@ -33,6 +33,10 @@ void register_common_func(py::module &m) {
   PYCLASS_WITH_FIELDS(m, Infos);
 
   PYCLASS_WITH_FIELDS(m, MetaInfo);
+
+  PYCLASS_WITH_FIELDS(m, LatencyStats);
+  PYCLASS_WITH_FIELDS(m, CollectorStats);
+  PYCLASS_WITH_FIELDS(m, CommLayerStats);
 }
 
 #ifdef GIT_COMMIT_HASH
@@ -47,28 +51,34 @@ void register_common_func(py::module &m) {
   void Steps(const GC::Infos& infos) { context->Steps(infos); } \
   std::string Version() const { return context->Version(); } \
   void PrintSummary() const { context->PrintSummary(); } \
-  int AddCollectors(int batchsize, int hist_len, int num_collectors) { return context->AddCollectors(batchsize, hist_len, num_collectors); } \
+  CommLayerStats GetCommStats() const { return context->GetCommStats(); } \
+  void ResetCommStats() { context->ResetCommStats(); } \
+  int AddCollectors(int batchsize, int hist_len, int num_collectors, int latency_budget_usec, int min_fill) { \
+      return context->AddCollectors(batchsize, hist_len, num_collectors, latency_budget_usec, min_fill); \
+  } \
   const MetaInfo &meta(int i) const { return context->meta(i); } \
   int size() const { return context->size(); } \
-  int CreateTensor(int gid, int id_within_group, const std::string &key, const std::map<std::string, std::string> &desc) {\
+  int CreateTensor(int gid, int id_within_group, const std::string &key, const std::map<std::string, std::string> &desc, int buffer) {\
       if (key == "input") \
-         return context->GetDataAddr(gid, id_within_group).GetInputService().Create(desc); \
+         return context->GetDataAddr(gid, id_within_group, buffer).GetInputService().Create(desc); \
       else if (key == "reply") \
-         return context->GetDataAddr(gid, id_within_group).GetReplyService().Create(desc); \
+         return context->GetDataAddr(gid, id_within_group, buffer).GetReplyService().Create(desc); \
       else throw std::range_error("Invalid key " + key); \
   } \
-  EntryInfo GetTensorInfo(int gid, int id_within_group, const std::string &key, int k) { \
+  EntryInfo GetTensorInfo(int gid, int id_within_group, const std::string &key, int k, int buffer) { \
       if (key == "input") \
-         return context->GetDataAddr(gid, id_within_group).GetInputService().entries()[k].entry_info;\
+         return context->GetDataAddr(gid, id_within_group, buffer).GetInputService().entries()[k].entry_info;\
       else if (key == "reply") \
-        return context->GetDataAddr(gid, id_within_group).GetReplyService().entries()[k].entry_info;\
+        return context->GetDataAddr(gid, id_within_group, buffer).GetReplyService().entries()[k].entry_info;\
       else throw std::range_error("Invalid key " + key); \
   } \
-  void SetTensorAddr(int gid, int id_within_group, const std::string &key, int k, int64_t p, int stride) { \
+  EntryInfo CreateStagingPool(const std::string &key, int depth) { return context->CreateStagingPool(key, depth); } \
+  void SetStagingPoolAddr(const std::string &key, int64_t p, int stride) { context->SetStagingPoolAddr(key, p, stride); } \
+  void SetTensorAddr(int gid, int id_within_group, const std::string &key, int k, int64_t p, int stride, int buffer) { \
       if (key == "input") \
-         context->GetDataAddr(gid, id_within_group).GetInputService().entries()[k].Set(p, stride);\
+         context->GetDataAddr(gid, id_within_group, buffer).GetInputService().entries()[k].Set(p, stride);\
       else if (key == "reply") \
-         context->GetDataAddr(gid, id_within_group).GetReplyService().entries()[k].Set(p, stride);\
+         context->GetDataAddr(gid, id_within_group, buffer).GetReplyService().entries()[k].Set(p, stride);\
       else throw std::range_error("Invalid key " + key); \
   } \
 
@@ -81,12 +91,20 @@ void register_common_func(py::module &m) {
     .def("Steps", &GameContext::Steps, py::call_guard<py::gil_scoped_release>()) \
     .def("Version", &GameContext::Version) \
     .def("PrintSummary", &GameContext::PrintSummary) \
-    .def("AddCollectors", &GameContext::AddCollectors) \
+    .def("GetCommStats", &GameContext::GetCommStats) \
+    .def("ResetCommStats", &GameContext::ResetCommStats) \
+    .def("AddCollectors", &GameContext::AddCollectors, py::arg("batchsize"), py::arg("hist_len"), \
+        py::arg("num_collectors"), py::arg("latency_budget_usec") = 0, py::arg("min_fill") = 1) \
     .def("Start", &GameContext::Start) \
     .def("Stop", &GameContext::Stop) \
     .def("__getitem__", &GameContext::meta) \
     .def("__len__", &GameContext::size) \
-    .def("CreateTensor", &GameContext::CreateTensor) \
-    .def("GetTensorInfo", &GameContext::GetTensorInfo) \
-    .def("SetTensorAddr", &GameContext::SetTensorAddr) \
+    .def("CreateTensor", &GameContext::CreateTensor, py::arg("gid"), py::arg("id_within_group"), \
+        py::arg("key"), py::arg("desc"), py::arg("buffer") = 0) \
+    .def("GetTensorInfo", &GameContext::GetTensorInfo, py::arg("gid"), py::arg("id_within_group"), \
+        py::arg("key"), py::arg("k"), py::arg("buffer") = 0) \
+    .def("SetTensorAddr", &GameContext::SetTensorAddr, py::arg("gid"), py::arg("id_within_group"), \
+        py::arg("key"), py::arg("k"), py::arg("p"), py::arg("stride"), py::arg("buffer") = 0) \
+    .def("CreateStagingPool", &GameContext::CreateStagingPool) \
+    .def("SetStagingPoolAddr", &GameContext::SetStagingPoolAddr) \
 
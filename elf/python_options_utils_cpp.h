@@ -33,6 +33,29 @@ struct ContextOptions {
     // Whether we wait for each group or we wait jointly.
     bool wait_per_group = false;
 
+    // Whether collectors reserve batch slots with atomics instead of locks.
+    bool lock_free_exchange = false;
+
+    // How many batch buffer sets each collector rotates through.
+    // With more than one, games can fill the next batch while the consumer holds the previous one.
+    int num_buffers = 1;
+
+    // If true, games only publish their records, and the collector thread assembles
+    // the batch field by field (column-wise) instead of each game copying its own row.
+    bool collector_gather = false;
+
+    // If true, a game step is a single rendezvous: the record is staged once and taken
+    // directly into each group's batch by the collectors (as in collector_gather), and
+    // the game wakes up once, when the replies of all groups have arrived.
+    bool fan_out = false;
+
+    // How threads wait on the game <-> collector <-> consumer path:
+    //   "park":           block right away (condition variable / kernel semaphore).
+    //   "spin_then_park": spin for up to wait_spin_usec, then block.
+    //   "spin":           never block. Only for threads pinned to their own cores.
+    std::string wait_policy = "park";
+    int wait_spin_usec = 50;
+
     ContextOptions() {}
 
     void print() const {
@@ -42,9 +65,16 @@ struct ContextOptions {
       if (verbose_comm) std::cout << "Comm Verbose On" << std::endl;
       if (verbose_collector) std::cout << "Comm Collector On" << std::endl;
       std::cout << "Wait per group: " << (wait_per_group ? "True" : "False") << std::endl;
+      std::cout << "Lock-free exchange: " << (lock_free_exchange ? "True" : "False") << std::endl;
+      std::cout << "#Buffers: " << num_buffers << std::endl;
+      std::cout << "Collector gather: " << (collector_gather ? "True" : "False") << std::endl;
+      std::cout << "Fan out: " << (fan_out ? "True" : "False") << std::endl;
+      std::cout << "Wait policy: " << wait_policy;
+      if (wait_policy == "spin_then_park") std::cout << " (" << wait_spin_usec << "us)";
+      std::cout << std::endl;
     }
 
-    REGISTER_PYBIND_FIELDS(num_games, max_num_threads, T, verbose_comm, verbose_collector, wait_per_group);
+    REGISTER_PYBIND_FIELDS(num_games, max_num_threads, T, verbose_comm, verbose_collector, wait_per_group, lock_free_exchange, num_buffers, collector_gather, fan_out, wait_policy, wait_spin_usec);
 };
 
 inline constexpr int get_query_id(int game_id, int thread_id) {
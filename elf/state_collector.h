@@ -19,14 +19,97 @@
 #include <atomic>
 #include <thread>
 #include <sstream>
+#include <chrono>
+#include <algorithm>
+#include <stdexcept>
+
+#if defined(__x86_64__) || defined(__i386__)
+  #include <immintrin.h>
+#endif
 
 #include "blockingconcurrentqueue.h"
 #include "pybind_helper.h"
+#include "python_options_utils_cpp.h"
+#include "comm_stats.h"
 #include "ctpl_stl.h"
 
 template <typename T>
 using CCQueue2 = moodycamel::BlockingConcurrentQueue<T>;
 
+// How a thread waits for another one on the game <-> collector <-> consumer path.
+//   PARK:           block right away.
+//   SPIN_THEN_PARK: busy-poll for up to spin_usec, then block for the rest of the timeout.
+//   SPIN:           busy-poll until the condition holds or the timeout expires. Never blocks,
+//                   so it only makes sense when every waiting thread has a core of its own.
+struct WaitPolicy {
+    using Clock = std::chrono::steady_clock;
+    enum Mode { PARK = 0, SPIN_THEN_PARK, SPIN };
+
+    Mode mode = PARK;
+    int spin_usec = 0;
+
+    WaitPolicy() { }
+    WaitPolicy(Mode mode, int spin_usec) : mode(mode), spin_usec(spin_usec) { }
+
+    static WaitPolicy FromOptions(const ContextOptions &options) {
+        if (options.wait_policy == "park") return WaitPolicy(PARK, 0);
+        if (options.wait_policy == "spin_then_park") return WaitPolicy(SPIN_THEN_PARK, std::max(options.wait_spin_usec, 0));
+        if (options.wait_policy == "spin") return WaitPolicy(SPIN, 0);
+        throw std::range_error("Unknown wait_policy: " + options.wait_policy);
+    }
+
+    static inline void relax() {
+#if defined(__x86_64__) || defined(__i386__)
+        _mm_pause();
+#else
+        std::this_thread::yield();
+#endif
+    }
+
+    // Wait until pred() holds. pred() is polled first as the policy says, then
+    // park(usec) blocks for what is left of the timeout (usec <= 0 means no timeout).
+    // Returns true if the condition was met, i.e., pred() or park() returned true.
+    template <typename Pred, typename Park>
+    bool Wait(Pred pred, int usec, Park park) const {
+        if (mode == PARK) return park(usec);
+
+        const bool forever = mode == SPIN && usec <= 0;
+        const int64_t budget = mode == SPIN ? usec : (usec > 0 ? std::min(spin_usec, usec) : spin_usec);
+        const auto start = Clock::now();
+        int64_t elapsed = 0;
+        for (int i = 1; ; ++i) {
+            if (pred()) return true;
+            relax();
+            if ((i & 63) != 0) continue;
+            // Give the core away now and then, so that an oversubscribed machine degrades
+            // instead of stalling until the scheduler preempts us. Cheap if nobody else is runnable.
+            std::this_thread::yield();
+            // Reading the clock costs about as much as a few pauses, so do it every 64 polls.
+            if (! forever) {
+                elapsed = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count();
+                if (elapsed >= budget) break;
+            }
+        }
+        if (mode == SPIN) return pred();
+        if (usec <= 0) return park(0);
+        if (elapsed >= usec) return pred();
+        return park(usec - elapsed);
+    }
+};
+
+template <typename T>
+void dequeue_wait(CCQueue2<T> &q, T &val, const WaitPolicy &wait) {
+    wait.Wait([&]() { return q.try_dequeue(val); }, 0, [&](int) { q.wait_dequeue(val); return true; });
+}
+
+template <typename T>
+bool dequeue_wait_timed(CCQueue2<T> &q, T &val, int time_usec, const WaitPolicy &wait) {
+    // As with wait_dequeue_timed(), a zero timeout only polls once.
+    if (time_usec <= 0) return q.try_dequeue(val);
+    return wait.Wait([&]() { return q.try_dequeue(val); }, time_usec,
+        [&](int usec) { return q.wait_dequeue_timed(val, usec); });
+}
+
 #ifdef USE_TBB
   #include <tbb/concurrent_queue.h>
 
@@ -53,6 +136,17 @@ using CCQueue2 = moodycamel::BlockingConcurrentQueue<T>;
     }
     return true;
   }
+
+  // pop_wait() already spins, so there is nothing to choose here.
+  template <typename T>
+  void pop_wait(CCQueue<T> &q, T &val, const WaitPolicy &) {
+    pop_wait(q, val);
+  }
+
+  template <typename T>
+  bool pop_wait_time(CCQueue<T> &q, T &val, int time_usec, const WaitPolicy &) {
+    return pop_wait_time(q, val, time_usec);
+  }
 #else
   template <typename T>
   using CCQueue = moodycamel::BlockingConcurrentQueue<T>;
@@ -71,17 +165,31 @@ using CCQueue2 = moodycamel::BlockingConcurrentQueue<T>;
   bool pop_wait_time(CCQueue<T> &q, T &val, int time_usec) {
      return q.wait_dequeue_timed(val, time_usec);
   }
+
+  template <typename T>
+  void pop_wait(CCQueue<T> &q, T &val, const WaitPolicy &wait) {
+     dequeue_wait(q, val, wait);
+  }
+
+  template <typename T>
+  bool pop_wait_time(CCQueue<T> &q, T &val, int time_usec, const WaitPolicy &wait) {
+     return dequeue_wait_timed(q, val, time_usec, wait);
+  }
 #endif
 
 class SemaCollector {
 private:
-    int _count;
+    // Written under _mutex, but atomic so that the spin phase can poll it without the lock.
+    std::atomic<int> _count;
     std::mutex _mutex;
     std::condition_variable _cv;
+    WaitPolicy _wait;
 
 public:
     SemaCollector() : _count(0) { }
 
+    void SetWaitPolicy(const WaitPolicy &wait) { _wait = wait; }
+
     inline void notify() {
         std::unique_lock<std::mutex> lock(_mutex);
         _count ++;
@@ -89,14 +197,14 @@ public:
     }
 
     inline int wait(int expected_count, int usec = 0) {
-        std::unique_lock<std::mutex> lock(_mutex);
-        if (usec == 0) {
-            _cv.wait(lock, [this, expected_count]() { return _count >= expected_count; });
-        } else {
-            _cv.wait_for(lock, std::chrono::microseconds(usec),
-                [this, expected_count]() { return _count >= expected_count; });
-        }
-        return _count;
+        auto ready = [this, expected_count]() { return _count.load() >= expected_count; };
+        _wait.Wait(ready, usec, [&](int remaining) {
+            std::unique_lock<std::mutex> lock(_mutex);
+            if (remaining <= 0) _cv.wait(lock, ready);
+            else _cv.wait_for(lock, std::chrono::microseconds(remaining), ready);
+            return ready();
+        });
+        return _count.load();
     }
 
     inline void reset() {
@@ -113,6 +221,7 @@ private:
 
 public:
     Notif() : _flag(false) { }
+    void SetWaitPolicy(const WaitPolicy &wait) { _counter.SetWaitPolicy(wait); }
     const std::atomic_bool &flag() const { return _flag; }
     bool get() const { return _flag.load(); }
     void notify() { _counter.notify(); }
@@ -139,22 +248,30 @@ public:
 template <typename T>
 class Semaphore {
 private:
-    bool _flag;
+    // Written under _mutex together with _val. Atomic so that the spin phase can poll it.
+    std::atomic_bool _flag;
     T _val;
     std::mutex _mutex;
     std::condition_variable _cv;
+    WaitPolicy _wait;
 
+    // Returns with the lock held.
     inline void _raw_wait(std::unique_lock<std::mutex> &lock, int usec) {
-        if (usec == 0) {
-            _cv.wait(lock, [this]() { return _flag; });
-        } else {
-            _cv.wait_for(lock, std::chrono::microseconds(usec),  [this]() { return _flag; });
-        }
+        auto ready = [this]() { return _flag.load(); };
+        _wait.Wait(ready, usec, [&](int remaining) {
+            lock.lock();
+            if (remaining <= 0) _cv.wait(lock, ready);
+            else _cv.wait_for(lock, std::chrono::microseconds(remaining), ready);
+            return _flag.load();
+        });
+        if (! lock.owns_lock()) lock.lock();
     }
 
 public:
     Semaphore() : _flag(false) { }
 
+    void SetWaitPolicy(const WaitPolicy &wait) { _wait = wait; }
+
     inline void notify(T val) {
         std::unique_lock<std::mutex> lock(_mutex);
         _flag = true;
@@ -163,14 +280,14 @@ public:
     }
 
     inline bool wait(T *val, int usec = 0) {
-        std::unique_lock<std::mutex> lock(_mutex);
+        std::unique_lock<std::mutex> lock(_mutex, std::defer_lock);
         _raw_wait(lock, usec);
         if (_flag) *val = _val;
         return _flag;
     }
 
     inline bool wait_and_reset(T *val, int usec = 0) {
-        std::unique_lock<std::mutex> lock(_mutex);
+        std::unique_lock<std::mutex> lock(_mutex, std::defer_lock);
         _raw_wait(lock, usec);
         bool last_flag = _flag;
         if (_flag) *val = _val;
@@ -188,20 +305,84 @@ public:
 // DataAddr::GetInput(const Value &v);
 // DataAddr::PutReply(Value &v) const;
 
+// Count down the samples of one batch and wake the waiter exactly once.
+// The waiter calls Arm(expected) once it knows how many samples it waits for,
+// while each sample calls Done() when it finishes. The counter starts at 0
+// and goes negative for samples that finish before Arm(); whoever brings it
+// back to 0 after Arm() is the only one that signals.
+class CountDownLatch {
+private:
+    std::atomic<int> _pending;
+    Semaphore<int> _done;
+
+public:
+    CountDownLatch() : _pending(0) { }
+
+    void SetWaitPolicy(const WaitPolicy &wait) { _done.SetWaitPolicy(wait); }
+
+    inline void Done() {
+        if (_pending.fetch_sub(1) == 1) _done.notify(0);
+    }
+
+    inline void Arm(int expected) {
+        if (_pending.fetch_add(expected) + expected == 0) return;
+        int dummy;
+        _done.wait_and_reset(&dummy);
+    }
+
+    inline void Reset() {
+        _pending = 0;
+        _done.reset();
+    }
+};
+
 template <typename DataAddr>
 class BatchExchangeT {
+public:
+    using Comm = typename DataAddr::Comm;
+
 private:
+    // If true, batch slots are reserved by an atomic counter over a preallocated
+    // slot array and completion is tracked by CountDownLatch.
+    // Otherwise we use a mutex-protected vector and SemaCollector.
+    const bool _lock_free;
+
     std::mutex _batch_mutex;
     std::vector<int> _batch_data;
+    std::atomic<int> _num_slots;
+
+    // Records published by games in collector gather mode, indexed by batch_idx,
+    // and whether the collector has copied them into the batch. _gathered is written
+    // under _gather_mutex, but atomic so that the spin phase can poll it.
+    std::vector<const Comm *> _samples;
+    std::atomic_bool _gathered;
+    std::mutex _gather_mutex;
+    std::condition_variable _gather_cv;
+    WaitPolicy _wait;
 
     DataAddr _base;
     SemaCollector _sema_input, _sema_reply;
+    CountDownLatch _latch_input, _latch_reply;
 
 public:
+    BatchExchangeT(int batchsize, bool lock_free, const WaitPolicy &wait)
+        : _lock_free(lock_free), _num_slots(0), _samples(batchsize, nullptr), _gathered(false), _wait(wait) {
+        if (_lock_free) _batch_data.resize(batchsize, -1);
+        _sema_input.SetWaitPolicy(wait);
+        _sema_reply.SetWaitPolicy(wait);
+        _latch_input.SetWaitPolicy(wait);
+        _latch_reply.SetWaitPolicy(wait);
+    }
+
     DataAddr &GetBase() { return _base; }
 
     // Each AICommT should call this once and only once.
     int AddBatch(int idx) {
+        if (_lock_free) {
+            int batch_idx = _num_slots.fetch_add(1);
+            _batch_data[batch_idx] = idx;
+            return batch_idx;
+        }
         std::unique_lock<std::mutex> lk_batch{_batch_mutex};
         int batch_idx = _batch_data.size();
         _batch_data.emplace_back(idx);
@@ -209,20 +390,60 @@ public:
         return batch_idx;
     }
 
-    void InputReady() { _sema_input.notify(); }
-    void ReplySaved() { _sema_reply.notify(); }
+    void Publish(int batch_idx, const Comm *v) { _samples[batch_idx] = v; }
+
+    void InputReady() {
+        if (_lock_free) _latch_input.Done();
+        else _sema_input.notify();
+    }
+    void ReplySaved() {
+        if (_lock_free) _latch_reply.Done();
+        else _sema_reply.notify();
+    }
 
     // Daemon side.
+    void Gather() {
+        _base.GatherInput(_samples, size());
+        std::unique_lock<std::mutex> lock(_gather_mutex);
+        _gathered = true;
+        // Every game of the batch may be waiting.
+        _gather_cv.notify_all();
+    }
+    // Records are read by the collector until then, so games should not touch them.
+    void WaitGathered() {
+        auto ready = [this]() { return _gathered.load(); };
+        _wait.Wait(ready, 0, [&](int) {
+            std::unique_lock<std::mutex> lock(_gather_mutex);
+            _gather_cv.wait(lock, ready);
+            return true;
+        });
+    }
+
     void Reset() {
-        _sema_input.reset();
-        _sema_reply.reset();
-        _batch_data.clear();
+        _gathered = false;
+        if (_lock_free) {
+            _latch_input.Reset();
+            _latch_reply.Reset();
+            _num_slots = 0;
+        } else {
+            _sema_input.reset();
+            _sema_reply.reset();
+            _batch_data.clear();
+        }
     }
 
-    const std::vector<int> &batch() const { return _batch_data; }
+    // Number of samples in the current batch, and the game index of each one.
+    int size() const { return _lock_free ? _num_slots.load() : (int)_batch_data.size(); }
+    int game_idx(int batch_idx) const { return _batch_data[batch_idx]; }
 
-    void WaitUntilInputReady(int expected) { _sema_input.wait(expected); }
-    void WaitUntilReplyDispatched() { _sema_reply.wait(_batch_data.size()); }
+    void WaitUntilInputReady(int expected) {
+        if (_lock_free) _latch_input.Arm(expected);
+        else _sema_input.wait(expected);
+    }
+    void WaitUntilReplyDispatched() {
+        if (_lock_free) _latch_reply.Arm(size());
+        else _sema_reply.wait(size());
+    }
 };
 
 template <typename T>
@@ -231,18 +452,27 @@ struct InfosT {
     int id;
     int id_in_group;
     int gid;
+
+    // Index of the buffer set of the collector that holds this batch.
+    int buffer;
+
+    // Number of valid samples in the batch (the fill count).
+    // Rows [batchsize, max_batchsize) of the batch tensors are padding.
     int batchsize;
+    int max_batchsize;
 
-    InfosT(T* collector, int batchsize) : collector(collector), batchsize(batchsize) {
+    InfosT(T* collector, int buffer, int batchsize)
+        : collector(collector), buffer(buffer), batchsize(batchsize), max_batchsize(0) {
         if (collector != nullptr) {
             id = collector->id();
             id_in_group = collector->id_in_group();
             gid = collector->gid();
+            max_batchsize = collector->max_batchsize();
         }
     }
-    InfosT() : collector(nullptr), id(-1), gid(-1), batchsize(0) { }
+    InfosT() : collector(nullptr), id(-1), gid(-1), buffer(0), batchsize(0), max_batchsize(0) { }
 
-    REGISTER_PYBIND_FIELDS(id, gid, id_in_group, batchsize);
+    REGISTER_PYBIND_FIELDS(id, gid, id_in_group, buffer, batchsize, max_batchsize);
 };
 
 enum TaskType { SELECTED_IN_BATCH = 0, REPLY_ARRIVED, NUM_TASK_CMD };
@@ -251,14 +481,21 @@ template <typename T>
 struct TaskSignalT {
     T *collector;
     TaskType type;
-    TaskSignalT() : collector(nullptr), type(NUM_TASK_CMD) { }
-    TaskSignalT(TaskType type, T* collector) : collector(collector), type(type) { }
+    int buffer;
+    TaskSignalT() : collector(nullptr), type(NUM_TASK_CMD), buffer(0) { }
+    TaskSignalT(TaskType type, T* collector, int buffer) : collector(collector), type(type), buffer(buffer) { }
 };
 
 template <typename T>
 struct TaskDataT {
     // #Collectors interested in this sample.
     CCQueue2<TaskSignalT<T>> cmd_q;
+
+    // Fan-out mode. The staged record shared by all groups, the lock that keeps
+    // collectors from reading it while a reply is being saved, and the replies still to come.
+    typename T::Comm *record = nullptr;
+    std::mutex record_mutex;
+    CountDownLatch replies;
 };
 
 template <typename T>
@@ -267,6 +504,7 @@ public:
     using Infos = InfosT<T>;
     using TaskSignal = TaskSignalT<T>;
     using TaskData = TaskDataT<T>;
+    using Comm = typename T::Comm;
 
 private:
     // A queue that contains the current queue of finished batch.
@@ -281,21 +519,31 @@ private:
     // Whether we should terminate.
     Notif _done;
 
+    // Games that passed their check of _done and have not finished their round trip yet.
+    // Once _done is set and this drops to 0, no sample will be sent again.
+    std::atomic<int> _num_sending;
+
     // Lock for printing.
     std::mutex _mutex_cout;
 
+    WaitPolicy _wait;
+
 public:
-    SyncSignalT(int num_games) {
+    SyncSignalT(int num_games, const WaitPolicy &wait = WaitPolicy()) : _num_sending(0), _wait(wait) {
         _data.reset(new std::vector<TaskData>(num_games));
+        for (TaskData &data : *_data) data.replies.SetWaitPolicy(wait);
+        _done.SetWaitPolicy(wait);
     }
 
+    const WaitPolicy &wait_policy() const { return _wait; }
+
     void use_queue_per_group(int num_groups) {
         _queue_per_group.resize(num_groups);
     }
 
-    void push(T *target, int gid, int batchsize) {
-        if (_queue_per_group.empty() || gid == -1) _queue.enqueue(Infos(target, batchsize));
-        else _queue_per_group[gid].enqueue(Infos(target, batchsize));
+    void push(T *target, int gid, int buffer, int batchsize) {
+        if (_queue_per_group.empty() || gid == -1) _queue.enqueue(Infos(target, buffer, batchsize));
+        else _queue_per_group[gid].enqueue(Infos(target, buffer, batchsize));
     }
 
     // From the main thread.
@@ -312,34 +560,54 @@ public:
         // Wait to check if there is any batch from any collectors.
         Infos infos;
         if (time_usec <= 0) {
-            // pop_wait(*q, infos);
-            q->wait_dequeue(infos);
+            dequeue_wait(*q, infos, _wait);
         } else {
-            // if (! pop_wait_time(*q, infos, time_usec)) infos.collector = nullptr;
-            if (! q->wait_dequeue_timed(infos, time_usec)) infos.collector = nullptr;
+            if (! dequeue_wait_timed(*q, infos, time_usec, _wait)) infos.collector = nullptr;
         }
         if (infos.collector == nullptr) infos.id = infos.gid = infos.id_in_group = -1;
         return infos;
     }
 
     // For sender.
-    void select_in_batch(T *target, int idx) {
+    void select_in_batch(T *target, int idx, int buffer) {
         TaskData &data = _data->at(idx);
-        data.cmd_q.enqueue(TaskSignal(SELECTED_IN_BATCH, target));
+        data.cmd_q.enqueue(TaskSignal(SELECTED_IN_BATCH, target, buffer));
     }
 
-    void reply_arrived(T *target, int idx) {
+    void reply_arrived(T *target, int idx, int buffer) {
         TaskData &data = _data->at(idx);
-        data.cmd_q.enqueue(TaskSignal(REPLY_ARRIVED, target));
+        data.cmd_q.enqueue(TaskSignal(REPLY_ARRIVED, target, buffer));
     }
 
     void GetSignal(int idx, TaskSignal *cmd) {
         auto& data = _data->at(idx);
-        data.cmd_q.wait_dequeue(*cmd);
+        dequeue_wait(data.cmd_q, *cmd, _wait);
     }
 
+    // Fan-out mode.
+    // Game side. Stage the record before sending it to the groups, and sleep until n groups have replied.
+    void stage(int idx, Comm *record) { (*_data)[idx].record = record; }
+    void wait_replies(int idx, int n) { (*_data)[idx].replies.Arm(n); }
+    // Collector and consumer side.
+    Comm *record(int idx) { return (*_data)[idx].record; }
+    std::mutex &record_mutex(int idx) { return (*_data)[idx].record_mutex; }
+    void reply_saved(int idx) { (*_data)[idx].replies.Done(); }
+
     Notif &GetDoneNotif() { return _done; }
 
+    // Game side, around a round trip. begin_send() returns false (and nothing should be sent)
+    // once we are done. The count is raised before the flag is read, so a collector that sees
+    // the flag set and the count at 0 knows that every game has stopped sending.
+    bool begin_send() {
+        _num_sending ++;
+        if (! _done.get()) return true;
+        _num_sending --;
+        return false;
+    }
+    void end_send() { _num_sending --; }
+    // Collector side. Once true, it stays true until the next reset of the done notif.
+    bool all_sent() const { return _done.get() && _num_sending.load() == 0; }
+
     // For sync printing.
     void Print(std::ostringstream &ss) {
         std::unique_lock<std::mutex> lock(_mutex_cout);
@@ -356,6 +624,26 @@ public:
 #define PRINT(arg) { std::stringstream ss; ss << arg; _signal->Print(ss.str()); }
 #define V_PRINT(verbose, arg) if (verbose) PRINT(arg)
 
+// Batching policy of a collector group.
+// If latency_budget_usec > 0, a batch is shipped as soon as it is full, or once
+// latency_budget_usec has passed since its first sample arrived and it holds at
+// least min_fill samples. The full size is further adapted online: if fewer
+// requests than a batch are outstanding (sent to the collector and not replied
+// yet), the batch cannot fill up, so we ship at that count instead of waiting
+// for the deadline. Unlike a ship-to-ship arrival rate, the outstanding count
+// does not drop when smaller batches leave fewer games in flight.
+// If latency_budget_usec == 0, we always wait for a full batch.
+struct BatchPolicy {
+    int latency_budget_usec = 0;
+    int min_fill = 1;
+
+    BatchPolicy() { }
+    BatchPolicy(int latency_budget_usec, int min_fill)
+        : latency_budget_usec(latency_budget_usec), min_fill(min_fill) { }
+
+    bool deadline_driven() const { return latency_budget_usec > 0; }
+};
+
 template <typename DataAddr>
 class StateCollectorT {
 public:
@@ -363,69 +651,186 @@ public:
     using StateCollector = StateCollectorT<DataAddr>;
     using SyncSignal = SyncSignalT<StateCollector>;
     using CustomFieldFunc = typename DataAddr::CustomFieldFunc;
+    using StagingPools = typename DataAddr::StagingPools;
+    using Comm = typename DataAddr::Comm;
 
 private:
+    using Clock = std::chrono::steady_clock;
+
+    // Per sample wait of the collector while it drains the games at shutdown.
+    static const int kDrainPollUsec = 100;
+
     const int _id, _id_in_group, _gid;
     int _batchsize;
     SyncSignal *_signal;
 
-    BatchExchange _exchange;
+    BatchPolicy _policy;
+    bool _collector_gather;
+    bool _fan_out;
+    // How the collector waits for samples and for the consumer to release buffers.
+    WaitPolicy _wait;
+    // Outstanding requests, exponentially averaged over batches.
+    double _demand;
+
+    // Each collector rotates through K buffer sets (exchanges). Game threads fill
+    // the current one while the consumer still holds the previous ones.
+    // _released[b] is notified (with the future timeout) once the consumer is
+    // done with buffer b, and the collector reclaims b before filling it again.
+    std::vector<std::unique_ptr<BatchExchange>> _exchanges;
+    std::vector<std::unique_ptr<Semaphore<int>>> _released;
+    std::vector<bool> _in_use;
+    int _curr;
     CCQueue<int> Q;
 
-    Semaphore<int> _wakeup;
-
     bool _verbose;
-    int _num_enqueue, _num_wait, _num_steps;
+    std::atomic<int64_t> _num_enqueue, _num_replied;
+    int _num_wait, _num_steps;
     std::vector<int> _freq_send, _freq_steps;
 
+    // Instrumentation. Each time stamp is written before the queue/semaphore
+    // hand-off that makes it visible to the thread reading it.
+    std::vector<Clock::time_point> _sent;          // per game, at SendData()
+    std::vector<Clock::time_point> _shipped;       // per buffer, when the batch is pushed to the consumer
+    std::vector<Clock::time_point> _received;      // per buffer, when Wait() returns it
+    std::vector<Clock::time_point> _stepped;       // per buffer, at Steps()
+    std::atomic<int64_t> _stats_batches, _stats_samples;
+    LatencyHistogram _send_to_select, _full_to_wait, _consumer_hold, _steps_to_reply;
+
+    // Collector thread, when sample idx is picked for the current batch.
+    void selected(int idx) {
+        _send_to_select.Record(_sent[idx]);
+        if (! _fan_out) {
+            _signal->select_in_batch(this, idx, _curr);
+            return;
+        }
+        // The game is parked until all groups have replied, so we take its record ourselves.
+        BatchExchange &ex = exchange();
+        ex.Publish(ex.AddBatch(idx), _signal->record(idx));
+        ex.InputReady();
+    }
+
+    int adaptive_target(int min_fill) const {
+        if (_demand <= 0.0) return _batchsize;
+        int expected = static_cast<int>(_demand + 0.5);
+        return std::max(min_fill, std::min(_batchsize, expected));
+    }
+
+    // Called once the first sample of a batch is in. Requests in the queue, in the batch and in
+    // the batches the consumer still holds all count: each of them is a game that comes back to
+    // us once it has its reply, whatever the size of the batches.
+    void update_demand() {
+        const double outstanding = static_cast<double>(_num_enqueue.load() - _num_replied.load());
+        _demand = (_demand <= 0.0) ? outstanding : 0.9 * _demand + 0.1 * outstanding;
+    }
+
+    BatchExchange &exchange() { return *_exchanges[_curr]; }
+
+    // In fan-out mode, replies of other groups may be saved into the records while we
+    // read them, so we hold their locks. Locks are taken in game order to avoid deadlocks
+    // with collectors of other groups.
+    void gather_fan_out() {
+        BatchExchange &ex = exchange();
+        std::vector<int> games(ex.size());
+        for (size_t i = 0; i < games.size(); ++i) games[i] = ex.game_idx(i);
+        std::sort(games.begin(), games.end());
+        for (int idx : games) _signal->record_mutex(idx).lock();
+        ex.Gather();
+        for (int idx : games) _signal->record_mutex(idx).unlock();
+    }
+
     void send_batch(int batchsize) {
-        _wakeup.reset();
-        _signal->push(this, _gid, batchsize);
+        if (_fan_out) gather_fan_out();
+        else if (_collector_gather) exchange().Gather();
+        _in_use[_curr] = true;
+        _stats_batches.fetch_add(1, std::memory_order_relaxed);
+        _stats_samples.fetch_add(batchsize, std::memory_order_relaxed);
+        _shipped[_curr] = Clock::now();
+        _signal->push(this, _gid, _curr, batchsize);
     }
-    int wait_batch_used() {
-        int future_timeout;
-        _wakeup.wait(&future_timeout);
+
+    // Wait until the consumer has used buffer b and all its replies are saved.
+    int reclaim_buffer(int b) {
+        int future_timeout = 0;
+        _released[b]->wait_and_reset(&future_timeout);
+
+        BatchExchange &ex = *_exchanges[b];
+        const int n = ex.size();
+        for (int i = 0; i < n; ++i) _freq_steps[ex.game_idx(i)] ++;
+        _num_steps += n;
+
+        V_PRINT(_verbose, "[" << _id << "][" << b << "] Start WaitUntilReplyDispatched");
+        ex.WaitUntilReplyDispatched();
+        ex.Reset();
+        V_PRINT(_verbose, "[" << _id << "][" << b << "] End WaitUntilReplyDispatched");
+        _in_use[b] = false;
         return future_timeout;
     }
 
 public:
     StateCollectorT(int id, int id_in_group, int gid, int batchsize, CustomFieldFunc field_func,
-        SyncSignal *signal, bool verbose = false)
+        StagingPools *pools, SyncSignal *signal, const BatchPolicy &policy, const ContextOptions &context_options)
         : _id(id), _id_in_group(id_in_group), _gid(gid), _batchsize{batchsize}, _signal(signal),
-          _verbose(verbose), _num_wait(0),
-          _num_steps(0), _freq_send(signal->num_games(), 0), _freq_steps(signal->num_games(), 0) {
-        _exchange.GetBase().RegCustomFunc(field_func);
+          _policy(policy), _collector_gather(context_options.collector_gather || context_options.fan_out),
+          _fan_out(context_options.fan_out), _wait(signal->wait_policy()),
+          _demand(0.0),
+          _in_use(std::max(context_options.num_buffers, 1), false), _curr(0),
+          _verbose(context_options.verbose_collector), _num_enqueue(0), _num_replied(0), _num_wait(0),
+          _num_steps(0), _freq_send(signal->num_games(), 0), _freq_steps(signal->num_games(), 0),
+          _sent(signal->num_games()), _shipped(_in_use.size()), _received(_in_use.size()), _stepped(_in_use.size()),
+          _stats_batches(0), _stats_samples(0) {
+        for (size_t b = 0; b < _in_use.size(); ++b) {
+            _exchanges.emplace_back(new BatchExchange(batchsize, context_options.lock_free_exchange, _wait));
+            _exchanges.back()->GetBase().RegCustomFunc(field_func);
+            _exchanges.back()->GetBase().RegStagingPools(pools);
+            _exchanges.back()->GetBase().SetCollectorGather(_collector_gather);
+            _released.emplace_back(new Semaphore<int>());
+            _released.back()->SetWaitPolicy(_wait);
+        }
     }
 
     // AICommT side.
     void SendData(int idx) {
+        _sent[idx] = Clock::now();
         push_q(Q, idx);
         _num_enqueue ++;
         _freq_send[idx] ++;
     }
 
     template <typename Value>
-    int CopyToInput(int idx, const Value& v) {
-        int batch_idx = _exchange.AddBatch(idx);
+    int CopyToInput(int buffer, int idx, const Value& v) {
+        BatchExchange &ex = *_exchanges[buffer];
+        int batch_idx = ex.AddBatch(idx);
         if (_verbose) _signal->Print("After AddBatch");
-        _exchange.GetBase().GetInput(batch_idx, v);
+        if (_collector_gather) ex.Publish(batch_idx, &v);
+        else ex.GetBase().GetInput(batch_idx, v);
         if (_verbose) _signal->Print("After GetInput");
-        _exchange.InputReady();
+        ex.InputReady();
         if (_verbose) _signal->Print("After InputReady");
         return batch_idx;
     }
 
     template <typename Value>
-    void CopyToReply(int batch_idx, Value &v) {
-        _exchange.GetBase().PutReply(batch_idx, v);
-        _exchange.ReplySaved();
+    void CopyToReply(int buffer, int batch_idx, Value &v) {
+        BatchExchange &ex = *_exchanges[buffer];
+        ex.GetBase().PutReply(batch_idx, v);
+        _steps_to_reply.Record(_stepped[buffer]);
+        _num_replied ++;
+        ex.ReplySaved();
+    }
+
+    // In collector gather mode, a game selected in buffer should not modify its record
+    // (e.g., by saving a reply from another collector) until the batch is gathered.
+    void WaitGathered(int buffer) const {
+        if (_collector_gather) _exchanges[buffer]->WaitGathered();
     }
 
     int id() const { return _id; }
     int gid() const { return _gid; }
     int id_in_group() const { return _id_in_group; }
+    int max_batchsize() const { return _batchsize; }
+    int num_buffers() const { return _exchanges.size(); }
 
-    DataAddr &GetDataAddr() { return _exchange.GetBase(); }
+    DataAddr &GetDataAddr(int buffer = 0) { return _exchanges.at(buffer)->GetBase(); }
 
     // Daemon Side.
     // no reentrable
@@ -435,25 +840,62 @@ public:
         int batchsize = 0;
         for (int i = 0; i < _batchsize; ++i) {
             int k;
-            pop_wait(Q, k);
+            pop_wait(Q, k, _wait);
             // Negative index means that it is a fake sample and we skip.
             if (k < 0) continue;
 
             // Once you get the idx, ask them to feed the data.
 
             V_PRINT(_verbose, "Get sample " << k << " cid = " << _id);
-            _signal->select_in_batch(this, k);
+            selected(k);
             batchsize ++;
         }
 
         // Wait until all features are extracted.
         V_PRINT(_verbose, "[" << _id << "] Start WaitUntilInputReady");
-        _exchange.WaitUntilInputReady(batchsize);
+        exchange().WaitUntilInputReady(batchsize);
         V_PRINT(_verbose, "[" << _id << "] Done with WaitUntilInputReady");
         _num_wait ++;
         return batchsize;
     }
 
+    int WaitBatchDataDeadline() {
+        // Fake samples are skipped but counted, as in WaitBatchData().
+        const int min_fill = std::min(std::max(_policy.min_fill, 1), _batchsize);
+        int target = _batchsize;
+        Clock::time_point deadline;
+        int batchsize = 0, num_fake = 0;
+        while (batchsize < target && batchsize + num_fake < _batchsize) {
+            int k;
+            if (batchsize == 0) {
+                // The budget starts from the first sample of the batch.
+                pop_wait(Q, k, _wait);
+                deadline = Clock::now() + std::chrono::microseconds(_policy.latency_budget_usec);
+                update_demand();
+                target = adaptive_target(min_fill);
+            } else {
+                int64_t remaining = std::chrono::duration_cast<std::chrono::microseconds>(deadline - Clock::now()).count();
+                if (remaining <= 0 || ! pop_wait_time(Q, k, remaining, _wait)) {
+                    // Deadline hit. Ship if we have enough, otherwise keep waiting for min_fill.
+                    if (batchsize >= min_fill) break;
+                    pop_wait(Q, k, _wait);
+                }
+            }
+            if (k < 0) {
+                num_fake ++;
+                continue;
+            }
+            V_PRINT(_verbose, "Get sample " << k << " cid = " << _id);
+            selected(k);
+            batchsize ++;
+        }
+
+        // Wait until all features are extracted.
+        exchange().WaitUntilInputReady(batchsize);
+        _num_wait ++;
+        return batchsize;
+    }
+
     int WaitBatchDataUntil(int timeout_usec) {
         // It will skip all fake examples (And does not count them)
         // This enables us to collect all samples, until batchsize = 0.
@@ -461,32 +903,47 @@ public:
         int batchsize = 0;
         while (batchsize < _batchsize) {
             int k;
-            if (! pop_wait_time(Q, k, timeout_usec_per_loop)) break;
+            if (! pop_wait_time(Q, k, timeout_usec_per_loop, _wait)) break;
             if (k < 0) continue;
-            _signal->select_in_batch(this, k);
+            selected(k);
             batchsize ++;
         }
         // Wait until all features are extracted.
-        _exchange.WaitUntilInputReady(batchsize);
+        exchange().WaitUntilInputReady(batchsize);
         _num_wait ++;
         return batchsize;
     }
 
-    void Steps() {
-        V_PRINT(_verbose, "#_exchange.batch() = " << _exchange.batch().size());
-        for (int batch_idx : _exchange.batch()) {
-            V_PRINT(_verbose, "Steps: idx = " << batch_idx << "#game = " << _signal->num_games());
-            _freq_steps[batch_idx] ++;
-            _signal->reply_arrived(this, batch_idx);
-        }
-        _num_steps += _exchange.batch().size();
-        V_PRINT(_verbose, "[" << _id << "] Start WaitUntilReplyDispatched");
-        _exchange.WaitUntilReplyDispatched();
-        _exchange.Reset();
-        V_PRINT(_verbose, "[" << _id << "] End WaitUntilReplyDispatched");
+    // Consumer side. Called once Wait() has returned the batch in buffer.
+    void BatchReceived(int buffer) {
+        _received[buffer] = Clock::now();
+        _full_to_wait.Record(_shipped[buffer]);
     }
 
-    void SignalBatchUsed(int future_timeout) { _wakeup.notify(future_timeout); }
+    // Consumer side. Dispatch the replies of the batch in buffer, and let the
+    // collector reclaim the buffer once all replies are saved.
+    void SignalBatchUsed(int buffer, int future_timeout) {
+        BatchExchange &ex = *_exchanges[buffer];
+        _stepped[buffer] = Clock::now();
+        _consumer_hold.Record(_received[buffer]);
+        const int n = ex.size();
+        V_PRINT(_verbose, "[" << _id << "][" << buffer << "] #batch = " << n);
+        for (int i = 0; i < n; ++i) {
+            int idx = ex.game_idx(i);
+            V_PRINT(_verbose, "Steps: idx = " << idx << "#game = " << _signal->num_games());
+            if (_fan_out) {
+                // Save the reply here, so that the buffer does not wait for the other groups.
+                {
+                    std::lock_guard<std::mutex> lock(_signal->record_mutex(idx));
+                    CopyToReply(buffer, i, *_signal->record(idx));
+                }
+                _signal->reply_saved(idx);
+            } else {
+                _signal->reply_arrived(this, idx, buffer);
+            }
+        }
+        _released[buffer]->notify(future_timeout);
+    }
 
     // For other thread.
     void NotifyAwake() {
@@ -497,37 +954,78 @@ public:
     void MainLoop(int initial_timeout_usec) {
         int timeout_usec = initial_timeout_usec;
         while (true) {
+            // Wait until the consumer is done with the buffer we are about to fill.
+            if (_in_use[_curr]) {
+                V_PRINT(_verbose, "[" << _id << "] about to wait until buffer " << _curr << " is processed");
+                timeout_usec = reclaim_buffer(_curr);
+            }
+            // Switch to wait_until mode. While we drain, wait a little for each sample instead of
+            // spinning on an empty queue.
+            const bool done = _signal->GetDoneNotif().get();
+            if (done) timeout_usec = kDrainPollUsec * _batchsize;
+
             // Wait until we have a complete batch.
-            int batchsize = (timeout_usec <= 0) ? WaitBatchData() : WaitBatchDataUntil(timeout_usec);
+            int batchsize;
+            if (timeout_usec > 0) batchsize = WaitBatchDataUntil(timeout_usec);
+            else if (_policy.deadline_driven()) batchsize = WaitBatchDataDeadline();
+            else batchsize = WaitBatchData();
+
+            if (done && batchsize == 0) {
+                // An empty poll is not enough to leave: a game that checked the done flag just
+                // before it was set may still be about to send, and games whose replies are in
+                // flight have not finished. So keep serving until every game has stopped sending.
+                // Empty batches are not shipped meanwhile, they would crowd the batches of other
+                // collectors out of the consumer queue.
+                if (! _signal->all_sent()) continue;
+                V_PRINT(_verbose, "[" << _id << "] Exit mode: batch size = " << batchsize);
+                // All sample drained, wait until the consumer is done with all buffers and leave.
+                for (int b = 0; b < num_buffers(); ++b) {
+                    if (_in_use[b]) reclaim_buffer(b);
+                }
+                break;
+            }
 
-            V_PRINT(_verbose, "[" << _id << "] about to send batch: batchsize = " << batchsize);
+            V_PRINT(_verbose, "[" << _id << "] about to send batch: batchsize = " << batchsize << " buffer = " << _curr);
             // Signal.
             send_batch(batchsize);
-
-            V_PRINT(_verbose, "[" << _id << "] about to wait until the batch is processed");
-            // Wait until it is processed.
-            timeout_usec = wait_batch_used();
-
-            V_PRINT(_verbose, "[" << _id << "] about to Step()");
-            // Move forward.
-            Steps();
-
-            if (_signal->GetDoneNotif().get()) {
-                // Switch to wait_until mode.
-                timeout_usec = 1;
-                V_PRINT(_verbose, "[" << _id << "] Exit mode: batch size = " << batchsize);
-                // All sample drained, leave.
-                if (batchsize == 0) break;
-            }
+            _curr = (_curr + 1) % num_buffers();
         }
 
         V_PRINT(_verbose, "[" << _id << "] Collector ends. Notify the upper level");
         _signal->GetDoneNotif().notify();
     }
 
+    CollectorStats GetStats() const {
+        CollectorStats stats;
+        stats.id = _id;
+        stats.gid = _gid;
+        stats.id_in_group = _id_in_group;
+        stats.max_batchsize = _batchsize;
+        stats.num_batches = _stats_batches.load();
+        stats.num_samples = _stats_samples.load();
+        stats.send_to_select = _send_to_select.Get();
+        stats.full_to_wait = _full_to_wait.Get();
+        stats.consumer_hold = _consumer_hold.Get();
+        stats.steps_to_reply = _steps_to_reply.Get();
+        return stats;
+    }
+
+    void ResetStats() {
+        _stats_batches = 0;
+        _stats_samples = 0;
+        _send_to_select.Reset();
+        _full_to_wait.Reset();
+        _consumer_hold.Reset();
+        _steps_to_reply.Reset();
+    }
+
     void PrintSummary() const {
         std::cout << "[" << _id << "]: #Enqueue: " << _num_enqueue
                   << ", #Wait: " << _num_wait << ", #Steps: " << _num_steps << std::endl;
+        if (_policy.deadline_driven()) {
+            std::cout << "[" << _id << "]: Budget: " << _policy.latency_budget_usec << "us, MinFill: " << _policy.min_fill
+                      << ", Demand: " << _demand << std::endl;
+        }
         for (size_t i = 0; i < _freq_send.size(); ++i) {
             std::cout << "[" << _id << "][" << i << "]: #Send[" << _freq_send[i] << "/"
                       << (float)_freq_send[i] / _num_enqueue << "],"
@@ -542,6 +1040,7 @@ public:
     using StateCollector = StateCollectorT<DataAddr>;
     using SyncSignal = typename StateCollector::SyncSignal;
     using CustomFieldFunc = typename DataAddr::CustomFieldFunc;
+    using StagingPools = typename DataAddr::StagingPools;
 
 private:
     std::vector<std::unique_ptr<StateCollector>> _collectors;
@@ -562,13 +1061,14 @@ private:
 
 public:
     CollectorGroupT(int start_id, int gid, int batchsize, int hist_len, int num_collectors,
-        CustomFieldFunc field_func, SyncSignal *signal, bool verbose)
+        CustomFieldFunc field_func, StagingPools *pools, SyncSignal *signal, const BatchPolicy &policy,
+        const ContextOptions &context_options)
         : _gid(gid), _hist_len(hist_len), _last_seq(signal->num_games(), -1), _game_counter(signal->num_games(), 0),
-        _pool(num_collectors), _verbose(verbose) {  //(Add by Gao)//
+        _pool(num_collectors), _verbose(context_options.verbose_collector) {  //(Add by Gao)//
         //(Annotate by Gao)//  _g(_rd()), _pool(num_collectors), _verbose(verbose) {
         for (int i = 0; i < num_collectors; ++i) {
             _collectors.emplace_back(
-                new StateCollector(start_id + i, i, gid, batchsize, field_func, signal, verbose));
+                new StateCollector(start_id + i, i, gid, batchsize, field_func, pools, signal, policy, context_options));
             StateCollector *this_collector = _collectors.back().get();
             _pool.push([this_collector, this](int) { this_collector->MainLoop(0); });
         }
@@ -596,6 +1096,12 @@ public:
         std::cout << "Group[" << _gid << "]: HistLen = " << _hist_len << std::endl;
         for (const auto &c : _collectors) c->PrintSummary();
     }
+    void GetStats(std::vector<CollectorStats> *stats) const {
+        for (const auto &c : _collectors) stats->push_back(c->GetStats());
+    }
+    void ResetStats() {
+        for (auto &c : _collectors) c->ResetStats();
+    }
     void NotifyAwake() {
         for (auto &c : _collectors) c->NotifyAwake();
     }
@@ -49,7 +49,8 @@ def print_ptrs(batches):
                 print("[thread=%d][t=%d] %s: %x" % (thread_id, t, k, v.data_ptr()))
 
 
-def _setup_tensor(GC, key, desc, group_id, num_thread, use_numpy=False):
+def _alloc_tensor(info, use_numpy=False):
+    '''Allocate the tensor described by an EntryInfo. Return the tensor, its address and its row stride.'''
     torch_types = {
         "int" : torch.IntTensor,
         "int64_t" : torch.LongTensor,
@@ -63,31 +64,52 @@ def _setup_tensor(GC, key, desc, group_id, num_thread, use_numpy=False):
         'unsigned char': 'byte'
     }
 
+    if not use_numpy:
+        v = torch_types[info.type](*info.sz).pin_memory()
+        p = v.data_ptr()
+        stride = v.stride()[0]
+    else:
+        v = np.zeros(info.sz, dtype=numpy_types[info.type])
+        p = v.ctypes.data
+        stride = v.ctypes.strides[0] // v.dtype.itemsize
+    return v, p, stride
+
+def _setup_staging_pools(GC, descriptions, use_numpy=False):
+    '''Create a staging pool for each pooled input key ("&key"), deep enough for the longest history using it.'''
+    depths = {}
+    for input, _ in descriptions.values():
+        for k in input:
+            if k.startswith("&"):
+                depths[k[1:]] = max(depths.get(k[1:], 1), int(input["_T"]))
+
+    pools = {}
+    for key, depth in depths.items():
+        info = GC.CreateStagingPool(key, depth)
+        v, p, stride = _alloc_tensor(info, use_numpy=use_numpy)
+        GC.SetStagingPoolAddr(key, p, stride)
+        pools[key] = v
+    return pools
+
+def _setup_tensor(GC, key, desc, group_id, num_thread, use_numpy=False, num_buffers=1):
+    # Batches of buffer b of thread i are at b * num_thread + i.
     batches = []
     T = int(desc["_T"])
 
-    for i in range(num_thread):
-        n = GC.CreateTensor(group_id, i, key, desc)
+    for b, i in ((b, i) for b in range(num_buffers) for i in range(num_thread)):
+        n = GC.CreateTensor(group_id, i, key, desc, b)
         batch = [dict() for t in range(T)]
 
         # print("thread = %d" % i)
 
         # Then we get
         for j in range(n):
-            info = GC.GetTensorInfo(group_id, i, key, j)
+            info = GC.GetTensorInfo(group_id, i, key, j, b)
             # Then we use the info to create the tensor.
-            if not use_numpy:
-                v = torch_types[info.type](*info.sz).pin_memory()
-                p = v.data_ptr()
-                stride = v.stride()[0]
-            else:
-                v = np.zeros(info.sz, dtype=numpy_types[info.type])
-                p = v.ctypes.data
-                stride = v.ctypes.strides[0] // v.dtype.itemsize
+            v, p, stride = _alloc_tensor(info, use_numpy=use_numpy)
             # print(info.key + " " + str(info.sz) + " addr: " + str(p) + " stride: " + str(stride))
 
             # Then we set the tensor address and stride.
-            GC.SetTensorAddr(group_id, i, key, j, p, stride)
+            GC.SetTensorAddr(group_id, i, key, j, p, stride, b)
             batch[info.hist_loc_for_py][info.key] = v
 
         batches.append(batch)
@@ -109,6 +131,8 @@ class GCWrapper:
             GC(C++ class): Game Context
             co(C type): context parameters.
             descriptions(list of tuple of dict): descriptions of input and reply entries.
+              An input key ``&key`` stages ``key`` once per game step in ``staging_pools[key]``
+              (shared by all groups), and the batch only gets row indices into it.
             use_numpy(boolean): whether we use numpy array (or PyTorch tensors)
             gpu(int): gpu to use.
             params(dict): additional parameters
@@ -131,6 +155,10 @@ class GCWrapper:
             total_batchsize += int(input["_batchsize"])
         num_recv_thread = math.floor(num_games / total_batchsize)
         num_recv_thread = max(num_recv_thread, 1)
+        num_buffers = max(co.num_buffers, 1)
+
+        # Pools have to exist before the tensors that refer to them.
+        self.staging_pools = _setup_staging_pools(GC, descriptions, use_numpy=use_numpy)
 
         inputs = []
         replies = []
@@ -138,10 +166,13 @@ class GCWrapper:
         for key, (input, reply) in descriptions.items():
             batchsize = int(input["_batchsize"])
             T = int(input["_T"])
-            group_id = GC.AddCollectors(batchsize, T, num_recv_thread)
-            inputs.append(_setup_tensor(GC, "input", input, group_id, num_recv_thread, use_numpy=use_numpy))
+            # Optional deadline-driven batching, see BatchPolicy in state_collector.h
+            latency_budget_usec = int(input.get("_latency_budget_usec", 0))
+            min_fill = int(input.get("_min_fill", 1))
+            group_id = GC.AddCollectors(batchsize, T, num_recv_thread, latency_budget_usec, min_fill)
+            inputs.append(_setup_tensor(GC, "input", input, group_id, num_recv_thread, use_numpy=use_numpy, num_buffers=num_buffers))
             if reply is not None:
-                replies.append(_setup_tensor(GC, "reply", reply, group_id, num_recv_thread, use_numpy=use_numpy))
+                replies.append(_setup_tensor(GC, "reply", reply, group_id, num_recv_thread, use_numpy=use_numpy, num_buffers=num_buffers))
             else:
                 replies.append(None)
             name2idx[key] = group_id
@@ -150,6 +181,7 @@ class GCWrapper:
         self.inputs = inputs
         self.replies = replies
         self.name2idx = name2idx
+        self.num_recv_thread = num_recv_thread
 
     def setup_gpu(self, gpu):
         '''Setup the gpu used in the wrapper'''
@@ -171,14 +203,15 @@ class GCWrapper:
         return True
 
     def _call(self, infos):
-        sel = self.inputs[infos.gid][infos.id_in_group]
+        idx = infos.buffer * self.num_recv_thread + infos.id_in_group
+        sel = self.inputs[infos.gid][idx]
         if self.inputs_gpu is not None:
             sel_gpu = self.inputs_gpu[infos.gid]
             transfer_cpu2gpu(sel, sel_gpu)
         else:
             sel_gpu = None
         if len(self.replies) > infos.gid and self.replies[infos.gid] is not None:
-            reply = self.replies[infos.gid][infos.id_in_group]
+            reply = self.replies[infos.gid][idx]
         else:
             reply = None
 
@@ -211,3 +244,12 @@ class GCWrapper:
     def PrintSummary(self):
         '''Print summary'''
         self.GC.PrintSummary()
+
+    def GetCommStats(self):
+        '''Latency histograms and counters of the comm layer since the last :func:`ResetCommStats()`.
+        Returns a ``CommLayerStats`` with ``send_wait_reply`` and one ``CollectorStats`` per collector.'''
+        return self.GC.GetCommStats()
+
+    def ResetCommStats(self):
+        '''Start a new measurement interval for :func:`GetCommStats()`.'''
+        self.GC.ResetCommStats()
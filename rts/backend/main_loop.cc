@@ -37,7 +37,7 @@ using Parser = CmdLineUtils::CmdLineParser;
 
 bool add_players(const string &args, int frame_skip, RTSGame *game) {
     vector<AI*> bots;
-    //bool mcts = false;
+    AI *mcts = nullptr;
     for (const auto& player : split(args, ',')) {
         cout << "Dealing with player = " << player << endl;
         if (player.find("tcp") == 0) {
@@ -45,17 +45,13 @@ bool add_players(const string &args, int frame_skip, RTSGame *game) {
             int tick_start = (params.size() == 1 ? 0 : std::stoi(params[1]));
             bots.push_back(new TCPAI(INVALID, tick_start, (char *)"tcp://127.0.0.1:8000", nullptr));
         }
-        /*else if (player.find("mcts") == 0) {
+        else if (player.find("mcts") == 0) {
             vector<string> params = split(player, '=');
             int mcts_thread = std::stoi(params[1]);
             int mcts_rollout_per_thread = std::stoi(params[2]);
-            vector<string> prerun_cmds;
-            if (params.size() >= 4) {
-                prerun_cmds = split(params[3], '-');
-            }
-            bots.push_back(new MCTSAI(INVALID, frame_skip, nullptr, mcts_thread, mcts_rollout_per_thread, false, &prerun_cmds));
-            mcts = true;
-        }*/
+            mcts = new MCTSAI(INVALID, frame_skip, nullptr, nullptr, mcts_thread, mcts_rollout_per_thread);
+            bots.push_back(mcts);
+        }
         /*
         else if (player == "simple") {
             //if (mcts) bots[0]->SetFactory([&](int r) -> AI* { return new SimpleAI(INVALID, r, nullptr, nullptr);});
@@ -80,6 +76,8 @@ bool add_players(const string &args, int frame_skip, RTSGame *game) {
         //else if (player == "td_simple") bots.push_back(new TDSimpleAI(INVALID, frame_skip, nullptr));
         //else if (player == "td_built_in") bots.push_back(new TDBuiltInAI(INVALID, frame_skip, nullptr));
         else {
+            // The opponent of MCTS is also its default policy.
+            if (mcts != nullptr) mcts->SetFactory([player](int r) -> AI* { return PlayerSelector::GetPlayer(player, r); });
             bots.push_back(PlayerSelector::GetPlayer(player, frame_skip));
             //cout << "Unknown player! " << player << endl;
             //return false;
@@ -112,10 +110,13 @@ RTSGameOptions GetOptions(const Parser &parser) {
     options.max_tick = parser.GetItem<int>("max_tick");
     options.output_file = parser.GetItem<string>("output_file", "");
     options.save_with_binary_format = parser.GetItem<bool>("binary_io");
+    options.replay_keyframe_interval = parser.GetItem<int>("replay_keyframe_interval", 0);
     options.tick_prompt_n_step = parser.GetItem<int>("tick_prompt_n_step");
     options.seed = parser.GetItem<int>("seed");
     options.cmd_verbose = parser.GetItem<int>("cmd_verbose");
     options.handicap_level = parser.GetItem<int>("handicap_level", 0);
+    options.fow_mode = (FOWMode)parser.GetItem<int>("fow_mode", 0);
+    options.check_fow = parser.GetItem<bool>("check_fow", false);
 
     string ticks = parser.GetItem<string>("peek_ticks", "");
     for (const auto &tick : split(ticks, ',')) {
@@ -157,15 +158,12 @@ RTSGameOptions ai_vs_ai2(const Parser &parser, string *players) {
 
     return options;
 }
-/*
 RTSGameOptions ai_vs_mcts(const Parser &parser, string *players) {
     RTSGameOptions options = GetOptions(parser);
     int mcts_threads = parser.GetItem<int>("mcts_threads");
     int mcts_rollout_per_thread = parser.GetItem<int>("mcts_rollout_per_thread");
-    string str_prerun_cmds = parser.GetItem<string>("mcts_prerun_cmds", "");
 
     *players = "mcts=" + to_string(mcts_threads) + "=" + to_string(mcts_rollout_per_thread);
-    if (! str_prerun_cmds.empty()) *players + "=" + str_prerun_cmds;
     *players += ",simple";
 
     int vis_after = parser.GetItem<int>("vis_after");
@@ -173,7 +171,6 @@ RTSGameOptions ai_vs_mcts(const Parser &parser, string *players) {
 
     return options;
 }
-*/
 RTSGameOptions flag_ai_vs_ai(const Parser &parser, string *players) {
     RTSGameOptions options = GetOptions(parser);
     *players = "flag_simple,flag_simple,dummy";
@@ -335,13 +332,14 @@ int main(int argc, char *argv[]) {
     _init_Level();
     _init_AIState();
     _init_PlayerPrivilege();
+    _init_FOWMode();
     _init_RawMsgStatus();
     _init_CDType();
 
     const map<string, function<RTSGameOptions (const Parser &, string *)> > func_mapping = {
         { "selfplay", ai_vs_ai },
         { "selfplay2", ai_vs_ai2 },
-        //{ "mcts", ai_vs_mcts },
+        { "mcts", ai_vs_mcts },
 
         { "replay", replay },
         { "replay_cmd", replay_cmd },
@@ -360,7 +358,7 @@ int main(int argc, char *argv[]) {
 
     CmdLineUtils::CmdLineParser parser("playstyle --save_replay --load_replay --vis_after[-1] --save_snapshot_prefix --load_snapshot_prefix --seed[0] \
 --load_snapshot_length --max_tick[30000] --binary_io[1] --games[16] --frame_skip[1] --tick_prompt_n_step[2000] --cmd_verbose[0] --peek_ticks --cmd_dumper_prefix \
---output_file[cout] --mcts_threads[16] --mcts_rollout_per_thread[100] --threads[64] --load_binary_string --mcts_verbose --mcts_prerun_cmds --handicap_level[0]");
+--output_file[cout] --mcts_threads[16] --mcts_rollout_per_thread[100] --threads[64] --load_binary_string --mcts_verbose --mcts_prerun_cmds --handicap_level[0] --fow_mode[0] --check_fow[0] --replay_keyframe_interval[0]");
 
     if (! parser.Parse(argc, argv)) {
         cout << parser.PrintHelper() << endl;
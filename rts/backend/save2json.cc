@@ -79,11 +79,13 @@ void save2json::SavePlayerMap(const Player& player, json *game) {
     rts_map["width"] = m.GetXSize();
     rts_map["height"] = m.GetYSize();
     json slots;
+    vector<char> visible(m.GetXSize());
     for (int y = 0; y < m.GetYSize(); y ++) {
+        player.GetVisibility().Unpack(m.GetLoc(0, y, 0), m.GetXSize(), (char)1, &visible[0]);
         for (int x = 0; x < m.GetXSize(); x ++) {
             Loc loc = m.GetLoc(x, y, 0);
             Terrain t = FOG;
-            if (player.CanSeeTerrain(loc)) {
+            if (visible[x]) {
                 if (m(loc).type == NORMAL) t = NORMAL;
                 else if (m(loc).type == IMPASSABLE) t = IMPASSABLE;
             }
@@ -0,0 +1,288 @@
+/**
+* Copyright (c) 2017-present, Facebook, Inc.
+* All rights reserved.
+*
+* This source code is licensed under the BSD-style license found in the
+* LICENSE file in the root directory of this source tree. An additional grant
+* of patent rights can be found in the PATENTS file in the same directory.
+*/
+
+//File: benchmark-fork.cc
+// Benchmark of branching MiniRTS games with GameEnv::Fork() and CmdReceiver::Fork(), against
+// a snapshot saved and loaded into a new game (the way to branch a game before Fork()).
+// For every (seed, tick), simple plays hit_and_run up to that tick. Then
+//   fork:     the time to fork the game, and to fork it and run one tick (which copies what
+//             the tick changes);
+//   snapshot: the same with a snapshot.
+// Forked games run --rollout ticks with new bots, both one after another and on --threads
+// threads at once. They all have to end in the same state as a game loaded from the snapshot,
+// and the game they were forked from must not change.
+//
+//   make -C ../game_MC && make && ./benchmark-fork.bin --seeds=1,2,3 --ticks=500,2000,5000
+//     --iters=1000 --rollout=100 --threads=4 --output=fork.json
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "json.hpp"
+#include "../engine/game.h"
+#include "../engine/cmd.gen.h"
+#include "../engine/cmd_specific.gen.h"
+#include "cmd_specific.gen.h"
+#include "player_selector.h"
+#include "../engine/wrapper_template.h"
+
+using json = nlohmann::json;
+using Clock = std::chrono::steady_clock;
+
+static const std::vector<std::pair<std::string, std::string>> kDefaults = {
+  {"seeds", "1,2,3"},
+  {"ticks", "500,2000,5000"},
+  {"iters", "1000"},
+  {"rollout", "100"},
+  {"threads", "4"},
+};
+
+static std::vector<int> parse_list(const std::string &key, const std::string &s) {
+  std::vector<int> values;
+  std::stringstream ss(s);
+  std::string item;
+  while (std::getline(ss, item, ',')) {
+    try {
+      values.push_back(std::stoi(item));
+    } catch (const std::exception &) {
+      throw std::invalid_argument("Bad value for --" + key + ": " + s);
+    }
+  }
+  if (values.empty()) throw std::invalid_argument("Empty value for --" + key);
+  return values;
+}
+
+// A game outside of RTSGame.
+struct Branch {
+  std::unique_ptr<GameEnv> env;
+  std::unique_ptr<CmdReceiver> receiver;
+};
+
+static Branch fork_game(const GameEnv &env, const CmdReceiver &receiver) {
+  Branch b;
+  b.env = env.Fork();
+  b.receiver = receiver.Fork();
+  return b;
+}
+
+static void save(const GameEnv &env, const CmdReceiver &receiver, std::string *s) {
+  s->clear();
+  serializer::saver saver(s);
+  env.SaveSnapshot(saver);
+  receiver.SaveCmdReceiver(saver);
+}
+
+static Branch load_game(const std::string &s) {
+  Branch b;
+  b.env.reset(new GameEnv());
+  b.env->InitGameDef();
+  b.receiver.reset(new CmdReceiver());
+  serializer::loader loader(s.data(), s.size());
+  b.env->LoadSnapshot(loader);
+  b.receiver->LoadCmdReceiver(loader);
+  return b;
+}
+
+static std::string save_env(const GameEnv &env) {
+  std::string s;
+  serializer::saver saver(&s);
+  env.SaveSnapshot(saver);
+  return s;
+}
+
+// Run num_ticks ticks as RTSGame::StepInPlace() does, with new bots.
+static void rollout(Branch *b, int num_ticks) {
+  std::vector<std::unique_ptr<AI>> bots;
+  bots.emplace_back(PlayerSelector::GetPlayer("simple", 1));
+  bots.emplace_back(PlayerSelector::GetPlayer("hit_and_run", 1));
+  for (size_t i = 0; i < bots.size(); ++i) {
+    bots[i]->SetId(i);
+    bots[i]->SetCmdReceiver(b->receiver.get());
+  }
+
+  GameEnv &env = *b->env;
+  CmdReceiver &receiver = *b->receiver;
+  for (int i = 0; i < num_ticks; ++i) {
+    for (const auto &bot : bots) bot->Act(env);
+    env.Forward(&receiver);
+    receiver.ExecuteDurativeCmds(env, false);
+    receiver.ExecuteImmediateCmds(&env, false);
+    env.ComputeFOW();
+    if (env.GetGameDef().CheckWinner(env, false) != INVALID) break;
+    receiver.IncTick();
+  }
+}
+
+// Average usec per call of f over iters calls.
+template <typename F>
+static double time_usec(int iters, F f) {
+  auto start = Clock::now();
+  for (int i = 0; i < iters; ++i) f();
+  return std::chrono::duration<double, std::micro>(Clock::now() - start).count() / iters;
+}
+
+static json run(int seed, int tick, int iters, int rollout_ticks, int num_threads, int *errors) {
+  RTSGameOptions options;
+  options.seed = seed;
+  options.max_tick = tick;
+  options.save_replay_prefix = "";
+  options.tick_prompt_n_step = 0;
+
+  RTSGame game(options);
+  game.AddBot(PlayerSelector::GetPlayer("simple", 1));
+  game.AddBot(PlayerSelector::GetPlayer("hit_and_run", 1));
+  game.MainLoop();
+
+  const GameEnv &env = game.GetGameEnv();
+  const CmdReceiver &receiver = *game.GetCmdReceiver();
+
+  std::string state;
+  save(env, receiver, &state);
+  const std::string parent_env = save_env(env);
+
+  // Forked games have to end where a loaded game ends. Only the GameEnv is compared, as cmd
+  // ids are renumbered by a load.
+  Branch loaded = load_game(state);
+  rollout(&loaded, rollout_ticks);
+  const std::string expected = save_env(*loaded.env);
+
+  Branch forked = fork_game(env, receiver);
+  rollout(&forked, rollout_ticks);
+  if (save_env(*forked.env) != expected) {
+    std::cerr << "seed " << seed << " tick " << tick << ": a forked game differs from a loaded one" << std::endl;
+    ++*errors;
+  }
+
+  std::vector<Branch> branches;
+  for (int i = 0; i < num_threads; ++i) branches.push_back(fork_game(env, receiver));
+  std::vector<std::thread> threads;
+  auto start = Clock::now();
+  for (auto &b : branches) threads.emplace_back([&b, rollout_ticks]() { rollout(&b, rollout_ticks); });
+  for (auto &t : threads) t.join();
+  const double threads_usec = std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+  for (const auto &b : branches) {
+    if (save_env(*b.env) != expected) {
+      std::cerr << "seed " << seed << " tick " << tick << ": a game forked on another thread differs" << std::endl;
+      ++*errors;
+      break;
+    }
+  }
+  if (save_env(env) != parent_env) {
+    std::cerr << "seed " << seed << " tick " << tick << ": forked games changed their parent" << std::endl;
+    ++*errors;
+  }
+
+  std::string s;
+  json result;
+  result["seed"] = seed;
+  result["tick"] = receiver.GetTick();
+  result["num_units"] = env.GetUnits().size();
+  result["bytes"] = state.size();
+  const double fork_usec = time_usec(iters, [&]() { fork_game(env, receiver); });
+  result["branch_usec"] = {
+    {"fork", fork_usec},
+    {"snapshot", time_usec(iters, [&]() { save(env, receiver, &s); load_game(s); })},
+  };
+  result["branch_and_tick_usec"] = {
+    {"fork", time_usec(iters, [&]() { Branch b = fork_game(env, receiver); rollout(&b, 1); })},
+    {"snapshot", time_usec(iters, [&]() { save(env, receiver, &s); Branch b = load_game(s); rollout(&b, 1); })},
+  };
+  result["forks_per_sec"] = 1e6 / fork_usec;
+  result["rollout_usec"] = {
+    {"ticks", rollout_ticks},
+    {"threads", num_threads},
+    {"wall", threads_usec},
+  };
+  return result;
+}
+
+int main(int argc, char **argv) {
+  std::map<std::string, std::string> args(kDefaults.begin(), kDefaults.end());
+  std::string output = "-";
+
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    size_t eq = arg.find('=');
+    if (arg.compare(0, 2, "--") != 0 || eq == std::string::npos) {
+      std::cerr << "Usage: " << argv[0] << " [--output=file.json]";
+      for (const auto &kv : kDefaults) std::cerr << " [--" << kv.first << "=" << kv.second << "]";
+      std::cerr << std::endl;
+      return 1;
+    }
+    std::string key = arg.substr(2, eq - 2);
+    std::string value = arg.substr(eq + 1);
+    if (key == "output") {
+      output = value;
+    } else if (args.find(key) == args.end()) {
+      std::cerr << "Unknown option --" << key << std::endl;
+      return 1;
+    } else {
+      args[key] = value;
+    }
+  }
+
+  std::vector<int> seeds, ticks;
+  int iters = 0, rollout_ticks = 0, num_threads = 0;
+  try {
+    seeds = parse_list("seeds", args["seeds"]);
+    ticks = parse_list("ticks", args["ticks"]);
+    iters = parse_list("iters", args["iters"])[0];
+    rollout_ticks = parse_list("rollout", args["rollout"])[0];
+    num_threads = parse_list("threads", args["threads"])[0];
+  } catch (const std::invalid_argument &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+
+  init_enums();
+  reg_engine();
+  reg_engine_specific();
+  reg_minirts_specific();
+
+  json report;
+  report["benchmark"] = "fork";
+#ifdef GIT_COMMIT_HASH
+#define STRINGIFY(x) #x
+#define TOSTRING(x) STRINGIFY(x)
+  report["version"] = TOSTRING(GIT_COMMIT_HASH) "_" TOSTRING(GIT_UNSTAGED);
+#else
+  report["version"] = "";
+#endif
+  report["results"] = json::array();
+
+  int errors = 0;
+  for (int seed : seeds) {
+    for (int tick : ticks) {
+      json result = run(seed, tick, iters, rollout_ticks, num_threads, &errors);
+      std::cerr << "seed " << seed << " tick " << result["tick"] << " units " << result["num_units"]
+        << " forks/sec " << result["forks_per_sec"].get<double>()
+        << " branch usec fork/snapshot: " << result["branch_usec"]["fork"].get<double>()
+        << "/" << result["branch_usec"]["snapshot"].get<double>()
+        << " branch+tick usec fork/snapshot: " << result["branch_and_tick_usec"]["fork"].get<double>()
+        << "/" << result["branch_and_tick_usec"]["snapshot"].get<double>() << std::endl;
+      report["results"].push_back(result);
+    }
+  }
+  report["errors"] = errors;
+
+  if (output == "-") {
+    std::cout << report.dump(2) << std::endl;
+  } else {
+    std::ofstream f(output);
+    f << report.dump(2) << std::endl;
+  }
+  return errors == 0 ? 0 : 2;
+}
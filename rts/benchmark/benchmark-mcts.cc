@@ -0,0 +1,232 @@
+/**
+* Copyright (c) 2017-present, Facebook, Inc.
+* All rights reserved.
+*
+* This source code is licensed under the BSD-style license found in the
+* LICENSE file in the root directory of this source tree. An additional grant
+* of patent rights can be found in the PATENTS file in the same directory.
+*/
+
+//File: benchmark-mcts.cc
+// Benchmark of MCTSAI in pure-rollout mode (no network), against the rule AIs it uses as
+// default policy. For every seed, up to --ticks ticks with --frame_skip:
+//   rule: simple plays hit_and_run, the game ticks per second of one core;
+//   mcts: MCTSAI with --threads threads of --playouts playouts per search plays simple (also its
+//         default policy, for --rollout ticks after each leaf). Playouts per second per core of
+//         search, and the game ticks they simulate, which compare with the rule AI ticks.
+// Every playout has to visit the root, so the root visits of every search add up to its playouts.
+//
+//   make -C ../game_MC && make && ./benchmark-mcts.bin --seeds=1,2 --threads=1,2,4 --playouts=25
+//     --ticks=2000 --frame_skip=50 --rollout=200 --output=mcts.json
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <numeric>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "json.hpp"
+#include "../engine/game.h"
+#include "../engine/cmd.gen.h"
+#include "../engine/cmd_specific.gen.h"
+#include "cmd_specific.gen.h"
+#include "player_selector.h"
+#include "../engine/wrapper_template.h"
+
+using json = nlohmann::json;
+using Clock = std::chrono::steady_clock;
+
+static const std::vector<std::pair<std::string, std::string>> kDefaults = {
+  {"seeds", "1,2"},
+  {"threads", "1,2,4"},
+  {"playouts", "25"},
+  {"ticks", "2000"},
+  {"frame_skip", "50"},
+  {"rollout", "200"},
+};
+
+static std::vector<int> parse_list(const std::string &key, const std::string &s) {
+  std::vector<int> values;
+  std::stringstream ss(s);
+  std::string item;
+  while (std::getline(ss, item, ',')) {
+    try {
+      values.push_back(std::stoi(item));
+    } catch (const std::exception &) {
+      throw std::invalid_argument("Bad value for --" + key + ": " + s);
+    }
+  }
+  if (values.empty()) throw std::invalid_argument("Empty value for --" + key);
+  return values;
+}
+
+static RTSGameOptions game_options(int seed, int ticks) {
+  RTSGameOptions options;
+  options.seed = seed;
+  options.max_tick = ticks;
+  options.save_replay_prefix = "";
+  options.tick_prompt_n_step = 0;
+  return options;
+}
+
+// Checks each search of an MCTSAI as it plays.
+class CheckedMCTSAI : public MCTSAI {
+public:
+  CheckedMCTSAI(int frame_skip, int num_threads, int playouts_per_thread, int rollout_ticks, int *errors)
+    : MCTSAI(INVALID, frame_skip, nullptr, nullptr, num_threads, playouts_per_thread, rollout_ticks),
+      _errors(errors) {
+  }
+
+  bool Act(const GameEnv &env, bool must_act = false) override {
+    const int64_t playouts = GetNumPlayouts();
+    bool acted = MCTSAI::Act(env, must_act);
+    if (GetNumPlayouts() == playouts) return acted;
+    _num_searches ++;
+    const auto &visits = GetLastSearch().visits;
+    if (std::accumulate(visits.begin(), visits.end(), 0) != GetLastSearch().playouts) {
+      std::cerr << "tick " << _receiver->GetTick() << ": root visits do not add up to the playouts" << std::endl;
+      ++*_errors;
+    }
+    return acted;
+  }
+
+  int GetNumSearches() const { return _num_searches; }
+
+private:
+  int *_errors;
+  int _num_searches = 0;
+};
+
+static json run_rule(int seed, int ticks, int frame_skip) {
+  RTSGame game(game_options(seed, ticks));
+  game.AddBot(PlayerSelector::GetPlayer("simple", frame_skip));
+  game.AddBot(PlayerSelector::GetPlayer("hit_and_run", frame_skip));
+  auto start = Clock::now();
+  PlayerId winner = game.MainLoop();
+  const double sec = std::chrono::duration<double>(Clock::now() - start).count();
+
+  json result;
+  result["ticks"] = game.GetCmdReceiver()->GetTick();
+  result["winner"] = winner;
+  result["ticks_per_sec"] = game.GetCmdReceiver()->GetTick() / sec;
+  return result;
+}
+
+static json run_mcts(int seed, int ticks, int frame_skip, int num_threads, int playouts_per_thread,
+    int rollout_ticks, int *errors) {
+  RTSGame game(game_options(seed, ticks));
+  CheckedMCTSAI *mcts = new CheckedMCTSAI(frame_skip, num_threads, playouts_per_thread, rollout_ticks, errors);
+  mcts->SetFactory([](int r) -> AI* { return PlayerSelector::GetPlayer("simple", r); });
+  game.AddBot(mcts);
+  game.AddBot(PlayerSelector::GetPlayer("simple", frame_skip));
+  auto start = Clock::now();
+  PlayerId winner = game.MainLoop();
+  const double sec = std::chrono::duration<double>(Clock::now() - start).count();
+
+  const double search_sec = mcts->GetSearchSeconds();
+  const double per_core = mcts->GetNumPlayouts() / (search_sec * num_threads);
+  json result;
+  result["threads"] = num_threads;
+  result["ticks"] = game.GetCmdReceiver()->GetTick();
+  result["winner"] = winner;
+  result["searches"] = mcts->GetNumSearches();
+  result["playouts"] = mcts->GetNumPlayouts();
+  result["search_sec"] = search_sec;
+  result["game_sec"] = sec;
+  result["playouts_per_sec"] = mcts->GetNumPlayouts() / search_sec;
+  result["playouts_per_sec_per_core"] = per_core;
+  // Each playout forks and plays one edge (frame_skip ticks), then forks and rolls out.
+  result["simulated_ticks_per_sec_per_core"] = per_core * (frame_skip + rollout_ticks);
+  return result;
+}
+
+int main(int argc, char **argv) {
+  std::map<std::string, std::string> args(kDefaults.begin(), kDefaults.end());
+  std::string output = "-";
+
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    size_t eq = arg.find('=');
+    if (arg.compare(0, 2, "--") != 0 || eq == std::string::npos) {
+      std::cerr << "Usage: " << argv[0] << " [--output=file.json]";
+      for (const auto &kv : kDefaults) std::cerr << " [--" << kv.first << "=" << kv.second << "]";
+      std::cerr << std::endl;
+      return 1;
+    }
+    std::string key = arg.substr(2, eq - 2);
+    std::string value = arg.substr(eq + 1);
+    if (key == "output") {
+      output = value;
+    } else if (args.find(key) == args.end()) {
+      std::cerr << "Unknown option --" << key << std::endl;
+      return 1;
+    } else {
+      args[key] = value;
+    }
+  }
+
+  std::vector<int> seeds, threads;
+  int playouts = 0, ticks = 0, frame_skip = 0, rollout_ticks = 0;
+  try {
+    seeds = parse_list("seeds", args["seeds"]);
+    threads = parse_list("threads", args["threads"]);
+    playouts = parse_list("playouts", args["playouts"])[0];
+    ticks = parse_list("ticks", args["ticks"])[0];
+    frame_skip = parse_list("frame_skip", args["frame_skip"])[0];
+    rollout_ticks = parse_list("rollout", args["rollout"])[0];
+  } catch (const std::invalid_argument &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+
+  init_enums();
+  reg_engine();
+  reg_engine_specific();
+  reg_minirts_specific();
+
+  json report;
+  report["benchmark"] = "mcts";
+#ifdef GIT_COMMIT_HASH
+#define STRINGIFY(x) #x
+#define TOSTRING(x) STRINGIFY(x)
+  report["version"] = TOSTRING(GIT_COMMIT_HASH) "_" TOSTRING(GIT_UNSTAGED);
+#else
+  report["version"] = "";
+#endif
+  report["frame_skip"] = frame_skip;
+  report["playouts_per_thread"] = playouts;
+  report["rollout_ticks"] = rollout_ticks;
+  report["results"] = json::array();
+
+  int errors = 0;
+  for (int seed : seeds) {
+    json result;
+    result["seed"] = seed;
+    result["rule"] = run_rule(seed, ticks, frame_skip);
+    std::cerr << "seed " << seed << " rule ticks/sec " << result["rule"]["ticks_per_sec"].get<double>() << std::endl;
+    result["mcts"] = json::array();
+    for (int num_threads : threads) {
+      json mcts = run_mcts(seed, ticks, frame_skip, num_threads, playouts, rollout_ticks, &errors);
+      std::cerr << "seed " << seed << " threads " << num_threads << " searches " << mcts["searches"]
+        << " playouts/sec " << mcts["playouts_per_sec"].get<double>()
+        << " playouts/sec/core " << mcts["playouts_per_sec_per_core"].get<double>()
+        << " simulated ticks/sec/core " << mcts["simulated_ticks_per_sec_per_core"].get<double>()
+        << " winner " << mcts["winner"] << std::endl;
+      result["mcts"].push_back(mcts);
+    }
+    report["results"].push_back(result);
+  }
+  report["errors"] = errors;
+
+  if (output == "-") {
+    std::cout << report.dump(2) << std::endl;
+  } else {
+    std::ofstream f(output);
+    f << report.dump(2) << std::endl;
+  }
+  return errors == 0 ? 0 : 2;
+}
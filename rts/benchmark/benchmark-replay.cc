@@ -0,0 +1,375 @@
+/**
+* Copyright (c) 2017-present, Facebook, Inc.
+* All rights reserved.
+*
+* This source code is licensed under the BSD-style license found in the
+* LICENSE file in the root directory of this source tree. An additional grant
+* of patent rights can be found in the PATENTS file in the same directory.
+*/
+
+//File: benchmark-replay.cc
+// Benchmark of indexed replays (.rpx, see replay_file.h) against the text replays (.rep) of
+// CmdReceiver::SaveReplay(). For every seed, simple plays hit_and_run for up to --ticks ticks,
+// and the game is saved both ways (with a keyframe every --keyframe_interval ticks). Then
+//   size:   the bytes of both files;
+//   open:   the time to read the index of a .rpx, against loading a whole .rep, and what that
+//           makes for a corpus of --corpus replays (with the files in the page cache);
+//   load:   the time to load the cmds of both into a CmdReceiver;
+//   seek:   the time to seek to --seeks random ticks, against playing the replay from tick 0
+//           (the way to seek without keyframes or snapshot files).
+// Playing the replay from each keyframe up to the next one has to give the next keyframe, and
+// every seek has to give the game played from tick 0. Truncated and damaged copies of the .rpx
+// have to be rejected by Open() or by a std::range_error.
+//
+//   make -C ../game_MC && make && ./benchmark-replay.bin --seeds=1,2,3 --ticks=5000
+//     --keyframe_interval=500 --seeks=20 --iters=200 --corpus=10000 --output=replay.json
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#include "json.hpp"
+#include "../engine/game.h"
+#include "../engine/replay_file.h"
+#include "../engine/cmd.gen.h"
+#include "../engine/cmd_specific.gen.h"
+#include "cmd_specific.gen.h"
+#include "player_selector.h"
+#include "../engine/wrapper_template.h"
+
+using json = nlohmann::json;
+using Clock = std::chrono::steady_clock;
+
+static const std::vector<std::pair<std::string, std::string>> kDefaults = {
+  {"seeds", "1,2,3"},
+  {"ticks", "5000"},
+  {"keyframe_interval", "500"},
+  {"seeks", "20"},
+  {"iters", "200"},
+  {"corpus", "10000"},
+};
+
+static std::vector<int> parse_list(const std::string &key, const std::string &s) {
+  std::vector<int> values;
+  std::stringstream ss(s);
+  std::string item;
+  while (std::getline(ss, item, ',')) {
+    try {
+      values.push_back(std::stoi(item));
+    } catch (const std::exception &) {
+      throw std::invalid_argument("Bad value for --" + key + ": " + s);
+    }
+  }
+  if (values.empty()) throw std::invalid_argument("Empty value for --" + key);
+  return values;
+}
+
+// A game outside of RTSGame, playing a replay.
+struct Playback {
+  std::unique_ptr<GameEnv> env;
+  std::unique_ptr<CmdReceiver> receiver;
+};
+
+static Playback load_playback(const std::string &filename) {
+  Playback p;
+  p.env.reset(new GameEnv());
+  p.env->InitGameDef();
+  p.receiver.reset(new CmdReceiver());
+  if (! p.receiver->LoadReplay(filename)) throw std::range_error("Cannot load " + filename);
+  return p;
+}
+
+static std::string save_env(const GameEnv &env) {
+  std::string s;
+  serializer::saver saver(&s);
+  env.SaveSnapshot(saver);
+  return s;
+}
+
+static std::string read_file(const std::string &filename) {
+  std::ifstream f(filename, std::ios::binary);
+  std::stringstream ss;
+  ss << f.rdbuf();
+  return ss.str();
+}
+
+static void write_file(const std::string &filename, const std::string &s) {
+  std::ofstream f(filename, std::ios::binary | std::ios::trunc);
+  f.write(s.data(), s.size());
+}
+
+// Number of damaged copies of rpx that are not rejected cleanly.
+static int check_damaged(const std::string &rpx, std::mt19937 *rng) {
+  const std::string content = read_file(rpx);
+  const std::string damaged = rpx + ".damaged";
+  std::vector<std::string> copies;
+  // Truncated anywhere.
+  for (int i = 0; i < 20; ++i) {
+    copies.push_back(content.substr(0, std::uniform_int_distribution<size_t>(0, content.size() - 1)(*rng)));
+  }
+  // Huge index offset or size in the trailer, and random bytes anywhere (block headers included).
+  for (size_t pos : { content.size() - 24, content.size() - 20, content.size() - 16 }) {
+    std::string s = content;
+    s[pos + 3] = '\x7f';
+    copies.push_back(s);
+  }
+  for (int i = 0; i < 20; ++i) {
+    std::string s = content;
+    for (int j = 0; j < 4; ++j) {
+      s[std::uniform_int_distribution<size_t>(0, s.size() - 1)(*rng)] = (char)(*rng)();
+    }
+    copies.push_back(s);
+  }
+
+  int errors = 0;
+  for (const std::string &s : copies) {
+    write_file(damaged, s);
+    ReplayReader reader;
+    try {
+      if (! reader.Open(damaged)) continue;
+      std::vector<CmdBPtr> cmds;
+      reader.ReadCmds(&cmds);
+      GameEnv env;
+      env.InitGameDef();
+      CmdReceiver receiver;
+      for (int i = 0; i < (int)reader.GetIndex().keyframes.size(); ++i) reader.LoadKeyframe(i, &env, &receiver);
+    } catch (const std::range_error &) {
+    } catch (const std::exception &e) {
+      std::cerr << "damaged " << rpx << " (" << s.size() << " bytes): " << e.what() << std::endl;
+      ++errors;
+    }
+  }
+  std::remove(damaged.c_str());
+  return errors;
+}
+
+static long file_size(const std::string &filename) {
+  std::ifstream f(filename, std::ios::binary | std::ios::ate);
+  return f ? (long)f.tellg() : -1;
+}
+
+// Average usec per call of f over iters calls.
+template <typename F>
+static double time_usec(int iters, F f) {
+  auto start = Clock::now();
+  for (int i = 0; i < iters; ++i) f();
+  return std::chrono::duration<double, std::micro>(Clock::now() - start).count() / iters;
+}
+
+static json run(const std::string &dir, int seed, int ticks, int keyframe_interval, int num_seeks, int iters,
+    int corpus, int *errors) {
+  RTSGameOptions options;
+  options.seed = seed;
+  options.max_tick = ticks;
+  options.save_replay_prefix = dir + "/" + std::to_string(seed) + "-";
+  options.replay_keyframe_interval = keyframe_interval;
+  options.tick_prompt_n_step = 0;
+
+  RTSGame game(options);
+  game.AddBot(PlayerSelector::GetPlayer("simple", 1));
+  game.AddBot(PlayerSelector::GetPlayer("hit_and_run", 1));
+  game.MainLoop();
+
+  const std::string rpx = options.save_replay_prefix + "0.rpx";
+  const std::string rep = options.save_replay_prefix + "0.rep";
+  game.GetCmdReceiver()->SaveReplay(rep);
+
+  ReplayReader reader;
+  if (! reader.Open(rpx)) {
+    std::cerr << "seed " << seed << ": cannot open " << rpx << std::endl;
+    ++*errors;
+    return json();
+  }
+  const ReplayIndex &index = reader.GetIndex();
+  if (index.num_cmds != (int)game.GetCmdReceiver()->GetCmdHistory().size()
+      || index.last_tick != game.GetCmdReceiver()->GetTick() || index.winner != game.GetGameEnv().GetWinnerId()) {
+    std::cerr << "seed " << seed << ": the index does not match the game" << std::endl;
+    ++*errors;
+  }
+
+  // Each keyframe played up to the next one.
+  Playback p = load_playback(rpx);
+  for (int i = 1; i < (int)index.keyframes.size(); ++i) {
+    reader.LoadKeyframe(i - 1, p.env.get(), p.receiver.get());
+    ReplayReader::FastForward(index.keyframes[i].tick, p.env.get(), p.receiver.get());
+    const std::string played = save_env(*p.env);
+    reader.LoadKeyframe(i, p.env.get(), p.receiver.get());
+    if (save_env(*p.env) != played) {
+      std::cerr << "seed " << seed << ": keyframe " << i << " (tick " << index.keyframes[i].tick
+        << ") differs from the replay played from the one before" << std::endl;
+      ++*errors;
+      break;
+    }
+  }
+
+  // Random seeks, against the replay played from tick 0 (in order, so it is played only once).
+  std::mt19937 rng(seed);
+  std::vector<Tick> seeks;
+  for (int i = 0; i < num_seeks; ++i) {
+    seeks.push_back(std::uniform_int_distribution<Tick>(index.first_tick, index.last_tick)(rng));
+  }
+  std::vector<Tick> sorted = seeks;
+  std::sort(sorted.begin(), sorted.end());
+  Playback from_start = load_playback(rpx);
+  reader.LoadKeyframe(0, from_start.env.get(), from_start.receiver.get());
+  Playback seeked = load_playback(rpx);
+  double seek_usec = 0.0;
+  for (Tick t : sorted) {
+    ReplayReader::FastForward(t, from_start.env.get(), from_start.receiver.get());
+    auto start = Clock::now();
+    reader.Seek(t, seeked.env.get(), seeked.receiver.get());
+    seek_usec += std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+    if (save_env(*seeked.env) != save_env(*from_start.env)) {
+      std::cerr << "seed " << seed << ": seek to tick " << t << " differs from the replay played from tick 0" << std::endl;
+      ++*errors;
+      break;
+    }
+  }
+  seek_usec /= num_seeks;
+
+  // The same seeks without keyframes: play from tick 0, in random order.
+  double play_usec = time_usec(num_seeks, [&, seeks]() mutable {
+    const Tick t = seeks.back();
+    seeks.pop_back();
+    reader.LoadKeyframe(0, p.env.get(), p.receiver.get());
+    ReplayReader::FastForward(t, p.env.get(), p.receiver.get());
+  });
+
+  *errors += check_damaged(rpx, &rng);
+
+  const double open_usec = time_usec(iters, [&]() { ReplayReader r; r.Open(rpx); });
+  const double rep_usec = time_usec(iters, [&]() { CmdReceiver r; r.LoadReplay(rep); });
+
+  json result;
+  result["seed"] = seed;
+  result["ticks"] = index.last_tick;
+  result["cmds"] = index.num_cmds;
+  result["chunks"] = index.chunks.size();
+  result["keyframes"] = index.keyframes.size();
+  result["bytes"] = {
+    {"rpx", file_size(rpx)},
+    {"rep", file_size(rep)},
+  };
+  result["open_usec"] = {
+    {"rpx_index", open_usec},
+    {"rep", rep_usec},
+  };
+  result["corpus_sec"] = {
+    {"replays", corpus},
+    {"rpx_index", open_usec * corpus / 1e6},
+    {"rep", rep_usec * corpus / 1e6},
+  };
+  result["load_cmds_usec"] = {
+    {"rpx", time_usec(iters, [&]() { CmdReceiver r; r.LoadReplay(rpx); })},
+    {"rep", rep_usec},
+  };
+  result["seek_usec"] = {
+    {"keyframe", seek_usec},
+    {"from_start", play_usec},
+  };
+
+  std::remove(rpx.c_str());
+  std::remove(rep.c_str());
+  return result;
+}
+
+int main(int argc, char **argv) {
+  std::map<std::string, std::string> args(kDefaults.begin(), kDefaults.end());
+  std::string output = "-";
+
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    size_t eq = arg.find('=');
+    if (arg.compare(0, 2, "--") != 0 || eq == std::string::npos) {
+      std::cerr << "Usage: " << argv[0] << " [--output=file.json]";
+      for (const auto &kv : kDefaults) std::cerr << " [--" << kv.first << "=" << kv.second << "]";
+      std::cerr << std::endl;
+      return 1;
+    }
+    std::string key = arg.substr(2, eq - 2);
+    std::string value = arg.substr(eq + 1);
+    if (key == "output") {
+      output = value;
+    } else if (args.find(key) == args.end()) {
+      std::cerr << "Unknown option --" << key << std::endl;
+      return 1;
+    } else {
+      args[key] = value;
+    }
+  }
+
+  std::vector<int> seeds;
+  int ticks = 0, keyframe_interval = 0, num_seeks = 0, iters = 0, corpus = 0;
+  try {
+    seeds = parse_list("seeds", args["seeds"]);
+    ticks = parse_list("ticks", args["ticks"])[0];
+    keyframe_interval = parse_list("keyframe_interval", args["keyframe_interval"])[0];
+    num_seeks = parse_list("seeks", args["seeks"])[0];
+    iters = parse_list("iters", args["iters"])[0];
+    corpus = parse_list("corpus", args["corpus"])[0];
+  } catch (const std::invalid_argument &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  if (keyframe_interval <= 0 || num_seeks <= 0 || iters <= 0) {
+    std::cerr << "--keyframe_interval, --seeks and --iters have to be positive" << std::endl;
+    return 1;
+  }
+
+  char dir[] = "/tmp/benchmark-replay-XXXXXX";
+  if (mkdtemp(dir) == nullptr) {
+    std::cerr << "Cannot make a temporary directory" << std::endl;
+    return 1;
+  }
+
+  init_enums();
+  reg_engine();
+  reg_engine_specific();
+  reg_minirts_specific();
+
+  json report;
+  report["benchmark"] = "replay";
+#ifdef GIT_COMMIT_HASH
+#define STRINGIFY(x) #x
+#define TOSTRING(x) STRINGIFY(x)
+  report["version"] = TOSTRING(GIT_COMMIT_HASH) "_" TOSTRING(GIT_UNSTAGED);
+#else
+  report["version"] = "";
+#endif
+  report["keyframe_interval"] = keyframe_interval;
+  report["results"] = json::array();
+
+  int errors = 0;
+  for (int seed : seeds) {
+    json result = run(dir, seed, ticks, keyframe_interval, num_seeks, iters, corpus, &errors);
+    if (result.is_null()) continue;
+    std::cerr << "seed " << seed << " ticks " << result["ticks"] << " cmds " << result["cmds"]
+      << " bytes rpx/rep " << result["bytes"]["rpx"] << "/" << result["bytes"]["rep"]
+      << " open usec rpx index/rep " << result["open_usec"]["rpx_index"].get<double>()
+      << "/" << result["open_usec"]["rep"].get<double>()
+      << " corpus sec " << result["corpus_sec"]["rpx_index"].get<double>()
+      << "/" << result["corpus_sec"]["rep"].get<double>()
+      << " seek usec keyframe/from start " << result["seek_usec"]["keyframe"].get<double>()
+      << "/" << result["seek_usec"]["from_start"].get<double>() << std::endl;
+    report["results"].push_back(result);
+  }
+  report["errors"] = errors;
+  rmdir(dir);
+
+  if (output == "-") {
+    std::cout << report.dump(2) << std::endl;
+  } else {
+    std::ofstream f(output);
+    f << report.dump(2) << std::endl;
+  }
+  return errors == 0 ? 0 : 2;
+}
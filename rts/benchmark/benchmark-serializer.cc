@@ -0,0 +1,232 @@
+/**
+* Copyright (c) 2017-present, Facebook, Inc.
+* All rights reserved.
+*
+* This source code is licensed under the BSD-style license found in the
+* LICENSE file in the root directory of this source tree. An additional grant
+* of patent rights can be found in the PATENTS file in the same directory.
+*/
+
+//File: benchmark-serializer.cc
+// Benchmark of binary snapshots of MiniRTS (GameEnv + CmdReceiver, as in RTSGame::save_to_string).
+// For every (seed, tick), simple plays hit_and_run up to that tick, then the state is saved and
+// loaded repeatedly with
+//   stream: serializer::saver(true) / loader(true), which go through a std::stringstream;
+//   buffer: serializer::saver(&buf) into a reused std::string / loader(data, size) over a span.
+// Both have to save the same bytes, and a state loaded with either has to save back to them.
+//
+//   make -C ../game_MC && make && ./benchmark-serializer.bin --seeds=1,2,3 --ticks=500,2000,5000
+//     --iters=200 --output=serializer.json
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "json.hpp"
+#include "../engine/game.h"
+#include "../engine/cmd.gen.h"
+#include "../engine/cmd_specific.gen.h"
+#include "cmd_specific.gen.h"
+#include "player_selector.h"
+#include "../engine/wrapper_template.h"
+
+using json = nlohmann::json;
+using Clock = std::chrono::steady_clock;
+
+static const std::vector<std::pair<std::string, std::string>> kDefaults = {
+  {"seeds", "1,2,3"},
+  {"ticks", "500,2000,5000"},
+  {"iters", "200"},
+};
+
+static std::vector<int> parse_list(const std::string &key, const std::string &s) {
+  std::vector<int> values;
+  std::stringstream ss(s);
+  std::string item;
+  while (std::getline(ss, item, ',')) {
+    try {
+      values.push_back(std::stoi(item));
+    } catch (const std::exception &) {
+      throw std::invalid_argument("Bad value for --" + key + ": " + s);
+    }
+  }
+  if (values.empty()) throw std::invalid_argument("Empty value for --" + key);
+  return values;
+}
+
+static void save_stream(const GameEnv &env, const CmdReceiver &receiver, std::string *s) {
+  serializer::saver saver(true);
+  env.SaveSnapshot(saver);
+  receiver.SaveCmdReceiver(saver);
+  *s = saver.get_str();
+}
+
+static void save_buffer(const GameEnv &env, const CmdReceiver &receiver, std::string *s) {
+  s->clear();
+  serializer::saver saver(s);
+  env.SaveSnapshot(saver);
+  receiver.SaveCmdReceiver(saver);
+}
+
+static void load_stream(const std::string &s, GameEnv *env, CmdReceiver *receiver) {
+  serializer::loader loader(true);
+  loader.set_str(s);
+  env->LoadSnapshot(loader);
+  receiver->LoadCmdReceiver(loader);
+}
+
+static void load_buffer(const std::string &s, GameEnv *env, CmdReceiver *receiver) {
+  serializer::loader loader(s.data(), s.size());
+  env->LoadSnapshot(loader);
+  receiver->LoadCmdReceiver(loader);
+}
+
+// Loads s into a new game with load and saves it again.
+template <typename F>
+static void resave(F load, const std::string &s, std::string *out) {
+  GameEnv env;
+  env.InitGameDef();
+  CmdReceiver receiver;
+  load(s, &env, &receiver);
+  save_buffer(env, receiver, out);
+}
+
+// Average usec per call of f over iters calls.
+template <typename F>
+static double time_usec(int iters, F f) {
+  auto start = Clock::now();
+  for (int i = 0; i < iters; ++i) f();
+  return std::chrono::duration<double, std::micro>(Clock::now() - start).count() / iters;
+}
+
+static json run(int seed, int tick, int iters, int *errors) {
+  RTSGameOptions options;
+  options.seed = seed;
+  options.max_tick = tick;
+  options.save_replay_prefix = "";
+  options.tick_prompt_n_step = 0;
+
+  RTSGame game(options);
+  game.AddBot(PlayerSelector::GetPlayer("simple", 1));
+  game.AddBot(PlayerSelector::GetPlayer("hit_and_run", 1));
+  game.MainLoop();
+
+  const GameEnv &env = game.GetGameEnv();
+  const CmdReceiver &receiver = *game.GetCmdReceiver();
+
+  std::string stream_state, buffer_state;
+  save_stream(env, receiver, &stream_state);
+  save_buffer(env, receiver, &buffer_state);
+  if (stream_state != buffer_state) {
+    std::cerr << "seed " << seed << " tick " << tick << ": stream and buffer saves differ" << std::endl;
+    ++*errors;
+  }
+
+  GameEnv env2;
+  env2.InitGameDef();
+  CmdReceiver receiver2;
+  std::string stream_resaved, buffer_resaved;
+  resave(load_stream, buffer_state, &stream_resaved);
+  resave(load_buffer, buffer_state, &buffer_resaved);
+  if (stream_resaved != buffer_state || buffer_resaved != buffer_state) {
+    std::cerr << "seed " << seed << " tick " << tick << ": a loaded state saves differently" << std::endl;
+    ++*errors;
+  }
+
+  std::string s;
+  json result;
+  result["seed"] = seed;
+  result["tick"] = receiver.GetTick();
+  result["num_units"] = env.GetUnits().size();
+  result["bytes"] = buffer_state.size();
+  result["save_usec"] = {
+    {"stream", time_usec(iters, [&]() { save_stream(env, receiver, &s); })},
+    {"buffer", time_usec(iters, [&]() { save_buffer(env, receiver, &s); })},
+  };
+  result["load_usec"] = {
+    {"stream", time_usec(iters, [&]() { load_stream(buffer_state, &env2, &receiver2); })},
+    {"buffer", time_usec(iters, [&]() { load_buffer(buffer_state, &env2, &receiver2); })},
+  };
+  return result;
+}
+
+int main(int argc, char **argv) {
+  std::map<std::string, std::string> args(kDefaults.begin(), kDefaults.end());
+  std::string output = "-";
+
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    size_t eq = arg.find('=');
+    if (arg.compare(0, 2, "--") != 0 || eq == std::string::npos) {
+      std::cerr << "Usage: " << argv[0] << " [--output=file.json]";
+      for (const auto &kv : kDefaults) std::cerr << " [--" << kv.first << "=" << kv.second << "]";
+      std::cerr << std::endl;
+      return 1;
+    }
+    std::string key = arg.substr(2, eq - 2);
+    std::string value = arg.substr(eq + 1);
+    if (key == "output") {
+      output = value;
+    } else if (args.find(key) == args.end()) {
+      std::cerr << "Unknown option --" << key << std::endl;
+      return 1;
+    } else {
+      args[key] = value;
+    }
+  }
+
+  std::vector<int> seeds, ticks;
+  int iters = 0;
+  try {
+    seeds = parse_list("seeds", args["seeds"]);
+    ticks = parse_list("ticks", args["ticks"]);
+    iters = parse_list("iters", args["iters"])[0];
+  } catch (const std::invalid_argument &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+
+  init_enums();
+  reg_engine();
+  reg_engine_specific();
+  reg_minirts_specific();
+
+  json report;
+  report["benchmark"] = "serializer";
+#ifdef GIT_COMMIT_HASH
+#define STRINGIFY(x) #x
+#define TOSTRING(x) STRINGIFY(x)
+  report["version"] = TOSTRING(GIT_COMMIT_HASH) "_" TOSTRING(GIT_UNSTAGED);
+#else
+  report["version"] = "";
+#endif
+  report["results"] = json::array();
+
+  int errors = 0;
+  for (int seed : seeds) {
+    for (int tick : ticks) {
+      json result = run(seed, tick, iters, &errors);
+      std::cerr << "seed " << seed << " tick " << result["tick"] << " units " << result["num_units"]
+        << " bytes " << result["bytes"]
+        << " save usec stream/buffer: " << result["save_usec"]["stream"].get<double>()
+        << "/" << result["save_usec"]["buffer"].get<double>()
+        << " load usec stream/buffer: " << result["load_usec"]["stream"].get<double>()
+        << "/" << result["load_usec"]["buffer"].get<double>() << std::endl;
+      report["results"].push_back(result);
+    }
+  }
+  report["errors"] = errors;
+
+  if (output == "-") {
+    std::cout << report.dump(2) << std::endl;
+  } else {
+    std::ofstream f(output);
+    f << report.dump(2) << std::endl;
+  }
+  return errors == 0 ? 0 : 2;
+}
@@ -129,7 +129,8 @@ bool CmdDurative::Run(const GameEnv &env, CmdReceiver *receiver) {
     // Run the script.
     bool ret = run(env, receiver);
 
-    _tick = receiver->GetNextTick();
+    _tick = std::max(receiver->GetNextTick(), _wake_tick);
+    _wake_tick = INVALID;
     return ret;
 }
 
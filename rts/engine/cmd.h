@@ -88,8 +88,10 @@ public:
     Tick tick() const { return _tick; }
     Tick start_tick() const { return _start_tick; }
     void set_tick_and_start_tick(Tick t) { _tick = _start_tick = t; }
+    void set_tick(Tick t) { _tick = t; }
     UnitId id() const { return _id; }
     void set_id(UnitId id) { _id = id; }
+    int cmd_id() const { return _cmd_id; }
     void set_cmd_id(int i) { _cmd_id = i; }
 
     virtual std::unique_ptr<CmdBase> clone() const { return std::unique_ptr<CmdBase>(new CmdBase(*this)); }
@@ -131,8 +133,14 @@ public:
 class CmdDurative : public CmdBase {
 protected:
     bool _done;
+    // Not serialized, only used between run() and Run().
+    Tick _wake_tick = INVALID;
     virtual bool run(const GameEnv&, CmdReceiver *) { return true; }
 
+    // Called in run(), if run() would do nothing before tick t (e.g., waiting for a cooldown) as long as
+    // no unit is removed. The command then sleeps until t or until a unit is removed.
+    void SleepUntil(Tick t) { _wake_tick = t; }
+
 public:
     explicit CmdDurative(UnitId id = INVALID) : CmdBase(id), _done(false) { }
     explicit CmdDurative(Tick t, UnitId id) : CmdBase(t, id), _done(false) { }
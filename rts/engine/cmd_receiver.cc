@@ -9,6 +9,8 @@
 
 #include "cmd.h"
 #include "game_env.h"
+#include "replay_file.h"
+#include <algorithm>
 #include <initializer_list>
 
 bool CmdReceiver::CheckGameSmooth(ostream *output_stream) const {
@@ -31,6 +33,42 @@ bool CmdReceiver::CheckGameSmooth(ostream *output_stream) const {
     } else return true;
 }
 
+template <typename T>
+static unique_ptr<T> clone_cmd(const T &cmd) {
+    return unique_ptr<T>(static_cast<T *>(cmd.clone().release()));
+}
+
+CmdReceiver::CmdReceiver(const CmdReceiver &receiver)
+    : _tick(receiver._tick), _cmd_next_id(receiver._cmd_next_id), _num_removed_units(receiver._num_removed_units),
+      _ui_cmd_queue(receiver._ui_cmd_queue), _ratio_failed_moves(receiver._ratio_failed_moves), _next_replay_idx(-1),
+      _cmd_dumper(nullptr), _save_to_history(receiver._save_to_history),
+      _verbose_player_id(receiver._verbose_player_id), _verbose_choice(receiver._verbose_choice),
+      _path_planning_verbose(receiver._path_planning_verbose), _use_cmd_comment(receiver._use_cmd_comment) {
+    if (! receiver._immediate_cmd_queue.empty()) {
+        const CmdIPtr *p = &receiver._immediate_cmd_queue.top();
+        for (size_t i = 0; i < receiver._immediate_cmd_queue.size(); ++i) _immediate_cmd_queue.push(clone_cmd(*p[i]));
+    }
+
+    // Sleeping cmds stay asleep, and the units point to the copies of their cmds.
+    map<const CmdDurative *, CmdDurative *> copies;
+    auto copy_to = [&](TimingWheel<CmdDPtr> *q) {
+        return [&copies, q](const CmdDPtr &cmd) {
+            CmdDPtr copy = clone_cmd(*cmd);
+            copies[cmd.get()] = copy.get();
+            q->push(std::move(copy));
+        };
+    };
+    receiver._durative_cmd_queue.ForEach(copy_to(&_durative_cmd_queue));
+    receiver._sleeping_cmd_queue.ForEach(copy_to(&_sleeping_cmd_queue));
+    for (const auto &p : receiver._unit_durative_cmd) {
+        _unit_durative_cmd[p.first] = copies.at(p.second);
+    }
+}
+
+unique_ptr<CmdReceiver> CmdReceiver::Fork() const {
+    return unique_ptr<CmdReceiver>(new CmdReceiver(*this));
+}
+
 bool CmdReceiver::StartDurativeCmd(CmdDurative *cmd) {
     UnitId id = cmd->id();
     if (id == INVALID) return false;
@@ -123,17 +161,23 @@ bool CmdReceiver::LoadReplay(const string& replay_filename) {
 
     // cout << "Loading replay = " << replay_filename << endl;
 
-    serializer::loader loader(false);
-    if (! loader.read_from_file(replay_filename)) {
-        return false;
-    }
+    if (ReplayReader::IsIndexed(replay_filename)) {
+        ReplayReader reader;
+        if (! reader.Open(replay_filename)) return false;
+        reader.ReadCmds(&_loaded_replay);
+    } else {
+        serializer::loader loader(false);
+        if (! loader.read_from_file(replay_filename)) {
+            return false;
+        }
 
-    _loaded_replay.clear();
-    loader >> _loaded_replay;
+        loader >> _loaded_replay;
+    }
     // cout << "Loaded replay, size = " << _loaded_replay.size() << endl;
 
     _cmd_history.clear();
-    _durative_cmd_queue = p_queue<CmdDPtr>();
+    _durative_cmd_queue.clear();
+    _sleeping_cmd_queue.clear();
     _immediate_cmd_queue = p_queue<CmdIPtr>();
 
     SendCurrentReplay();
@@ -158,11 +202,25 @@ void CmdReceiver::ExecuteDurativeCmds(const GameEnv &env, bool force_verbose) {
 
     // cout << "Starting ExecutiveDurativeCmds[" << _tick << "]" << endl;
 
+    // Wake the sleeping cmds that are due. A sleeping cmd may refer to a unit that was removed since,
+    // so then wake them all. They would have done nothing in the ticks they skipped.
+    if (env.GetNumRemovedUnits() != _num_removed_units) {
+        _num_removed_units = env.GetNumRemovedUnits();
+        vector<CmdDPtr> cmds;
+        _sleeping_cmd_queue.PopAll(&cmds);
+        for (auto &cmd : cmds) {
+            cmd->set_tick(_tick);
+            _durative_cmd_queue.push(std::move(cmd));
+        }
+    }
+    while (_sleeping_cmd_queue.HasDue(_tick)) {
+        _durative_cmd_queue.push(_sleeping_cmd_queue.pop_top());
+    }
+
     // Execute durative cmds.
-    while (! _durative_cmd_queue.empty()) {
+    while (_durative_cmd_queue.HasDue(_tick)) {
         const CmdDPtr& cmd_ref = _durative_cmd_queue.top();
         // cout << "Top: " << cmd_ref->PrintInfo() << endl;
-        if (cmd_ref->tick() > _tick) break;
 
         show_prompt_cond("ExecuteDurativeCmds", cmd_ref, force_verbose);
 
@@ -182,8 +240,9 @@ void CmdReceiver::ExecuteDurativeCmds(const GameEnv &env, bool force_verbose) {
         cmd->Run(env, this);
 
         // If the command is not yet done, push it back to the queue.
-        if (! cmd->IsDone()) _durative_cmd_queue.push(std::move(cmd));
-        else FinishDurativeCmd(cmd->id());
+        if (cmd->IsDone()) FinishDurativeCmd(cmd->id());
+        else if (cmd->tick() > GetNextTick()) _sleeping_cmd_queue.push(std::move(cmd));
+        else _durative_cmd_queue.push(std::move(cmd));
     }
 
     // cout << "Ending ExecutiveDurativeCmds[" << _tick << "]" << endl;
@@ -248,9 +307,49 @@ vector<CmdDurative*> CmdReceiver::GetHistoryAtCurrentTick() const {
 }
 
 
+// Same as saver << CmdBPtr (see SERIALIZER_ANCHOR), for a cmd we do not own.
+static void save_cmd(serializer::saver &saver, const CmdBase &cmd) {
+    saver << cmd._signature();
+    if (! saver.is_binary()) saver.get() << " ";
+    cmd.Save(saver);
+    if (! saver.is_binary()) saver.get() << " ";
+}
+
+// Saves cmds as a p_queue of them, in the order they run. The bytes then only depend on
+// the cmds, not on how the queues are laid out, and a loaded state saves the same bytes again.
+static void save_cmds(serializer::saver &saver, vector<const CmdBase *> *cmds) {
+    std::sort(cmds->begin(), cmds->end(), [](const CmdBase *c1, const CmdBase *c2) { return *c2 < *c1; });
+    int size = cmds->size();
+    if (! saver.is_binary()) saver.get() << " ";
+    saver << size;
+    if (! saver.is_binary()) saver.get() << " ";
+    for (const CmdBase *cmd : *cmds) save_cmd(saver, *cmd);
+}
+
 void CmdReceiver::SaveCmdReceiver(serializer::saver &saver) const {
     // Do not save/load _loaded_replay, as well as command history.
-    saver << _tick << _immediate_cmd_queue << _durative_cmd_queue << _verbose_player_id << _verbose_choice;
+    saver << _tick;
+
+    vector<const CmdBase *> cmds;
+    if (! _immediate_cmd_queue.empty()) {
+        const CmdIPtr *p = &_immediate_cmd_queue.top();
+        for (size_t i = 0; i < _immediate_cmd_queue.size(); ++i) cmds.push_back(p[i].get());
+    }
+    save_cmds(saver, &cmds);
+
+    // Sleeping cmds are saved as due now, which is what they would have been without
+    // sleeping. They go back to sleep once they run.
+    cmds.clear();
+    _durative_cmd_queue.ForEach([&](const CmdDPtr &cmd) { cmds.push_back(cmd.get()); });
+    vector<CmdBPtr> awake;
+    _sleeping_cmd_queue.ForEach([&](const CmdDPtr &cmd) {
+        awake.push_back(cmd->clone());
+        awake.back()->set_tick(_tick);
+        cmds.push_back(awake.back().get());
+    });
+    save_cmds(saver, &cmds);
+
+    saver << _verbose_player_id << _verbose_choice;
 }
 
 void CmdReceiver::AlignReplayIdx() {
@@ -263,18 +362,31 @@ void CmdReceiver::AlignReplayIdx() {
 }
 
 void CmdReceiver::LoadCmdReceiver(serializer::loader &loader) {
-    loader >> _tick >> _immediate_cmd_queue >> _durative_cmd_queue >> _verbose_player_id >> _verbose_choice;
-
-    // Set the failed_moves.
-    _ratio_failed_moves.resize(_tick + 1, 0);
+    // The immediate cmd queue is saved as a p_queue<CmdIPtr>, which has the layout of a vector.
+    vector<CmdIPtr> immediate_cmds;
+    vector<CmdDPtr> durative_cmds;
+    loader >> _tick >> immediate_cmds >> durative_cmds >> _verbose_player_id >> _verbose_choice;
+
+    // Set the failed_moves. Those of the ticks before the snapshot are unknown.
+    _ratio_failed_moves.assign(_tick + 1, 0);
+
+    // New cmds are numbered after the loaded ones, so the state after a load does not depend on
+    // what this receiver ran before.
+    _cmd_next_id = 0;
+    while (! _immediate_cmd_queue.empty()) _immediate_cmd_queue.pop();
+    for (auto &cmd : immediate_cmds) {
+        _cmd_next_id = max(_cmd_next_id, cmd->cmd_id() + 1);
+        _immediate_cmd_queue.push(std::move(cmd));
+    }
 
-    // load durative cmd queue. Note that the priority queue is opaque so we need some hacks.
-    int size = _durative_cmd_queue.size();
-    const CmdDPtr *c = &(_durative_cmd_queue.top());
+    // load durative cmd queue.
+    _durative_cmd_queue.clear();
+    _sleeping_cmd_queue.clear();
     _unit_durative_cmd.clear();
-    for (int i = 0; i < size; ++i) {
-        const CmdDPtr &curr = c[i];
-        if (! curr->IsDone()) _unit_durative_cmd.insert(make_pair(curr->id(), curr.get()));
+    for (auto &cmd : durative_cmds) {
+        _cmd_next_id = max(_cmd_next_id, cmd->cmd_id() + 1);
+        if (! cmd->IsDone()) _unit_durative_cmd.insert(make_pair(cmd->id(), cmd.get()));
+        _durative_cmd_queue.push(std::move(cmd));
     }
 
     AlignReplayIdx();
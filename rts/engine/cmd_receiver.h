@@ -13,6 +13,7 @@
 #include "cmd.h"
 
 #include "pq_extend.h"
+#include "timing_wheel.h"
 #include <map>
 #include <functional>
 // #include "Selene.h"
@@ -43,7 +44,11 @@ private:
     int _cmd_next_id;
 
     p_queue<CmdIPtr> _immediate_cmd_queue;
-    p_queue<CmdDPtr> _durative_cmd_queue;
+    TimingWheel<CmdDPtr> _durative_cmd_queue;
+    // Durative commands that called SleepUntil(), by wake tick.
+    TimingWheel<CmdDPtr> _sleeping_cmd_queue;
+    // GameEnv::GetNumRemovedUnits() when the sleeping commands were last checked.
+    int _num_removed_units;
     std::queue<UICmd> _ui_cmd_queue;
 
     vector<CmdBPtr> _cmd_history;
@@ -89,14 +94,22 @@ private:
         else return false;
     }
 
+    // See Fork().
+    CmdReceiver(const CmdReceiver &receiver);
+    CmdReceiver &operator=(const CmdReceiver &) = delete;
+
 public:
     CmdReceiver()
-        : _tick(0), _cmd_next_id(0), _next_replay_idx(-1),
+        : _tick(0), _cmd_next_id(0), _num_removed_units(0), _next_replay_idx(-1),
           _cmd_dumper(nullptr), _save_to_history(true),
           _verbose_player_id(INVALID), _verbose_choice(CR_NO_VERBOSE), _path_planning_verbose(false), _use_cmd_comment(false)  {
               _ratio_failed_moves.resize(1, 0.0);
     }
 
+    // A copy with copies of the queued commands, to go with GameEnv::Fork(). As with
+    // SaveCmdReceiver(), the command history and the loaded replay are not copied.
+    unique_ptr<CmdReceiver> Fork() const;
+
     Tick GetTick() const { return _tick; }
     Tick GetNextTick() const { return _tick + 1; }
     bool CheckGameSmooth(ostream *output_stream = nullptr) const;
@@ -116,7 +129,8 @@ public:
     }
     void ClearCmd() {
         while (! _immediate_cmd_queue.empty()) _immediate_cmd_queue.pop();
-        while (! _durative_cmd_queue.empty()) _durative_cmd_queue.pop();
+        _durative_cmd_queue.clear();
+        _sleeping_cmd_queue.clear();
         while (! _ui_cmd_queue.empty()) _ui_cmd_queue.pop();
         _cmd_history.clear();
         _unit_durative_cmd.clear();
@@ -146,9 +160,11 @@ public:
     const CmdDurative *GetUnitDurativeCmd(UnitId id) const;
     int GetLoadedReplaySize() const { return _loaded_replay.size(); }
     int GetLoadedReplayLastTick() const { return _loaded_replay.back()->tick(); }
+    // The cmds sent, in order, while save to history is on.
+    const vector<CmdBPtr> &GetCmdHistory() const { return _cmd_history; }
     vector<CmdDurative*> GetHistoryAtCurrentTick() const;
 
-    // Save and load Replay from a file
+    // Save and load Replay from a file. LoadReplay() also reads indexed replays (see replay_file.h).
     bool LoadReplay(const string& replay_filename);
     bool SaveReplay(const string& replay_filename) const;
 
@@ -162,6 +178,7 @@ public:
     // Send replay from this tick.
     void SendCurrentReplay();
     void AlignReplayIdx();
+    void SetNextReplayIdx(unsigned int idx) { _next_replay_idx = min<unsigned int>(idx, _loaded_replay.size()); }
 
     // CmdReceiver has its specialized Save and Load function.
     // No SERIALIZER(...) is needed.
@@ -131,6 +131,8 @@ bool CmdGather::run(const GameEnv &env, CmdReceiver *receiver) {
             if (property.CD(CD_GATHER).Passed(_tick)) {
                 receiver->SendCmd(CmdIPtr(new CmdHarvest(_id, _resource, -5)));
                 _state = kMoveToBase;
+            } else {
+                SleepUntil(property.CD(CD_GATHER).Expiry());
             }
             break;
         case kMoveToBase:
@@ -213,6 +215,8 @@ bool CmdBuild::run(const GameEnv &env, CmdReceiver *receiver) {
                     receiver->SendCmd(CmdIPtr(new CmdCreate(_id, _build_type, build_p, u->GetPlayerId(), cost)));
                     _done = true;
                 }
+            } else {
+                SleepUntil(p.CD(CD_BUILD).Expiry());
             }
             break;
     }
@@ -218,6 +218,8 @@ struct Cooldown {
     bool Passed(Tick tick) const {
         return tick - _last >= _cd;
     }
+    // The first tick at which Passed() is true.
+    Tick Expiry() const { return _last + _cd; }
     string PrintInfo(Tick tick = INVALID) const {
         stringstream ss;
         ss << "_last: " << _last << " cd: " << _cd;
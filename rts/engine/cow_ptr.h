@@ -0,0 +1,65 @@
+/**
+* Copyright (c) 2017-present, Facebook, Inc.
+* All rights reserved.
+*
+* This source code is licensed under the BSD-style license found in the
+* LICENSE file in the root directory of this source tree. An additional grant
+* of patent rights can be found in the PATENTS file in the same directory.
+*/
+
+#ifndef _COW_PTR_H_
+#define _COW_PTR_H_
+
+#include <atomic>
+#include <memory>
+#include "serializer.h"
+
+// A value of type T behind a pointer, shared copy-on-write. Copying a CowPtr only shares the
+// value, and Mutable() makes a private copy first if the value is still shared.
+//
+// Copies may be used on different threads: a shared value is never written, and once the other
+// owners have dropped it (e.g. after making their own copies) the remaining owner writes it in
+// place. Copying one CowPtr while another thread writes through it is a data race, as for T.
+template <typename T>
+class CowPtr {
+public:
+    CowPtr() : _p(std::make_shared<T>()) { }
+    explicit CowPtr(T value) : _p(std::make_shared<T>(std::move(value))) { }
+
+    const T &operator*() const { return *_p; }
+    const T *operator->() const { return _p.get(); }
+    const T &Get() const { return *_p; }
+
+    T &Mutable() {
+        if (_p.use_count() != 1) {
+            _p = std::make_shared<T>(*_p);
+        } else {
+            // Pairs with the release in the last other owner's decrement, so their reads of the
+            // value happen before our writes.
+            std::atomic_thread_fence(std::memory_order_acquire);
+        }
+        return *_p;
+    }
+
+    bool IsShared() const { return _p.use_count() != 1; }
+
+    // Replace the value with a default one, without copying a shared one first.
+    void Reset() { _p = std::make_shared<T>(); }
+    // Empty the value with T::clear() if we own it (which keeps its storage), or Reset() if shared.
+    void Clear() {
+        if (IsShared()) Reset();
+        else Mutable().clear();
+    }
+
+    friend serializer::saver &operator<<(serializer::saver &oo, const CowPtr<T> &p) { return oo << *p._p; }
+    // Loading replaces the value, so a shared one is not copied first.
+    friend serializer::loader &operator>>(serializer::loader &ii, CowPtr<T> &p) {
+        if (p.IsShared()) p._p = std::make_shared<T>();
+        return ii >> *p._p;
+    }
+
+private:
+    std::shared_ptr<T> _p;
+};
+
+#endif
@@ -0,0 +1,151 @@
+/**
+* Copyright (c) 2017-present, Facebook, Inc.
+* All rights reserved.
+*
+* This source code is licensed under the BSD-style license found in the
+* LICENSE file in the root directory of this source tree. An additional grant
+* of patent rights can be found in the PATENTS file in the same directory.
+*/
+
+#ifndef _DISTANCE_ORACLE_H_
+#define _DISTANCE_ORACLE_H_
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <sstream>
+#include <vector>
+
+#include "common.h"
+
+// Landmark (ALT) lower bounds on the number of 4-neighbour steps between two cells of a grid.
+// For a landmark L, |d(L, a) - d(L, b)| <= d(a, b) by the triangle inequality, so the max over
+// all landmarks is an admissible (and usually much tighter than L2) heuristic for A*.
+//
+// Landmarks are picked by farthest-point sampling, so they end up in corners, dead ends and
+// in every connected region. Memory is kMaxLandmarks * 2 bytes per cell, build time is one BFS
+// per landmark; both are reported in GetStats().
+class DistanceOracle {
+public:
+    static const int kMaxLandmarks = 8;
+
+    struct Stats {
+        int num_cells = 0;
+        int num_landmarks = 0;
+        int64_t bytes = 0;
+        int64_t build_usec = 0;
+
+        std::string PrintInfo() const {
+            std::stringstream ss;
+            ss << "DistanceOracle: cells = " << num_cells << ", landmarks = " << num_landmarks
+               << ", bytes = " << bytes << ", build_usec = " << build_usec;
+            return ss.str();
+        }
+    };
+
+private:
+    enum : uint16_t { kUnreachable = 0xffff };
+
+    int _xsize = 0, _ysize = 0;
+    int _num_landmarks = 0;
+
+    // _dist[loc * _num_landmarks + k] is the distance from landmark k to loc.
+    std::vector<uint16_t> _dist;
+    Stats _stats;
+
+    // BFS from src over passable cells, writes into d (size of the grid).
+    void bfs(const std::vector<bool> &passable, Loc src, std::vector<uint16_t> *d) const {
+        const int dx[] = { 1, 0, -1, 0 };
+        const int dy[] = { 0, 1, 0, -1 };
+
+        d->assign(passable.size(), kUnreachable);
+        (*d)[src] = 0;
+        std::vector<Loc> q(1, src);
+        for (size_t i = 0; i < q.size(); ++i) {
+            const int x = q[i] % _xsize, y = q[i] / _xsize;
+            // Farther cells stay kUnreachable (and are skipped by LowerBound) rather than wrap.
+            if ((*d)[q[i]] + 1 >= kUnreachable) break;
+            const uint16_t next_d = (*d)[q[i]] + 1;
+            for (int j = 0; j < 4; ++j) {
+                const int xn = x + dx[j], yn = y + dy[j];
+                if (xn < 0 || xn >= _xsize || yn < 0 || yn >= _ysize) continue;
+                const Loc l = yn * _xsize + xn;
+                if (! passable[l] || (*d)[l] != kUnreachable) continue;
+                (*d)[l] = next_d;
+                q.push_back(l);
+            }
+        }
+    }
+
+public:
+    // passable[y * xsize + x] tells whether a unit may walk on (x, y).
+    void Build(int xsize, int ysize, const std::vector<bool> &passable) {
+        auto start = std::chrono::steady_clock::now();
+
+        _xsize = xsize;
+        _ysize = ysize;
+        const int n = xsize * ysize;
+
+        // Distance from the closest landmark so far, kUnreachable if none reaches the cell.
+        std::vector<uint16_t> min_d(n, kUnreachable);
+        std::vector<std::vector<uint16_t>> dists;
+        std::vector<uint16_t> d;
+
+        // The first landmark is the cell farthest from an arbitrary passable cell.
+        Loc seed = std::find(passable.begin(), passable.end(), true) - passable.begin();
+        if (seed < n) {
+            bfs(passable, seed, &d);
+            seed = std::max_element(d.begin(), d.end(), [](uint16_t a, uint16_t b) {
+                return (a == kUnreachable ? 0 : a) < (b == kUnreachable ? 0 : b);
+            }) - d.begin();
+        }
+
+        while (seed < n && (int)dists.size() < kMaxLandmarks) {
+            bfs(passable, seed, &d);
+            for (int i = 0; i < n; ++i) min_d[i] = std::min(min_d[i], d[i]);
+            dists.push_back(d);
+
+            // Next landmark: a cell no landmark reaches yet, otherwise the farthest from all of them.
+            seed = n;
+            int best = 0;
+            for (int i = 0; i < n; ++i) {
+                if (! passable[i]) continue;
+                const int v = (min_d[i] == kUnreachable ? n + 1 : min_d[i]);
+                if (v > best) {
+                    best = v;
+                    seed = i;
+                }
+            }
+        }
+
+        _num_landmarks = dists.size();
+        _dist.assign((size_t)n * _num_landmarks, kUnreachable);
+        for (int k = 0; k < _num_landmarks; ++k) {
+            for (int i = 0; i < n; ++i) _dist[(size_t)i * _num_landmarks + k] = dists[k][i];
+        }
+
+        _stats.num_cells = n;
+        _stats.num_landmarks = _num_landmarks;
+        _stats.bytes = _dist.size() * sizeof(uint16_t);
+        _stats.build_usec = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // Lower bound of the number of steps from a to b. Landmarks that cannot reach one of the two
+    // cells (e.g. b is impassable) are skipped, so the bound stays admissible.
+    float LowerBound(Loc a, Loc b) const {
+        if (_num_landmarks == 0 || a < 0 || b < 0 || a >= _xsize * _ysize || b >= _xsize * _ysize) return 0.0;
+        const uint16_t *da = &_dist[(size_t)a * _num_landmarks];
+        const uint16_t *db = &_dist[(size_t)b * _num_landmarks];
+        int lb = 0;
+        for (int k = 0; k < _num_landmarks; ++k) {
+            if (da[k] == kUnreachable || db[k] == kUnreachable) continue;
+            lb = std::max(lb, std::abs((int)da[k] - (int)db[k]));
+        }
+        return lb;
+    }
+
+    const Stats &GetStats() const { return _stats; }
+};
+
+#endif
@@ -9,6 +9,15 @@
 
 #include "fields.h"
 
+// Fused gathers for the actor and train key sets requested by game.py.
+static FusedGatherRegistrar<AIComm, FieldId<AIComm>, FieldState, FieldResource0, FieldResource1,
+    FieldLastReward, FieldLastTerminal>
+    _actor_gather({"id", "s", "r0", "r1", "last_r", "last_terminal"});
+
+static FusedGatherRegistrar<AIComm, FieldReplyVersion<AIComm>, FieldId<AIComm>, FieldPolicy, FieldState,
+    FieldResource0, FieldResource1, FieldAction, FieldReward, FieldValue, FieldSeq<AIComm>, FieldTerminal>
+    _train_gather({"rv", "id", "pi", "s", "r0", "r1", "a", "r", "V", "seq", "terminal"});
+
 bool CustomFieldFunc(int batchsize, const std::string& key, const std::string& v, SizeType *sz, FieldBase<AIComm> **p) {
     // Note that ptr and stride will be set after the memory are initialized in the Python side.
     if (key == "s") {
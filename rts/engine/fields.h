@@ -25,7 +25,7 @@ class FieldState : public FieldT<AIComm, float> {
 public:
     void ToPtr(int batch_idx, const AIComm& ai_comm) override {
         const auto &info = ai_comm.newest(this->_hist_loc);
-        std::copy(info.data.features.begin(), info.data.features.end(), this->addr(batch_idx));
+        this->CopyRow(batch_idx, info.data.features);
     }
 };
 
@@ -33,7 +33,7 @@ class FieldResource0 : public FieldT<AIComm, float> {
 public:
     void ToPtr(int batch_idx, const AIComm& ai_comm) override {
         const auto &info = ai_comm.newest(this->_hist_loc);
-        std::copy(info.data.resources[0].begin(), info.data.resources[0].end(), this->addr(batch_idx));
+        this->CopyRow(batch_idx, info.data.resources[0]);
     }
 };
 
@@ -41,7 +41,7 @@ class FieldResource1 : public FieldT<AIComm, float> {
 public:
     void ToPtr(int batch_idx, const AIComm& ai_comm) override {
         const auto &info = ai_comm.newest(this->_hist_loc);
-        std::copy(info.data.resources[1].begin(), info.data.resources[1].end(), this->addr(batch_idx));
+        this->CopyRow(batch_idx, info.data.resources[1]);
     }
 };
 
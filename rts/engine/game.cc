@@ -37,6 +37,7 @@ RTSGame::RTSGame(const RTSGameOptions &options)
     _bots.clear();
     _env.InitGameDef();
     _env.ClearAllPlayers();
+    _env.SetFOWMode(_options.fow_mode);
 }
 
 RTSGame::~RTSGame() {
@@ -66,6 +67,12 @@ void RTSGame::AddSpectator(AI *spectator) {
 // 0.0 - 1.0
 bool RTSGame::move_to_tick(float percent) {
     // Move to a specific tick.
+    if (_replay_reader != nullptr) {
+        // Seek from the keyframes of the replay.
+        _snapshot_to_load = static_cast<Tick>(percent * _replay_reader->GetIndex().last_tick + 0.5);
+        return true;
+    }
+
     int num_replay_entry = _cmd_receiver.GetLoadedReplaySize();
     cout << "#replay = " << num_replay_entry << endl;
     cout << "snapshot_load_prefix = " << _options.snapshot_load_prefix << endl;
@@ -129,15 +136,15 @@ CmdReturn RTSGame::dispatch_cmds(const UICmd& cmd) {
 }
 
 void RTSGame::save_to_string(string *s) const {
-    serializer::saver saver(true);
+    // Written straight into *s, whose capacity is reused from one snapshot to the next.
+    s->clear();
+    serializer::saver saver(s);
     _env.SaveSnapshot(saver);
     _cmd_receiver.SaveCmdReceiver(saver);
-    *s = saver.get_str();
 }
 
 void RTSGame::load_from_string(const string &s) {
-    serializer::loader loader(true);
-    loader.set_str(s);
+    serializer::loader loader(s.data(), s.size());
     _env.LoadSnapshot(loader);
     _cmd_receiver.LoadCmdReceiver(loader);
 }
@@ -172,6 +179,12 @@ void RTSGame::Reset() {
 
 PlayerId RTSGame::Step(int num_ticks, std::string *state) {
     load_from_string(*state);
+    PlayerId winner_id = StepInPlace(num_ticks);
+    if (winner_id == INVALID) save_to_string(state);
+    return winner_id;
+}
+
+PlayerId RTSGame::StepInPlace(int num_ticks) {
     for (int i = 0; i < num_ticks; i++) {
         for (const auto &bot : _bots) {
             bot->Act(_env);
@@ -181,7 +194,7 @@ PlayerId RTSGame::Step(int num_ticks, std::string *state) {
         _cmd_receiver.ExecuteDurativeCmds(_env, false);
         _cmd_receiver.ExecuteImmediateCmds(&_env, false);
         _cmd_receiver.ExecuteUICmds(default_cmd_dispatch);
-        _env.ComputeFOW();
+        _env.ComputeFOW(_options.check_fow);
         PlayerId winner_id = _env.GetGameDef().CheckWinner(_env, _cmd_receiver.GetTick() >= _options.max_tick);
         _env.SetWinnerId(winner_id);
         if (_cmd_receiver.GetTick() >= _options.max_tick) {
@@ -194,7 +207,6 @@ PlayerId RTSGame::Step(int num_ticks, std::string *state) {
         }
         _cmd_receiver.IncTick();
     }
-    save_to_string(state);
     return INVALID;
 }
 
@@ -224,10 +236,15 @@ bool RTSGame::PrepareGame() {
 
   // Load the replay.
   bool situation_loaded = false;
+  _replay_reader.reset();
   if (! load_replay_filename.empty()) {
       if (_output_stream) *_output_stream << "Load from replay, name = " << load_replay_filename << endl << flush;
       if (_cmd_receiver.LoadReplay(load_replay_filename)) {
         situation_loaded = true;
+        if (ReplayReader::IsIndexed(load_replay_filename)) {
+            _replay_reader.reset(new ReplayReader());
+            if (! _replay_reader->Open(load_replay_filename)) _replay_reader.reset();
+        }
       } else {
           if (_output_stream) *_output_stream << "Failed to open " << load_replay_filename << endl << flush;
           return false;
@@ -296,6 +313,12 @@ PlayerId RTSGame::MainLoop(const std::atomic_bool *done) {
 
   if (_output_stream) *_output_stream << "Starting " << prefix << " Tick: " << _cmd_receiver.GetTick() << endl << flush;
 
+  if (! _options.save_replay_prefix.empty() && _options.replay_keyframe_interval > 0) {
+      if (! _replay_writer.Open(prefix + ".rpx", _options.replay_keyframe_interval)) {
+          if (_output_stream) *_output_stream << "Failed to open " << prefix << ".rpx" << endl << flush;
+      }
+  }
+
   while (true) {
       auto time_loop_start = chrono::system_clock::now();
       clock.SetStartPoint();
@@ -313,6 +336,14 @@ PlayerId RTSGame::MainLoop(const std::atomic_bool *done) {
           save_snapshot(_options.snapshot_prefix + "-" + to_string(t) + ".bin");
           clock.Record("SaveSnapshot");
       }
+      if (_replay_writer.IsOpen()) {
+          _replay_writer.OnTick(_env, _cmd_receiver);
+          clock.Record("SaveReplay");
+      }
+      if (_replay_reader != nullptr && _snapshot_to_load >= 0) {
+          _replay_reader->Seek(_snapshot_to_load, &_env, &_cmd_receiver);
+          _snapshot_to_load = -1;
+      }
       if (! _options.snapshot_load_prefix.empty() && _snapshot_to_load >= 0) {
           string filename = _options.snapshot_load_prefix + "-" + to_string(_snapshot_to_load) + ".bin";
           load_snapshot(filename);
@@ -362,7 +393,7 @@ PlayerId RTSGame::MainLoop(const std::atomic_bool *done) {
       _cmd_receiver.ExecuteImmediateCmds(&_env, tick_verbose);
       _cmd_receiver.ExecuteUICmds(default_cmd_dispatch);
       // cout << "Compute Fow" << endl;
-      _env.ComputeFOW();
+      _env.ComputeFOW(_options.check_fow);
 
       clock.Record("Cmd");
 
@@ -406,7 +437,9 @@ PlayerId RTSGame::MainLoop(const std::atomic_bool *done) {
   }
 
   // cout << "[" << prefix << "] About to save to rep" << endl;
-  if (! _options.save_replay_prefix.empty()) {
+  if (_replay_writer.IsOpen()) {
+      _replay_writer.Close(_env, _cmd_receiver);
+  } else if (! _options.save_replay_prefix.empty()) {
       _cmd_receiver.SaveReplay(prefix + ".rep");
   }
   return _env.GetWinnerId();
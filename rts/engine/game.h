@@ -24,6 +24,7 @@
 #include <set>
 #include "game_env.h"
 #include "ai.h"
+#include "replay_file.h"
 
 struct RTSGameOptions {
     // A map file that specifies the map, the terrain
@@ -81,9 +82,19 @@ struct RTSGameOptions {
     // Whether we save the snapshot using binary format (faster).
     bool save_with_binary_format = true;
 
+    // If > 0, save the replay as an indexed one (.rpx, see replay_file.h) with a keyframe every
+    // replay_keyframe_interval ticks, instead of a .rep. Seeking in it needs no snapshot files.
+    int replay_keyframe_interval = 0;
+
     // Handicap_level used in Capture the Flag.
     int handicap_level = 0;
 
+    // How the fog of war is kept up to date, see FOWMode.
+    FOWMode fow_mode = FOW_SIGHT_COUNTS;
+
+    // Cross-check the incremental fog of war against a full recompute every tick (slow, for debugging).
+    bool check_fow = false;
+
     string PrintInfo() const {
         std::stringstream ss;
 
@@ -111,6 +122,9 @@ struct RTSGameOptions {
         ss << "Max ticks: " << max_tick << endl;
         ss << "Tick prompt n step: " << tick_prompt_n_step << endl;
         ss << "Save with binary format: " << (save_with_binary_format ? "True" : "False") << endl;
+        ss << "Replay keyframe interval: " << replay_keyframe_interval << endl;
+        ss << "FOW mode: " << _FOWMode2string(fow_mode) << endl;
+        ss << "Check FOW: " << (check_fow ? "True" : "False") << endl;
 
         return ss.str();
     }
@@ -134,9 +148,13 @@ private:
     // Receivers.
     CmdReceiver _cmd_receiver;
 
-    // Next snapshot to load.
+    // Next snapshot to load (a tick to seek to, with an indexed replay).
     int _snapshot_to_load;
 
+    // The indexed replay loaded, and the one being saved.
+    unique_ptr<ReplayReader> _replay_reader;
+    ReplayWriter _replay_writer;
+
     // Whether we pause the system.
     bool _paused;
 
@@ -158,9 +176,6 @@ private:
     void save_snapshot(const string &filename) const;
     void load_snapshot(const string &filename);
 
-    // Load a game from a state string.
-    void load_from_string(const string &s);
-
 public:
     // Initialize the game.
     explicit RTSGame(const RTSGameOptions &options);
@@ -181,9 +196,19 @@ public:
     // Start the game.
     bool PrepareGame();
     PlayerId MainLoop(const std::atomic_bool *done = nullptr);
-    // Step the game once and modify state string in place.
-    PlayerId Step(int num_step, std::string *state);
+
+    // Stepping in place (e.g. for rollouts). The state stays in this game, and is only
+    // serialized when asked for.
+    // Run num_ticks ticks. Returns the winner, MAX_GAME_LENGTH_EXCEEDED once max_tick is
+    // reached, or INVALID if the game goes on.
+    PlayerId StepInPlace(int num_ticks);
+    // Save the current state to *s, reusing the capacity of *s.
     void save_to_string(string *s) const;
+    // Restore a state saved by save_to_string. The map and the players are loaded in place.
+    void load_from_string(const string &s);
+
+    // Load *state, run num_step ticks, and save the result back to *state unless the game ended.
+    PlayerId Step(int num_step, std::string *state);
     ~RTSGame();
 };
 
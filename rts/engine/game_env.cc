@@ -17,6 +17,21 @@ GameEnv::GameEnv() {
     Reset();
 }
 
+GameEnv::GameEnv(const GameEnv &env)
+    : _gamedef(env._gamedef), _game_counter(env._game_counter), _next_unit_id(env._next_unit_id),
+      _units(env._units), _num_removed_units(env._num_removed_units), _bullets(env._bullets),
+      _map(new RTSMap(*env._map)), _players(env._players), _fow_mode(env._fow_mode), _rng(env._rng),
+      _winner_id(env._winner_id), _terminated(env._terminated) {
+    // The players keep their fog of war and flow fields, as the terrain is the same.
+    for (auto &player : _players) {
+        player.SetMapCopy(_map.get());
+    }
+}
+
+unique_ptr<GameEnv> GameEnv::Fork() const {
+    return unique_ptr<GameEnv>(new GameEnv(*this));
+}
+
 void GameEnv::ClearAllPlayers() {
     _players.clear();
 }
@@ -27,8 +42,8 @@ void GameEnv::Reset() {
     _winner_id = INVALID;
     _terminated = false;
     _game_counter ++;
-    _units.clear();
-    _bullets.clear();
+    _units.Clear();
+    _bullets.Clear();
     for (auto& player : _players) {
         player.ClearCache();
     }
@@ -37,12 +52,20 @@ void GameEnv::Reset() {
 void GameEnv::AddPlayer(PlayerPrivilege pv) {
     _players.emplace_back(*_map, _players.size());
     _players.back().SetPrivilege(pv);
+    _players.back().SetFOWMode(_fow_mode);
 }
 
 void GameEnv::RemovePlayer() {
     _players.pop_back();
 }
 
+void GameEnv::SetFOWMode(FOWMode mode) {
+    _fow_mode = mode;
+    for (auto &player : _players) {
+        player.SetFOWMode(mode);
+    }
+}
+
 void GameEnv::SaveSnapshot(serializer::saver &saver) const {
     serializer::Save(saver, _next_unit_id);
 
@@ -57,25 +80,29 @@ void GameEnv::SaveSnapshot(serializer::saver &saver) const {
 void GameEnv::LoadSnapshot(serializer::loader &loader) {
     serializer::Load(loader, _next_unit_id);
 
-    loader >> _map;
+    // The map and the players are loaded in place, so restoring a snapshot into a running game
+    // does not reallocate them. The map rebuilds its terrain data only if the terrain changed.
+    loader >> *_map;
     loader >> _units;
     loader >> _bullets;
-    loader >> _players;
+    _players.resize(loader.read_size(1));
+    for (auto &player : _players) loader >> player;
     loader >> _winner_id;
     loader >> _terminated;
 
     for (auto &player : _players) {
         player.ResetMap(_map.get());
+        player.SetFOWMode(_fow_mode);
     }
 }
 
 // Compute the hash code.
 uint64_t GameEnv::CurrentHashCode() const {
     uint64_t code = 0;
-    for (auto it = _units.begin(); it != _units.end(); ++it) {
-        serializer::hash_combine(code, it->first);
-        serializer::hash_combine(code, *it->second);
-        // cout << "Unit: " << it->first << ": #hash = " << this_code << ", " << it->second->GetProperty().CD(CD_ATTACK).PrintInfo() << endl;
+    for (const Unit &u : *_units) {
+        serializer::hash_combine(code, u.GetId());
+        serializer::hash_combine(code, u);
+        // cout << "Unit: " << u.GetId() << ": #hash = " << this_code << ", " << u.GetProperty().CD(CD_ATTACK).PrintInfo() << endl;
         // code ^= this_code;
     }
     // Players.
@@ -87,12 +114,11 @@ uint64_t GameEnv::CurrentHashCode() const {
 
 bool GameEnv::AddUnit(Tick tick, UnitType type, const PointF &p, PlayerId player_id) {
     // Check if there is any space.
-    if (!_gamedef.CheckAddUnit(_map.get(), type, p)) return false;
+    if (!_gamedef->CheckAddUnit(_map.get(), type, p)) return false;
     // cout << "Actual adding unit." << endl;
 
     UnitId new_id = Player::CombinePlayerId(_next_unit_id, player_id);
-    Unit *new_unit = new Unit(tick, new_id, type, p, _gamedef.unit(type)._property);
-    _units.insert(make_pair(new_id, unique_ptr<Unit>(new_unit)));
+    _units.Mutable().Add(Unit(tick, new_id, type, p, _gamedef->unit(type)._property));
     _map->AddUnit(new_id, p);
 
     _next_unit_id ++;
@@ -100,33 +126,32 @@ bool GameEnv::AddUnit(Tick tick, UnitType type, const PointF &p, PlayerId player
 }
 
 bool GameEnv::RemoveUnit(const UnitId &id) {
-    auto it = _units.find(id);
-    if (it == _units.end()) return false;
-    _units.erase(it);
+    if (! _units.Mutable().Remove(id)) return false;
+    _num_removed_units ++;
 
     _map->RemoveUnit(id);
     return true;
 }
 
 UnitId GameEnv::FindClosestBase(PlayerId player_id) const {
-    // Find closest base. [TODO]: Not efficient here.
-    for (auto it = _units.begin(); it != _units.end(); ++it) {
-        const Unit *u = it->second.get();
-        if ((u->GetUnitType() == BASE || u->GetUnitType() == FLAG_BASE) && u->GetPlayerId() == player_id) {
-            return u->GetId();
-        }
+    // Find closest base. Only the player's own units, which are contiguous in _units, are visited.
+    const Units &units = *_units;
+    for (int i = units.LowerBound(Player::CombinePlayerId(0, player_id)); i < units.size(); ++i) {
+        if (units.GetPlayerId(i) != player_id) break;
+        const UnitType t = units.GetUnitType(i);
+        if (t == BASE || t == FLAG_BASE) return units.GetId(i);
     }
     return INVALID;
 }
 
 PlayerId GameEnv::CheckBase(UnitType base_type) const{
+    const Units &units = *_units;
     PlayerId last_player_has_base = INVALID;
-    for (auto it = _units.begin(); it != _units.end(); ++it) {
-        const Unit *u = it->second.get();
-        if (u->GetUnitType() == base_type) {
+    for (int i = 0; i < units.size(); ++i) {
+        if (units.GetUnitType(i) == base_type) {
             if (last_player_has_base == INVALID) {
-                last_player_has_base = u->GetPlayerId();
-            } else if (last_player_has_base != u->GetPlayerId()) {
+                last_player_has_base = units.GetPlayerId(i);
+            } else if (last_player_has_base != units.GetPlayerId(i)) {
                 // No winning.
                 last_player_has_base = INVALID;
                 break;
@@ -216,11 +241,44 @@ bool GameEnv::FindClosestPlaceWithDistance(const PointF &p, int dist,
   return found;
 }
 
+bool GameEnv::Accept(const UnitFilter &filter, UnitId id) const {
+    const PlayerId player_id = Player::ExtractPlayerId(id);
+    if (filter.owner != INVALID && player_id != filter.owner) return false;
+    if (filter.enemies_of != INVALID && player_id == filter.enemies_of) return false;
+    if (filter.type_mask == ~0ULL && filter.visible_to == INVALID) return true;
+
+    const Unit *u = GetUnit(id);
+    if (u == nullptr) return false;
+    if (! (filter.type_mask & (1ULL << u->GetUnitType()))) return false;
+    if (filter.visible_to != INVALID && ! _players[filter.visible_to].FilterWithFOW(*u)) return false;
+    return true;
+}
+
+static vector<const Unit *> units_of(const GameEnv &env, const vector<UnitId> &ids) {
+    vector<const Unit *> res;
+    res.reserve(ids.size());
+    for (UnitId id : ids) {
+        const Unit *u = env.GetUnit(id);
+        if (u != nullptr) res.push_back(u);
+    }
+    return res;
+}
+
+vector<const Unit *> GameEnv::KNearest(const PointF &p, int k, const UnitFilter &filter, float max_r) const {
+    return units_of(*this, _map->KNearest(p, k, [&](const UnitId &id) { return Accept(filter, id); }, max_r));
+}
+
+vector<const Unit *> GameEnv::WithinRadius(const PointF &p, float r, const UnitFilter &filter) const {
+    return units_of(*this, _map->WithinRadius(p, r, [&](const UnitId &id) { return Accept(filter, id); }));
+}
+
 void GameEnv::Forward(CmdReceiver *receiver) {
     // Compute all bullets.
+    if (_bullets->empty()) return;
+    Bullets &bullets = _bullets.Mutable();
     set<int> done_bullets;
-    for (size_t i = 0; i < _bullets.size(); ++i) {
-        CmdBPtr cmd = _bullets[i].Forward(*_map, _units);
+    for (size_t i = 0; i < bullets.size(); ++i) {
+        CmdBPtr cmd = bullets[i].Forward(*_map, *_units);
         if (cmd.get() != nullptr) {
             // Note that this command is special. It should not be recorded in
             // the cmd_history.
@@ -228,24 +286,25 @@ void GameEnv::Forward(CmdReceiver *receiver) {
             receiver->SendCmd(std::move(cmd));
             receiver->SetSaveToHistory(true);
         }
-        if (_bullets[i].IsDead()) done_bullets.insert(i);
+        if (bullets[i].IsDead()) done_bullets.insert(i);
     }
 
     // Remove bullets that are done.
     // Need to traverse in the reverse order.
     for (set<int>::reverse_iterator it = done_bullets.rbegin(); it != done_bullets.rend(); ++it) {
         unsigned int idx = *it;
-        if (idx < _bullets.size() - 1) {
-            swap(_bullets[idx], _bullets.back());
+        if (idx < bullets.size() - 1) {
+            swap(bullets[idx], bullets.back());
         }
-        _bullets.pop_back();
+        bullets.pop_back();
     }
 }
 
-void GameEnv::ComputeFOW() {
+void GameEnv::ComputeFOW(bool check) {
     // Compute FoW.
     for (Player &p : _players) {
-        p.ComputeFOW(_units);
+        p.ComputeFOW(*_units);
+        if (check) p.CheckFOW(*_units);
     }
 }
 
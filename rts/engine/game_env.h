@@ -17,10 +17,34 @@
 #include "player.h"
 #include <random>
 
+// Which units GameEnv::KNearest() and GameEnv::WithinRadius() return. Accepts every unit by default.
+// e.g. UnitFilter::EnemiesOf(player_id).OfType(WORKER).VisibleTo(player_id)
+struct UnitFilter {
+    PlayerId owner = INVALID;       // Only units of this player.
+    PlayerId enemies_of = INVALID;  // Only units not owned by this player.
+    PlayerId visible_to = INVALID;  // Only units this player can see through the fog of war.
+    uint64_t type_mask = ~0ULL;     // Bit t is set if UnitType t is accepted.
+
+    static UnitFilter OwnedBy(PlayerId player_id) { UnitFilter f; f.owner = player_id; return f; }
+    static UnitFilter EnemiesOf(PlayerId player_id) { UnitFilter f; f.enemies_of = player_id; return f; }
+
+    UnitFilter &OfType(UnitType t) {
+        if (type_mask == ~0ULL) type_mask = 0;
+        type_mask |= 1ULL << t;
+        return *this;
+    }
+    UnitFilter &ExceptType(UnitType t) { type_mask &= ~(1ULL << t); return *this; }
+    UnitFilter &VisibleTo(PlayerId player_id) { visible_to = player_id; return *this; }
+};
+
+// GameEnv::Fork() copies a game for search or rollouts. The game definition, the terrain, the
+// units, the bullets and the path-planning caches of the players are shared copy-on-write, so
+// the copy only pays for what it changes, and each of the two games can be simulated on its own
+// thread. Non-const accessors like GetUnits() make the state they return private to the game.
 class GameEnv {
 private:
     // Game definitions.
-    GameDef _gamedef;
+    CowPtr<GameDef> _gamedef;
 
     // Game counter.
     int _game_counter;
@@ -28,11 +52,14 @@ private:
     // Next unit_id, initialized to be 0
     UnitId _next_unit_id;
 
-    // Unit hash tables.
-    Units _units;
+    // All units.
+    CowPtr<Units> _units;
+
+    // Number of units removed so far.
+    int _num_removed_units = 0;
 
     // Bullet tables.
-    Bullets _bullets;
+    CowPtr<Bullets> _bullets;
 
     // The game map.
     unique_ptr<RTSMap> _map;
@@ -40,6 +67,9 @@ private:
     // Players
     vector<Player> _players;
 
+    // How the players keep their fog of war up to date.
+    FOWMode _fow_mode = FOW_SIGHT_COUNTS;
+
     // Random number generator
     std::mt19937 _rng;
 
@@ -50,47 +80,54 @@ private:
     // This happens if the time tick exceeds max_tick, or there is anything wrong.
     bool _terminated;
 
+    // See Fork().
+    GameEnv(const GameEnv &env);
+    GameEnv &operator=(const GameEnv &) = delete;
+
 public:
     class UnitIterator {
         private:
-            Units::const_iterator _it;
+            int _i;
             const GameEnv *_env;
             PlayerId _player_id;
             bool _output_building;
             bool _output_moving;
 
             void next() {
-                while (_it != _env->_units.end()) {
-                    const Unit &u = *_it->second;
-                    if (_player_id == INVALID || _env->_players[_player_id].FilterWithFOW(u)) {
-                        bool is_building = _env->_gamedef.IsUnitTypeBuilding(u.GetUnitType());
-                        if ((is_building && _output_building) || (! is_building && _output_moving)) break;
+                const Units &units = *_env->_units;
+                while (_i < units.size()) {
+                    bool is_building = _env->_gamedef->IsUnitTypeBuilding(units.GetUnitType(_i));
+                    if ((is_building && _output_building) || (! is_building && _output_moving)) {
+                        if (_player_id == INVALID || _env->_players[_player_id].FilterWithFOW(units.At(_i))) break;
                     }
-                    ++ _it;
+                    ++ _i;
                 }
             }
 
         public:
             UnitIterator(const GameEnv *env, PlayerId player_id, bool output_building, bool output_moving)
-                : _env(env), _player_id(player_id), _output_building(output_building), _output_moving(output_moving) {
-                _it = _env->_units.begin();
+                : _i(0), _env(env), _player_id(player_id), _output_building(output_building), _output_moving(output_moving) {
                 next();
             }
             UnitIterator &operator ++() {
-                ++ _it;
+                ++ _i;
                 next();
                 return *this;
             }
 
             const Unit &operator *() {
-                return *_it->second;
+                return _env->_units->At(_i);
             }
 
-            bool end() const { return _it == _env->_units.end(); }
+            bool end() const { return _i == _env->_units->size(); }
     };
 
     GameEnv();
 
+    // A copy of the game, which shares what it does not change with this one. Call it while this
+    // game is not being changed; afterwards both can be simulated on different threads.
+    unique_ptr<GameEnv> Fork() const;
+
     // Remove all players.
     void ClearAllPlayers();
 
@@ -101,6 +138,9 @@ public:
     void AddPlayer(PlayerPrivilege pv);
     void RemovePlayer();
 
+    // Applies to current and future players.
+    void SetFOWMode(FOWMode mode);
+
     int GetNumOfPlayers() const { return _players.size(); }
     int GetGameCounter() const { return _game_counter; }
 
@@ -121,32 +161,18 @@ public:
     // Generate a maze used by Tower Defense.
     bool GenerateTDMaze();
 
-    const Units& GetUnits() const { return _units; }
-    Units& GetUnits() { return _units; }
+    const Units& GetUnits() const { return *_units; }
+    Units& GetUnits() { return _units.Mutable(); }
 
     // Initialize different units for this game.
     void InitGameDef() {
-        _gamedef.InitUnits();
+        _gamedef.Mutable().InitUnits();
     }
-    const GameDef &GetGameDef() const { return _gamedef; }
+    const GameDef &GetGameDef() const { return *_gamedef; }
 
     // Get a unit from its Id.
-    const Unit *GetUnit(UnitId id) const {
-        const Unit *target = nullptr;
-        if (id != INVALID) {
-            auto it = _units.find(id);
-            if (it != _units.end()) target = it->second.get();
-        }
-        return target;
-    }
-    Unit *GetUnit(UnitId id) {
-        Unit *target = nullptr;
-        if (id != INVALID) {
-            auto it = _units.find(id);
-            if (it != _units.end()) target = it->second.get();
-        }
-        return target;
-    }
+    const Unit *GetUnit(UnitId id) const { return _units->Find(id); }
+    Unit *GetUnit(UnitId id) { return _units.Mutable().Find(id); }
 
     // Find the closest base.
     UnitId FindClosestBase(PlayerId player_id) const;
@@ -161,14 +187,21 @@ public:
     bool FindClosestPlaceWithDistance(const PointF &p, int l1_radius,
             const vector<const Unit *>& units, PointF *res_p) const;
 
+    // Units accepted by filter, closest to p first (ties broken by id).
+    // These only visit the map cells around p, rather than all units.
+    bool Accept(const UnitFilter &filter, UnitId id) const;
+    vector<const Unit *> KNearest(const PointF &p, int k, const UnitFilter &filter, float max_r = 1e38) const;
+    vector<const Unit *> WithinRadius(const PointF &p, float r, const UnitFilter &filter) const;
+
     const Player &GetPlayer(PlayerId player_id) const { return _players[player_id]; }
     Player &GetPlayer(PlayerId player_id) { return _players[player_id]; }
 
     // Add and remove units.
     bool AddUnit(Tick tick, UnitType type, const PointF &p, PlayerId player_id);
     bool RemoveUnit(const UnitId &id);
+    int GetNumRemovedUnits() const { return _num_removed_units; }
 
-    void AddBullet(const Bullet &b) { _bullets.push_back(b); }
+    void AddBullet(const Bullet &b) { _bullets.Mutable().push_back(b); }
 
     // Check if one player's base has been destroyed.
     PlayerId CheckBase(UnitType base_type) const;
@@ -181,7 +214,8 @@ public:
 
     // Compute bullets cmds.
     void Forward(CmdReceiver *receiver);
-    void ComputeFOW();
+    // If check is true, cross-check the incremental FoW against a full recompute (slow).
+    void ComputeFOW(bool check = false);
 
     UnitIterator GetUnitIterator(PlayerId player_id) const { return UnitIterator(this, player_id, true, true); }
     UnitIterator GetUnitBuildingIterator(PlayerId player_id) const { return UnitIterator(this, player_id, true, false); }
@@ -226,7 +260,7 @@ public:
         }
 
         // cout << "Save bullet" << endl << flush;
-        for (const auto& bullet : _bullets) {
+        for (const auto& bullet : *_bullets) {
             save_class::Save(bullet, game);
         }
     }
@@ -31,8 +31,8 @@ struct UnitProperty {
     // Attributes
     UnitAttr _attr;
 
-    // All CDs.
-    vector<Cooldown> _cds;
+    // All CDs, inline so that a unit does not own any heap memory.
+    std::array<Cooldown, NUM_COOLDOWN> _cds;
 
     // Used for capturing the flag game.
     int _has_flag = 0;
@@ -56,7 +56,7 @@ struct UnitProperty {
 
     UnitProperty()
         : _hp(0), _max_hp(0), _att(0), _def(0), _att_r(0),
-        _speed(0.0), _vis_r(0), _changed_hp(0), _damage_from(INVALID), _attr(ATTR_NORMAL),  _cds(NUM_COOLDOWN) { }
+        _speed(0.0), _vis_r(0), _changed_hp(0), _damage_from(INVALID), _attr(ATTR_NORMAL),  _cds() { }
 
     SERIALIZER(UnitProperty, _hp, _max_hp, _att, _def, _att_r, _speed, _vis_r, _changed_hp, _damage_from, _attr, _cds);
     HASH(UnitProperty, _hp, _max_hp, _att, _def, _att_r, _speed, _vis_r, _changed_hp, _damage_from, _attr, _cds);
@@ -10,7 +10,11 @@
 #ifndef _LOCALITY_SEARCH_H_
 #define _LOCALITY_SEARCH_H_
 
+#include <algorithm>
+#include <cmath>
 #include <limits>
+#include <map>
+#include <queue>
 #include <set>
 #include <sstream>
 #include <vector>
@@ -40,25 +44,16 @@ struct LineCoeff {
 
     LineCoeff(const PointF &p1, const PointF &p2, float line_r, float exclusion_r)
       : _p1(p1), _p2(p2), _line_r(line_r), _exclusion_r(exclusion_r) {
-        const float det = p2.x * p1.y - p1.x * p2.y;
         const float eps = std::numeric_limits<float>::epsilon();
         const float dx = p1.x - p2.x;
         const float dy = p1.y - p2.y;
         const float dist_sqr = dx * dx + dy * dy;
 
-        if (std::abs(det) < eps) {
-            _C = 0;
-            _A = - p2.y;
-            _B = p1.x;
-            float norm = sqrt(_A * _A + _B * _B) + eps;
-            _A /= norm;
-            _B /= norm;
-        } else {
-            const float dist = sqrt(dist_sqr);
-            _C = det / dist;
-            _B = dx / dist;
-            _A = - dy / dist;
-        }
+        // The normal comes from p1 - p2, which also holds for lines through the origin.
+        const float dist = sqrt(dist_sqr);
+        _B = dx / dist;
+        _A = - dy / dist;
+        _C = - (_A * p1.x + _B * p1.y);
         _tx = dx / dist_sqr;
         _ty = dy / dist_sqr;
         _t0 = - (p2.x * dx + p2.y * dy) / dist_sqr;
@@ -110,18 +105,69 @@ struct LineCoeff {
 template <typename T>
 class LocalitySearch {
 private:
+    // Entries of one grid cell, stored as parallel arrays so that a scan over a
+    // cell only touches contiguous memory. Removal swaps the last entry in.
+    struct Cell {
+        std::vector<T> keys;
+        std::vector<PointF> ps;
+        std::vector<float> rs;
+
+        int size() const { return keys.size(); }
+
+        int Push(const T& key, const PointF& p, float r) {
+            keys.push_back(key);
+            ps.push_back(p);
+            rs.push_back(r);
+            return keys.size() - 1;
+        }
+
+        // Remove entry i. Return true if another entry was moved into slot i.
+        bool Erase(int i) {
+            const int last = keys.size() - 1;
+            if (i != last) {
+                keys[i] = keys[last];
+                ps[i] = ps[last];
+                rs[i] = rs[last];
+            }
+            keys.pop_back();
+            ps.pop_back();
+            rs.pop_back();
+            return i != last;
+        }
+
+        void Clear() {
+            keys.clear();
+            ps.clear();
+            rs.clear();
+        }
+    };
+
+    // Where a key lives: a grid cell (or kIrregular) and its slot in that cell.
+    struct Slot {
+        int cell;
+        int idx;
+    };
+    static constexpr int kIrregular = -1;
+
     PointF _pmin;
     PointF _pmax;
     float _margin;
+    // Number of buckets along x and y.
     int _n;
     int _m;
 
+    std::unordered_map<T, Slot> _slots;
+    // Row-major in x: cell (x_i, y_i) is _cells[x_i * _m + y_i].
+    std::vector<Cell> _cells;
+    // Entries that are too large for a cell, or outside [_pmin, _pmax].
+    Cell _irreg;
+
+    // Snapshot layout of the original hash-map based implementation, kept so
+    // that saved games load in both directions. A std::map is saved the same way as
+    // an unordered_map, but in key order, so the bytes and the cells after loading
+    // do not depend on the order the entries were added in.
     using Loc = std::pair<PointF, float>;
-    using KeysToLocs = std::unordered_map<T, Loc>;
-    // If memory usage is an issue, we can store iterator in the grid instead
-    KeysToLocs _keys2locs;
-    KeysToLocs _irreg_keys2locs;
-    std::vector<std::vector<KeysToLocs>> _grid;
+    using KeysToLocs = std::map<T, Loc>;
 
     int GetXBucket(float x) const {
         return static_cast<int>((x - _pmin.x) / _margin);
@@ -144,77 +190,141 @@ private:
             && p.IsIn(_pmin, _pmax);
     }
 
-    static bool CheckCollision(const Loc& loc1, const Loc& loc2) {
-      const float dist_sqr = PointF::L2Sqr(loc1.first, loc2.first);
-      const float sum_dist = loc1.second + loc2.second;
+    // Bucket of a coordinate clamped to the grid, safe for points far outside it.
+    int ClampedXBucket(float x) const {
+        const float b = (x - _pmin.x) / _margin;
+        return b <= 0 ? 0 : (b >= _n - 1 ? _n - 1 : static_cast<int>(b));
+    }
+
+    int ClampedYBucket(float y) const {
+        const float b = (y - _pmin.y) / _margin;
+        return b <= 0 ? 0 : (b >= _m - 1 ? _m - 1 : static_cast<int>(b));
+    }
+
+    int CellOf(const PointF& p, const float radius) const {
+        if (! IsRegular(p, radius)) return kIrregular;
+        return GetXBucket(p) * _m + GetYBucket(p);
+    }
+
+    Cell &GetCell(int c) { return c == kIrregular ? _irreg : _cells[c]; }
+    const Cell &GetCell(int c) const { return c == kIrregular ? _irreg : _cells[c]; }
+
+    static bool CheckCollision(const PointF& p1, float r1, const PointF& p2, float r2) {
+      const float dist_sqr = PointF::L2Sqr(p1, p2);
+      const float sum_dist = r1 + r2;
       return dist_sqr < sum_dist * sum_dist;
     }
 
-    bool _line_passable(const LineCoeff &c, int x_ind, int y_ind, T* id, LineResult* result) const {
-        if (x_ind < 0 || x_ind >= _m || y_ind < 0 || y_ind >= _n) return true;
-        for (const auto& item : _grid[x_ind][y_ind]) {
-            if (! c.IsPassable(item.second.first, item.second.second, result)) {
-                if (id) *id = item.first;
-                return false;
-            }
+    void insert(const T& key, const PointF& p, const float radius) {
+        const int c = CellOf(p, radius);
+        _slots[key] = Slot{c, GetCell(c).Push(key, p, radius)};
+    }
+
+    void erase(const Slot& slot) {
+        Cell &cell = GetCell(slot.cell);
+        if (cell.Erase(slot.idx)) _slots[cell.keys[slot.idx]].idx = slot.idx;
+    }
+
+    bool _cell_empty(const Cell& cell, const PointF& p, float radius, const T& key_exclude) const {
+        for (int i = 0; i < cell.size(); ++i) {
+            if (cell.keys[i] == key_exclude) continue;
+            if (CheckCollision(p, radius, cell.ps[i], cell.rs[i])) return false;
         }
         return true;
     }
 
-    bool _line_irregular_passable(const LineCoeff &c, T* id, LineResult *result) const {
-        for (const auto& item : _irreg_keys2locs) {
-            // cout << "Check irregular " << item.second.first << " radius = " << item.second.second << endl;
-            if (! c.IsPassable(item.second.first, item.second.second, result)) {
-                if (id) *id = item.first;
+    void _cell_closest(const Cell& cell, const PointF& p, const T** res, float* min_dist) const {
+        for (int i = 0; i < cell.size(); ++i) {
+            const float r = cell.rs[i];
+            const float dist_sqr = PointF::L2Sqr(p, cell.ps[i]);
+            if (dist_sqr < r * r && dist_sqr < *min_dist) {
+                *res = &cell.keys[i];
+                *min_dist = dist_sqr;
+            }
+        }
+    }
+
+    bool _cell_line_passable(const LineCoeff &c, const Cell& cell, const T& key_exclude, T* id, LineResult* result) const {
+        for (int i = 0; i < cell.size(); ++i) {
+            if (cell.keys[i] == key_exclude) continue;
+            if (! c.IsPassable(cell.ps[i], cell.rs[i], result)) {
+                if (id) *id = cell.keys[i];
                 return false;
             }
         }
         return true;
     }
 
+    bool _line_passable(const LineCoeff &c, int x_ind, int y_ind, const T& key_exclude, T* id, LineResult* result) const {
+        if (x_ind < 0 || x_ind >= _n || y_ind < 0 || y_ind >= _m) return true;
+        return _cell_line_passable(c, _cells[x_ind * _m + y_ind], key_exclude, id, result);
+    }
+
+    // Push the entries of cell within max_dist_sqr of p, keeping the best k in a max-heap.
+    template <typename Pred>
+    void _cell_nearest(const Cell& cell, const PointF& p, size_t k, float max_dist_sqr, Pred& pred,
+        std::priority_queue<std::pair<float, T>>* heap) const {
+        for (int i = 0; i < cell.size(); ++i) {
+            const float dist_sqr = PointF::L2Sqr(p, cell.ps[i]);
+            if (dist_sqr > max_dist_sqr) continue;
+            if (heap->size() == k && ! (std::make_pair(dist_sqr, cell.keys[i]) < heap->top())) continue;
+            if (! pred(cell.keys[i])) continue;
+            heap->emplace(dist_sqr, cell.keys[i]);
+            if (heap->size() > k) heap->pop();
+        }
+    }
+
+    // Grid size for _pmin, _pmax and _margin. The cells are not touched.
+    void _init_grid() {
+        _n = static_cast<int>((_pmax.x - _pmin.x + _margin) / _margin);
+        _m = static_cast<int>((_pmax.y - _pmin.y + _margin) / _margin);
+    }
+
 public:
-    LocalitySearch() {};
+    LocalitySearch() : _margin(1.0), _n(0), _m(0) {};
 
     LocalitySearch(
         const PointF& pmin,
         const PointF& pmax,
         const float max_radius = kUnitRadius)
             : _pmin(pmin), _pmax(pmax), _margin(2 * max_radius) {
-        _n = static_cast<int>((_pmax.x - _pmin.x + _margin) / _margin);
-        _m = static_cast<int>((_pmax.y - _pmin.y + _margin) / _margin);
-        _grid.resize(_n, std::vector<KeysToLocs>(_m));
+        _init_grid();
+        _cells.assign(_n * _m, Cell());
     }
 
     // Add location and key
     void Add(const T& key, const PointF& p, const float radius) {
-        const auto loc = Loc(p, radius);
-        _keys2locs.emplace(key, loc);
-        if (IsRegular(p, radius)) {
-            int x_i = GetXBucket(p);
-            int y_i = GetYBucket(p);
-            // cout << "Add " << p << " to (" << x_i << ", " << y_i << ")" << endl;
-            _grid[x_i][y_i].emplace(key, loc);
+        // Same as emplace(): an existing key is left untouched.
+        if (Exists(key)) return;
+        insert(key, p, radius);
+    }
+
+    // Move an existing key to p, keeping its radius. The entry is updated in
+    // place if it stays in the same cell.
+    bool Move(const T& key, const PointF& p) {
+        auto it = _slots.find(key);
+        if (it == _slots.end()) return false;
+        const Slot slot = it->second;
+        Cell &cell = GetCell(slot.cell);
+        const float radius = cell.rs[slot.idx];
+        const int c = CellOf(p, radius);
+        if (c == slot.cell) {
+            cell.ps[slot.idx] = p;
         } else {
-            // cout << "Add " << p << " to irregular spot" << " # size = " << _irreg_keys2locs.size() << endl;
-            _irreg_keys2locs.emplace(key, loc);
+            erase(slot);
+            insert(key, p, radius);
         }
+        return true;
     }
 
     bool Exists(const T& key) const {
-        return _keys2locs.find(key) != _keys2locs.end();
+        return _slots.find(key) != _slots.end();
     }
 
     bool IsEmpty(const PointF& p, const float radius,
         const T& key_exclude = INVALID) const {
-        const auto loc = Loc(p, radius);
         if (!IsRegular(p, radius)) {
-            for (const auto& item : _irreg_keys2locs) {
-                if (item.first == key_exclude) continue;
-                if (CheckCollision(loc, item.second)) {
-                    return false;
-                }
-            }
-            return true;
+            return _cell_empty(_irreg, p, radius, key_exclude);
         }
         const int bx = GetXBucket(p);
         const int by = GetYBucket(p);
@@ -223,99 +333,84 @@ public:
             if (bx + dx < 0 || bx + dx >= _n) continue;
             for (int dy = -1; dy <= 1; ++dy) {
                 if (by + dy < 0 || by + dy >= _m) continue;
-                for (const auto& item : _grid[bx + dx][by + dy]) {
-                    if (item.first == key_exclude) continue;
-                    if (CheckCollision(loc, item.second)) {
-                        return false;
-                    }
-                }
+                if (! _cell_empty(_cells[(bx + dx) * _m + by + dy], p, radius, key_exclude)) return false;
             }
         }
         return true;
     }
 
     // Check whether a line of a given radius can pass though all the points.
-    // Note that we exclude the region around p1 and p2.
-    bool LinePassable(const PointF &p1, const PointF &p2, float line_radius, float exclusion_radius, T* id, LineResult *result) const {
+    // Note that we exclude the region around p1 and p2, and the entry key_exclude.
+    bool LinePassable(const PointF &p1, const PointF &p2, float line_radius, float exclusion_radius, T* id, LineResult *result,
+        const T& key_exclude = INVALID) const {
         LineCoeff c(p1, p2, line_radius, exclusion_radius);
-        bool line_passable = true;
-        const PointF *p_min = &p1;
-        const PointF *p_max = &p2;
-
-        if (! _line_irregular_passable(c, id, result)) return false;
-
-        // Compute the bucket we want to check on.
-        // Pick the coordinates with smaller magnitude.
-        if (abs(c._A) > abs(c._B)) {
-            // We loop over y.
-            if (p_min->y > p_max->y) std::swap(p_min, p_max);
-
-            // Go through the bucket and check
-            int idx_min = GetYBucket(p_min->y);
-            int idx_max = GetYBucket(p_max->y);
-            // cout << "Loop over y: idx_min = " << idx_min << ", idx_max = " << idx_max << endl;
-
-            for (int y_i = idx_min; y_i <= idx_max && line_passable; ++y_i) {
-                // Get X bucket.
-                float y = p_min->y + (y_i - idx_min) * _margin;
-                float x = c.GetXFromY(y);
-                int x_i = GetXBucket(x);
-                // cout << "(x, y) = (" << x << ", " << y << ")" << " (x_i, y_i) = (" << x_i << ", " << y_i << ")" << endl;
-                // Check x_i - 1, x_i and x_i + 1.
-                line_passable = _line_passable(c, x_i, y_i, id, result) \
-                                && _line_passable(c, x_i - 1, y_i, id, result) \
-                                && _line_passable(c, x_i + 1, y_i, id, result);
-            }
-        } else {
-            if (p_min->x > p_max->x) std::swap(p_min, p_max);
-
-            // Go through the bucket and check
-            int idx_min = GetXBucket(p_min->x);
-            int idx_max = GetXBucket(p_max->x);
-
-            // cout << "Loop over x: idx_min = " << idx_min << ", idx_max = " << idx_max << endl;
-
-            for (int x_i = idx_min; x_i <= idx_max && line_passable; ++x_i) {
-                // Get Y bucket.
-                float x = p_min->x + (x_i - idx_min) * _margin;
-                float y = c.GetYFromX(x);
-                int y_i = GetYBucket(y);
-                // cout << "(x, y) = (" << x << ", " << y << ")" << " (x_i, y_i) = (" << x_i << ", " << y_i << ")" << endl;
-                // Check y_i - 1, y_i and y_i + 1.
-                line_passable = _line_passable(c, x_i, y_i, id, result) \
-                                && _line_passable(c, x_i, y_i - 1, id, result) \
-                                && _line_passable(c, x_i, y_i + 1, id, result);
+
+        if (! _cell_line_passable(c, _irreg, key_exclude, id, result)) return false;
+
+        // Regular entries sit in the bucket of their center and have radius at most _margin / 2,
+        // so a blocking center is within w of the segment. Walk the buckets along the longer axis
+        // ("rows"), and in each row check the span of buckets such a center can fall in.
+        const float w = line_radius + _margin / 2;
+        const bool along_y = std::abs(p2.y - p1.y) > std::abs(p2.x - p1.x);
+        float a0 = along_y ? p1.y : p1.x, a1 = along_y ? p2.y : p2.x;
+        float b0 = along_y ? p1.x : p1.y, b1 = along_y ? p2.x : p2.y;
+        if (a0 > a1) {
+            std::swap(a0, a1);
+            std::swap(b0, b1);
+        }
+        const float slope = a1 > a0 ? (b1 - b0) / (a1 - a0) : 0;
+        const float amin = along_y ? _pmin.y : _pmin.x;
+        const float bmin = along_y ? _pmin.x : _pmin.y;
+        const int na = along_y ? _m : _n;
+        const int nb = along_y ? _n : _m;
+        auto bucket = [&](float v, float vmin) { return static_cast<int>(std::floor((v - vmin) / _margin)); };
+
+        const int i_lo = std::max(0, bucket(a0 - w, amin));
+        const int i_hi = std::min(na - 1, bucket(a1 + w, amin));
+        for (int i = i_lo; i <= i_hi; ++i) {
+            // The part of the segment whose points are within w of this row (along the long axis).
+            const float lo = std::max(a0, amin + i * _margin - w);
+            const float hi = std::min(a1, amin + (i + 1) * _margin + w);
+            if (lo > hi) continue;
+            const float bl = b0 + (lo - a0) * slope;
+            const float bh = b0 + (hi - a0) * slope;
+            const int j_lo = std::max(0, bucket(std::min(bl, bh) - w, bmin));
+            const int j_hi = std::min(nb - 1, bucket(std::max(bl, bh) + w, bmin));
+            for (int j = j_lo; j <= j_hi; ++j) {
+                const int x_i = along_y ? j : i;
+                const int y_i = along_y ? i : j;
+                if (! _line_passable(c, x_i, y_i, key_exclude, id, result)) return false;
             }
         }
-        return line_passable;
+        return true;
     }
 
     // Remove the entry.
     void Remove(const T& key) {
-        const auto it = _keys2locs.find(key);
-        if (it != _keys2locs.end()) {
-            const auto& p = it->second.first;
-            if (IsRegular(p, it->second.second)) {
-                _grid[GetXBucket(p)][GetYBucket(p)].erase(key);
-            } else {
-                _irreg_keys2locs.erase(key);
-            }
-            _keys2locs.erase(it);
+        const auto it = _slots.find(key);
+        if (it != _slots.end()) {
+            const Slot slot = it->second;
+            _slots.erase(it);
+            erase(slot);
         }
     }
 
     // Retrieval.
     // Find the object within its radius.
+    // A regular object contains p only if its center is within _margin / 2 of p,
+    // so only the 3x3 cells around p (and the irregular ones) are checked.
     const T* Loc2Key(const PointF& p, float* const min_dist_sqr) const {
         const T* res = nullptr;
         float min_dist = std::numeric_limits<float>::max();
-        for (const auto& item : _keys2locs) {
-            const auto& q = item.second.first;
-            const float r = item.second.second;
-            const float dist_sqr = PointF::L2Sqr(p, q);
-            if (dist_sqr < r * r && dist_sqr < min_dist) {
-                res = &item.first;
-                min_dist = dist_sqr;
+        _cell_closest(_irreg, p, &res, &min_dist);
+        const PointF lo(_pmin.x - _margin, _pmin.y - _margin), hi(_pmax.x + _margin, _pmax.y + _margin);
+        if (_n > 0 && _m > 0 && p.IsIn(lo, hi)) {
+            const int bx = GetXBucket(p);
+            const int by = GetYBucket(p);
+            for (int x_i = std::max(bx - 1, 0); x_i <= std::min(bx + 1, _n - 1); ++x_i) {
+                for (int y_i = std::max(by - 1, 0); y_i <= std::min(by + 1, _m - 1); ++y_i) {
+                    _cell_closest(_cells[x_i * _m + y_i], p, &res, &min_dist);
+                }
             }
         }
         *min_dist_sqr = min_dist;
@@ -323,45 +418,156 @@ public:
     }
 
     const PointF* Key2Loc(const T& key) const {
-        const auto it = _keys2locs.find(key);
-        return it == _keys2locs.end() ? nullptr : &it->second->first;
+        const auto it = _slots.find(key);
+        return it == _slots.end() ? nullptr : &GetCell(it->second.cell).ps[it->second.idx];
     }
 
     std::set<T> KeysInRegion(
         const PointF& left_top,
         const PointF& right_bottom) const {
         std::set<T> res;
-        for (const auto& item : _keys2locs) {
-            const auto& p = item.second.first;
-            if (p.IsIn(left_top, right_bottom)) {
-                res.insert(item.first);
+        auto collect = [&](const Cell& cell) {
+            for (int i = 0; i < cell.size(); ++i) {
+                if (cell.ps[i].IsIn(left_top, right_bottom)) res.insert(cell.keys[i]);
             }
+        };
+        collect(_irreg);
+        if (_n == 0 || _m == 0 || left_top.x > right_bottom.x || left_top.y > right_bottom.y) return res;
+
+        // Buckets are monotonic in the coordinates, so points in the region are in these cells.
+        const int x0 = std::max(GetXBucket(std::max(left_top.x, _pmin.x)), 0);
+        const int x1 = std::min(GetXBucket(std::min(right_bottom.x, _pmax.x)), _n - 1);
+        const int y0 = std::max(GetYBucket(std::max(left_top.y, _pmin.y)), 0);
+        const int y1 = std::min(GetYBucket(std::min(right_bottom.y, _pmax.y)), _m - 1);
+        for (int x_i = x0; x_i <= x1; ++x_i) {
+            for (int y_i = y0; y_i <= y1; ++y_i) collect(_cells[x_i * _m + y_i]);
         }
         return res;
     }
 
-    void Clear() {
-        _keys2locs.clear();
-        _irreg_keys2locs.clear();
-        for (auto& row : _grid) {
-            for (auto& item : row) {
-                item.clear();
+    // Up to k keys accepted by pred(key), nearest to p first, with their squared distances.
+    // Distances are between centers, ties are broken by key, and keys farther than
+    // max_dist are skipped. Cells are visited in rings around p, stopping as soon as
+    // no unvisited ring can hold anything closer than the current k-th key.
+    template <typename Pred>
+    std::vector<std::pair<float, T>> KNearest(const PointF& p, int k, Pred pred,
+        float max_dist = std::numeric_limits<float>::max()) const {
+        std::vector<std::pair<float, T>> res;
+        if (k <= 0) return res;
+        const float max_dist_sqr = max_dist >= std::sqrt(std::numeric_limits<float>::max()) ?
+            std::numeric_limits<float>::max() : max_dist * max_dist;
+
+        std::priority_queue<std::pair<float, T>> heap;
+        _cell_nearest(_irreg, p, k, max_dist_sqr, pred, &heap);
+
+        if (_n > 0 && _m > 0) {
+            const int bx = ClampedXBucket(p.x);
+            const int by = ClampedYBucket(p.y);
+            const int max_ring = std::max(std::max(bx, _n - 1 - bx), std::max(by, _m - 1 - by));
+            for (int d = 0; d <= max_ring; ++d) {
+                // Anything in ring d is at least (d - 1) * _margin away from p.
+                const float bound = (d - 1) * _margin;
+                if (d > 0 && bound > 0 && bound * bound > max_dist_sqr) break;
+                if (d > 0 && heap.size() == (size_t)k && bound > 0 && heap.top().first < bound * bound) break;
+
+                for (int x_i = bx - d; x_i <= bx + d; ++x_i) {
+                    if (x_i < 0 || x_i >= _n) continue;
+                    // Only the border of the ring: all y on its left/right columns, two cells otherwise.
+                    const bool edge = (x_i == bx - d || x_i == bx + d);
+                    for (int y_i = by - d; y_i <= by + d; y_i += (edge || d == 0) ? 1 : 2 * d) {
+                        if (y_i < 0 || y_i >= _m) continue;
+                        _cell_nearest(_cells[x_i * _m + y_i], p, k, max_dist_sqr, pred, &heap);
+                    }
+                }
             }
         }
+
+        res.resize(heap.size());
+        for (int i = res.size() - 1; i >= 0; --i) {
+            res[i] = heap.top();
+            heap.pop();
+        }
+        return res;
+    }
+
+    // All keys accepted by pred(key) whose center is within r of p, nearest first
+    // (ties broken by key), with their squared distances.
+    template <typename Pred>
+    std::vector<std::pair<float, T>> WithinRadius(const PointF& p, float r, Pred pred) const {
+        std::vector<std::pair<float, T>> res;
+        const float r_sqr = r * r;
+        auto collect = [&](const Cell& cell) {
+            for (int i = 0; i < cell.size(); ++i) {
+                const float dist_sqr = PointF::L2Sqr(p, cell.ps[i]);
+                if (dist_sqr <= r_sqr && pred(cell.keys[i])) res.emplace_back(dist_sqr, cell.keys[i]);
+            }
+        };
+        collect(_irreg);
+        if (_n > 0 && _m > 0 && r >= 0) {
+            const int x0 = ClampedXBucket(p.x - r), x1 = ClampedXBucket(p.x + r);
+            const int y0 = ClampedYBucket(p.y - r), y1 = ClampedYBucket(p.y + r);
+            for (int x_i = x0; x_i <= x1; ++x_i) {
+                for (int y_i = y0; y_i <= y1; ++y_i) collect(_cells[x_i * _m + y_i]);
+            }
+        }
+        std::sort(res.begin(), res.end());
+        return res;
+    }
+
+    void Clear() {
+        _slots.clear();
+        _irreg.Clear();
+        for (auto& cell : _cells) cell.Clear();
     }
 
     std::string PrintDebugInfo() const {
         std::stringstream ss;
         ss << "Locality table: " << endl;
-        for (const auto& item : _keys2locs) {
-            ss << "Id " << item.first << " -> " << item.second.first << ", "
-                << item.second.second << std::endl;
+        for (const auto& item : _slots) {
+            const Cell &cell = GetCell(item.second.cell);
+            ss << "Id " << item.first << " -> " << cell.ps[item.second.idx] << ", "
+                << cell.rs[item.second.idx] << std::endl;
         }
         return ss.str();
     }
 
-    SERIALIZER(LocalitySearch,
-        _pmin, _pmax, _margin, _keys2locs, _irreg_keys2locs, _grid);
+    // Snapshots keep the layout of SERIALIZER(LocalitySearch, _pmin, _pmax, _margin,
+    // _keys2locs, _irreg_keys2locs, _grid) used by the hash-map based implementation.
+    serializer::saver &Save(serializer::saver &oo) const {
+        KeysToLocs keys2locs, irreg_keys2locs;
+        std::vector<std::vector<KeysToLocs>> grid(_n, std::vector<KeysToLocs>(_m));
+        for (const auto& item : _slots) {
+            const Cell &cell = GetCell(item.second.cell);
+            const Loc loc(cell.ps[item.second.idx], cell.rs[item.second.idx]);
+            keys2locs.emplace(item.first, loc);
+            if (item.second.cell == kIrregular) irreg_keys2locs.emplace(item.first, loc);
+            else grid[item.second.cell / _m][item.second.cell % _m].emplace(item.first, loc);
+        }
+        serializer::Save(oo, _pmin, _pmax, _margin, keys2locs, irreg_keys2locs, grid);
+        if (! oo.is_binary()) oo.get() << "\n";
+        return oo;
+    }
+
+    serializer::loader &Load(serializer::loader &ii) {
+        KeysToLocs keys2locs, irreg_keys2locs;
+        std::vector<std::vector<KeysToLocs>> grid;
+        serializer::Load(ii, _pmin, _pmax, _margin, keys2locs, irreg_keys2locs, grid);
+        _init_grid();
+        // Keep the cells (and what they have allocated) if the grid has the same size.
+        if (_cells.size() != (size_t)(_n * _m)) _cells.assign(_n * _m, Cell());
+        Clear();
+        // The cells are derived from the positions.
+        for (const auto& item : keys2locs) insert(item.first, item.second.first, item.second.second);
+        return ii;
+    }
+
+    friend serializer::saver &operator<<(serializer::saver &oo, const LocalitySearch &p) {
+        return p.Save(oo);
+    }
+
+    friend serializer::loader &operator>>(serializer::loader &ii, LocalitySearch& p) {
+        return p.Load(ii);
+    }
 };
 
 #endif
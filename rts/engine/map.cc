@@ -9,6 +9,7 @@
 
 #include "map.h"
 #include "time.h"
+#include <atomic>
 
 // Constructor
 RTSMap::RTSMap() {
@@ -32,12 +33,14 @@ bool RTSMap::find_two_nearby_empty_slots(const std::function<uint16_t(int)>& f,
 }
 
 bool RTSMap::GenerateImpassable(const std::function<uint16_t(int)>& f, int nImpassable) {
-    _map.assign(_m * _n * _level, MapSlot());
+    vector<MapSlot> &slots = _map.Mutable();
+    slots.assign(_m * _n * _level, MapSlot());
     for (int i = 0; i < nImpassable; ++i) {
         const int x = f(_m);
         const int y = f(_n);
-        _map[GetLoc(Coord(x, y))].type = IMPASSABLE;
+        slots[GetLoc(Coord(x, y))].type = IMPASSABLE;
     }
+    OnTerrainChanged();
     return true;
 }
 
@@ -45,11 +48,12 @@ bool RTSMap::GenerateTDMaze(const std::function<uint16_t(int)>& f) {
     const int blank = 3;
     int m = _m / 2;
     int n = _n / 2;
-    _map.assign(_m * _n * _level, MapSlot());
+    vector<MapSlot> &slots = _map.Mutable();
+    slots.assign(_m * _n * _level, MapSlot());
     for (int x = 0; x < _m; x++) {
         for (int y = 0; y < _n; y++) {
         if ((x < _m - blank * 2) || (y < _n - blank * 2))
-            _map[GetLoc(Coord(x, y))].type = IMPASSABLE;
+            slots[GetLoc(Coord(x, y))].type = IMPASSABLE;
         }
     }
     int maze[m * n];
@@ -95,8 +99,8 @@ bool RTSMap::GenerateTDMaze(const std::function<uint16_t(int)>& f) {
         maze[curr] = 1;
         int xc = curr / m;
         int yc = curr % m;
-        _map[GetLoc(Coord(xc * 2, yc * 2))].type = NORMAL;
-        _map[GetLoc(Coord(xc * 2 - dx[coming_from], yc * 2 - dy[coming_from]))].type = NORMAL;
+        slots[GetLoc(Coord(xc * 2, yc * 2))].type = NORMAL;
+        slots[GetLoc(Coord(xc * 2 - dx[coming_from], yc * 2 - dy[coming_from]))].type = NORMAL;
         for (size_t i = 0; i < sizeof(dx) / sizeof(int); ++i) {
             int xn = xc + dx[i];
             int yn = yc + dy[i];
@@ -105,6 +109,7 @@ bool RTSMap::GenerateTDMaze(const std::function<uint16_t(int)>& f) {
             previous.push_back(i);
         }
     }
+    OnTerrainChanged();
     return true;
 }
 
@@ -138,75 +143,174 @@ bool RTSMap::GenerateMap(const std::function<uint16_t(int)>& f, int nImpassable,
 
 void RTSMap::reset_intermediates() {
     // Locality Search
-    _locality = LocalitySearch<UnitId>(PointF(-0.5, -0.5), PointF(_m + 0.5, _n + 0.5));
-
-    // Precompute map structure.
-    precompute_all_pair_distances();
+    _locality = CowPtr<LocalitySearch<UnitId>>(LocalitySearch<UnitId>(PointF(-0.5, -0.5), PointF(_m + 0.5, _n + 0.5)));
 }
 
 void RTSMap::load_default_map() {
     _m = 20;
     _n = 20;
     _level = 1;
-    _map.assign(_m * _n * _level, MapSlot());
+    _map.Mutable().assign(_m * _n * _level, MapSlot());
+    OnTerrainChanged();
+}
+
+void RTSMap::OnTerrainChanged() {
+    static std::atomic<int> next_version(0);
+    _terrain_version = next_version ++;
+
+    // Precompute map structure.
+    precompute_all_pair_distances();
 }
 
 void RTSMap::precompute_all_pair_distances() {
-    // All-pair shortest distance for path-planning.
-    // Floyd–Warshall algorithm O(V^3) = O(m^3n^3)
-    // Not extremely fast, but since it is only computed
-    // once for each map, we could just use it.
+    // Exact all-pair distances would take O(m^2n^2) memory. Landmark distances give
+    // path-planning a lower bound for any pair with a few BFS from landmarks.
+    vector<bool> passable(GetPlaneSize());
+    for (int y = 0; y < _n; ++y) {
+        for (int x = 0; x < _m; ++x) {
+            const Loc loc = GetLoc(x, y);
+            passable[loc] = ((*_map)[loc].type != IMPASSABLE);
+        }
+    }
+    // A new oracle, rather than rebuilding one that copies of the map may share.
+    _oracle = CowPtr<DistanceOracle>();
+    _oracle.Mutable().Build(_m, _n, passable);
+}
+
+serializer::saver &RTSMap::Save(serializer::saver &oo) const {
+    serializer::Save(oo, _m, _n, _level, _map, _infos, _locality);
+    if (! oo.is_binary()) oo.get() << "\n";
+    return oo;
+}
+
+serializer::loader &RTSMap::Load(serializer::loader &ii) {
+    int m, n, level;
+    ii >> m >> n >> level;
+    const int size = ii.read_size(1);
+    bool changed = (m != _m || n != _n || level != _level || size != (int)_map->size());
+    _m = m;
+    _n = n;
+    _level = level;
+    vector<MapSlot> &slots = _map.Mutable();
+    slots.resize(size);
+    for (auto &slot : slots) {
+        const Terrain type = slot.type;
+        ii >> slot;
+        if (slot.type != type) changed = true;
+    }
+    ii >> _infos >> _locality;
+    if (changed) OnTerrainChanged();
+    return ii;
 }
 
 bool RTSMap::AddUnit(const UnitId &id, const PointF& new_p) {
-    if (_locality.Exists(id)) return false;
-    if (! _locality.IsEmpty(new_p, kUnitRadius, INVALID)) return false;
+    if (_locality->Exists(id)) return false;
+    if (! _locality->IsEmpty(new_p, kUnitRadius, INVALID)) return false;
 
-    _locality.Add(id, new_p, kUnitRadius);
+    _locality.Mutable().Add(id, new_p, kUnitRadius);
     return true;
 }
 
 bool RTSMap::MoveUnit(const UnitId &id, const PointF& new_p) {
-    if (! _locality.Exists(id)) return false;
-    if (! _locality.IsEmpty(new_p, kUnitRadius, id)) return false;
+    if (! _locality->Exists(id)) return false;
+    if (! _locality->IsEmpty(new_p, kUnitRadius, id)) return false;
 
-    _locality.Remove(id);
-    _locality.Add(id, new_p, kUnitRadius);
+    _locality.Mutable().Move(id, new_p);
     return true;
 }
 
 bool RTSMap::RemoveUnit(const UnitId &id) {
-    if (! _locality.Exists(id)) return false;
-    _locality.Remove(id);
+    if (! _locality->Exists(id)) return false;
+    _locality.Mutable().Remove(id);
     return true;
 }
 
+bool RTSMap::IsLinePassable(const PointF &s, const PointF &t, UnitId id_exclude) const {
+    const Coord cs = s.ToCoord();
+    const Coord ct = t.ToCoord();
+
+    // Walk the cells crossed by the segment (Amanatides-Woo). Cell c spans [c - 0.5, c + 0.5)
+    // on each axis, and t_max_* is the segment parameter of the next boundary on that axis.
+    // Each step moves one axis towards ct, so the walk ends on ct after n steps.
+    const float dx = t.x - s.x;
+    const float dy = t.y - s.y;
+    const float inf = std::numeric_limits<float>::infinity();
+    const int step_x = dx > 0 ? 1 : -1;
+    const int step_y = dy > 0 ? 1 : -1;
+    const float t_delta_x = dx != 0 ? 1.0 / std::abs(dx) : inf;
+    const float t_delta_y = dy != 0 ? 1.0 / std::abs(dy) : inf;
+    float t_max_x = dx != 0 ? (cs.x + 0.5 * step_x - s.x) / dx : inf;
+    float t_max_y = dy != 0 ? (cs.y + 0.5 * step_y - s.y) / dy : inf;
+
+    Coord c = cs;
+    // Move to the next cell, and return the segment parameter where it is entered.
+    auto step = [&]() -> float {
+        float entered;
+        if (c.x != ct.x && (c.y == ct.y || t_max_x < t_max_y)) {
+            c.x += step_x;
+            entered = t_max_x;
+            t_max_x += t_delta_x;
+        } else {
+            c.y += step_y;
+            entered = t_max_y;
+            t_max_y += t_delta_y;
+        }
+        return std::min(1.0f, std::max(0.0f, entered));
+    };
+
+    // Like the cells of s and t, units are only checked between them.
+    const int n = std::abs(ct.x - cs.x) + std::abs(ct.y - cs.y);
+    if (n <= 1) return true;
+
+    const float t_leave_s = step();
+    if (! CanPass(c, INVALID, false)) return false;
+    for (int i = 1; i + 1 < n; ++i) {
+        step();
+        if (! CanPass(c, INVALID, false)) return false;
+    }
+    const float t_enter_t = step();
+
+    // Then the units, once, against a capsule swept over the part of the segment in between.
+    const PointF a(s.x + dx * t_leave_s, s.y + dy * t_leave_s);
+    const PointF b(s.x + dx * t_enter_t, s.y + dy * t_enter_t);
+    if (PointF::L2Sqr(a, b) < 1e-6) return true;
+
+    LineResult result;
+    UnitId block_id = INVALID;
+    return _locality->LinePassable(a, b, kUnitRadius, 0, &block_id, &result, id_exclude);
+}
+
 UnitId RTSMap::GetClosestUnitId(const PointF& p, float max_r) const {
     float dist_sqr;
-    const UnitId *res = _locality.Loc2Key(p, &dist_sqr);
+    const UnitId *res = _locality->Loc2Key(p, &dist_sqr);
     if (res == nullptr || dist_sqr >= max_r * max_r ) return INVALID;
     return *res;
 }
 
 set<UnitId> RTSMap::GetUnitIdInRegion(const PointF &left_top, const PointF &right_bottom) const {
-    return _locality.KeysInRegion(left_top, right_bottom);
+    return _locality->KeysInRegion(left_top, right_bottom);
 }
 
-vector<Loc> RTSMap::GetSight(const Loc& loc, int range) const {
-    Coord c = GetCoord(loc);
-    vector<Loc> res;
+static vector<UnitId> ids_of(const vector<pair<float, UnitId>> &items) {
+    vector<UnitId> res;
+    res.reserve(items.size());
+    for (const auto &item : items) res.push_back(item.second);
+    return res;
+}
 
-    const int xmin = std::max(0, c.x - range);
-    const int xmax = std::min(_m - 1, c.x + range);
+vector<UnitId> RTSMap::KNearest(const PointF &p, int k, const UnitIdFilter &filter, float max_r) const {
+    if (filter == nullptr) return ids_of(_locality->KNearest(p, k, [](const UnitId &) { return true; }, max_r));
+    return ids_of(_locality->KNearest(p, k, filter, max_r));
+}
 
-    for (int x = xmin; x <= xmax; ++x) {
-        const int yrange = range - std::abs(c.x  - x);
-        const int ymin = std::max(0, c.y - yrange);
-        const int ymax = std::min(_n - 1, c.y + yrange);
-        for (int y = ymin; y <= ymax; ++y) {
-            res.push_back(GetLoc(x, y));
-        }
-    }
+vector<UnitId> RTSMap::WithinRadius(const PointF &p, float r, const UnitIdFilter &filter) const {
+    if (filter == nullptr) return ids_of(_locality->WithinRadius(p, r, [](const UnitId &) { return true; }));
+    return ids_of(_locality->WithinRadius(p, r, filter));
+}
+
+vector<Loc> RTSMap::GetSight(const Loc& loc, int range) const {
+    vector<Loc> res;
+    ForEachInSight(loc, range, [&](Loc l) { res.push_back(l); });
     return res;
 }
 
@@ -241,7 +345,7 @@ string RTSMap::Draw() const {
         for (int i = 0; i < _m; ++i) {
             // Draw the map (only level 0)
             Loc loc = GetLoc(i, j, 0);
-            ss << _map[loc].type << " ";
+            ss << (*_map)[loc].type << " ";
         }
         ss << endl;
     }
@@ -249,5 +353,5 @@ string RTSMap::Draw() const {
 }
 
 string RTSMap::PrintDebugInfo() const {
-    return _locality.PrintDebugInfo();
+    return _oracle->GetStats().PrintInfo() + "\n" + _locality->PrintDebugInfo();
 }
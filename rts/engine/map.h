@@ -10,10 +10,13 @@
 #ifndef _MAP_H_
 #define _MAP_H_
 
+#include <algorithm>
 #include <functional>
 #include <vector>
 #include "common.h"
+#include "cow_ptr.h"
 #include "locality_search.h"
+#include "distance_oracle.h"
 
 struct MapSlot {
   // three layers, terrian, ground and air.
@@ -42,9 +45,11 @@ struct PlayerMapInfo {
 
 // Map properties.
 // Map location is an integer.
+// The terrain, the oracle and the locality search are shared copy-on-write, so copies of a map
+// (see GameEnv::Fork()) are cheap, and only copy the locality search once units move.
 class RTSMap {
 private:
-  vector<MapSlot> _map;
+  CowPtr<vector<MapSlot>> _map;
 
   // Size of the map.
   int _m, _n, _level;
@@ -53,7 +58,14 @@ private:
   vector<PlayerMapInfo> _infos;
 
   // Locality search.
-  LocalitySearch<UnitId> _locality;
+  CowPtr<LocalitySearch<UnitId>> _locality;
+
+  // Changes whenever the terrain is regenerated, so caches built on it (e.g. flow fields
+  // for path planning) know they are stale. Unique across maps, not serialized.
+  int _terrain_version;
+
+  // Lower bounds of path lengths, rebuilt with the terrain. Not serialized.
+  CowPtr<DistanceOracle> _oracle;
 
 private:
   void reset_intermediates();
@@ -71,26 +83,35 @@ public:
 
 
   const vector<PlayerMapInfo> &GetPlayerMapInfo() const { return _infos; }
-  void ClearMap() { _infos.clear(); _locality.Clear();}
+  void ClearMap() { _infos.clear(); _locality.Mutable().Clear();}
 
-  const MapSlot &operator()(const Loc& loc) const { return _map[loc]; }
-  MapSlot &operator()(const Loc& loc) { return _map[loc]; }
+  // Read-only: flow fields and the distance oracle are keyed by the terrain version, so the
+  // terrain only changes through methods that call OnTerrainChanged().
+  const MapSlot &operator()(const Loc& loc) const { return (*_map)[loc]; }
 
   int GetXSize() const { return _m; }
   int GetYSize() const { return _n; }
   int GetPlaneSize() const { return _m * _n; }
+  int GetTerrainVersion() const { return _terrain_version; }
+
+  // The generators and Load() call it. Call it after changing the terrain in any other way.
+  void OnTerrainChanged();
+
+  // Admissible lower bound of the number of 4-neighbour steps from a to b.
+  float GetDistanceLowerBound(const Loc &a, const Loc &b) const { return _oracle->LowerBound(a, b); }
+  const DistanceOracle::Stats &GetDistanceOracleStats() const { return _oracle->GetStats(); }
 
 bool CanBuildTower(const PointF &p, UnitId id_exclude) const {
     Coord c = p.ToCoord();
     if (! IsIn(c)) return false;
 
     Loc loc = GetLoc(c);
-    const MapSlot &s = _map[loc];
+    const MapSlot &s = (*_map)[loc];
     // cannot block the path
     if (s.type == NORMAL) return false;
 
     // [TODO] Add object radius here.
-    return _locality.IsEmpty(p, kUnitRadius, id_exclude);
+    return _locality->IsEmpty(p, kUnitRadius, id_exclude);
 }
 
   bool CanPass(const PointF &p, UnitId id_exclude, bool check_locality = true) const {
@@ -98,12 +119,12 @@ bool CanBuildTower(const PointF &p, UnitId id_exclude) const {
       if (! IsIn(c)) return false;
 
       Loc loc = GetLoc(c);
-      const MapSlot &s = _map[loc];
+      const MapSlot &s = (*_map)[loc];
       if (s.type == IMPASSABLE) return false;
 
       // [TODO] Add object radius here.
       if (check_locality)
-        return _locality.IsEmpty(p, kUnitRadius, id_exclude);
+        return _locality->IsEmpty(p, kUnitRadius, id_exclude);
       else
         return true;
   }
@@ -112,21 +133,20 @@ bool CanBuildTower(const PointF &p, UnitId id_exclude) const {
       if (! IsIn(c)) return false;
 
       Loc loc = GetLoc(c);
-      const MapSlot &s = _map[loc];
+      const MapSlot &s = (*_map)[loc];
       if (s.type == IMPASSABLE) return false;
 
       // [TODO] Add object radius here.
       if (check_locality)
-        return _locality.IsEmpty(PointF(c.x, c.y), kUnitRadius, id_exclude);
+        return _locality->IsEmpty(PointF(c.x, c.y), kUnitRadius, id_exclude);
       else
         return true;
   }
 
-  bool IsLinePassable(const PointF &s, const PointF &t) const {
-      LineResult result;
-      UnitId block_id = INVALID;
-      return _locality.LinePassable(s, t, kUnitRadius, 1e-4, &block_id, &result);
-  }
+  // Whether a unit can walk from s to t by a straight line: no cell the segment crosses is
+  // impassable (the cells of s and t are not checked), and no unit other than id_exclude is
+  // in the way of a kUnitRadius wide capsule between the cells of s and t.
+  bool IsLinePassable(const PointF &s, const PointF &t, UnitId id_exclude = INVALID) const;
 
   // Move a unit to next_loc;
   bool MoveUnit(const UnitId &id, const PointF& new_loc);
@@ -142,6 +162,38 @@ bool CanBuildTower(const PointF &p, UnitId id_exclude) const {
   // Get sight from the current location.
   vector<Loc> GetSight(const Loc& loc, int range) const;
 
+  // Call f(loc) on each cell of GetSight(loc, range), without building the vector.
+  template <typename Func>
+  void ForEachInSight(const Loc& loc, int range, Func f) const {
+      Coord c = GetCoord(loc);
+      const int xmin = std::max(0, c.x - range);
+      const int xmax = std::min(_m - 1, c.x + range);
+
+      for (int x = xmin; x <= xmax; ++x) {
+          const int yrange = range - std::abs(c.x  - x);
+          const int ymin = std::max(0, c.y - yrange);
+          const int ymax = std::min(_n - 1, c.y + yrange);
+          for (int y = ymin; y <= ymax; ++y) {
+              f(GetLoc(x, y));
+          }
+      }
+  }
+
+  // Same cells, as one run f(lo, hi) of consecutive locs [lo, hi] per row.
+  template <typename Func>
+  void ForEachSightRow(const Loc& loc, int range, Func f) const {
+      Coord c = GetCoord(loc);
+      const int ymin = std::max(0, c.y - range);
+      const int ymax = std::min(_n - 1, c.y + range);
+
+      for (int y = ymin; y <= ymax; ++y) {
+          const int xrange = range - std::abs(c.y - y);
+          const int xmin = std::max(0, c.x - xrange);
+          const int xmax = std::min(_m - 1, c.x + xrange);
+          f(GetLoc(xmin, y), GetLoc(xmax, y));
+      }
+  }
+
   bool IsIn(Loc loc) const { return loc >= 0 && loc < _m * _n * _level; }
   bool IsIn(int x, int y) const { return x >= 0 && x < _m && y >= 0 && y < _n; }
   bool IsIn(const Coord &c, int margin = 0) const { return c.x >= margin && c.x < _m - margin && c.y >= margin && c.y < _n - margin && c.z >= 0 && c.z < _level; }
@@ -153,12 +205,23 @@ bool CanBuildTower(const PointF &p, UnitId id_exclude) const {
   UnitId GetClosestUnitId(const PointF& p, float max_r = 1e38) const;
   set<UnitId> GetUnitIdInRegion(const PointF &left_top, const PointF &right_bottom) const;
 
+  // Units accepted by filter (all units if it is empty), closest to p first.
+  // Distances are between unit centers, and ties are broken by id.
+  using UnitIdFilter = std::function<bool (const UnitId &)>;
+  vector<UnitId> KNearest(const PointF &p, int k, const UnitIdFilter &filter, float max_r = 1e38) const;
+  vector<UnitId> WithinRadius(const PointF &p, float r, const UnitIdFilter &filter) const;
+
   // Draw the map
   string Draw() const;
 
   string PrintDebugInfo() const;
 
-  SERIALIZER(RTSMap, _m, _n, _level, _map, _infos, _locality);
+  // Same layout as SERIALIZER(RTSMap, _m, _n, _level, _map, _infos, _locality). Load() reuses the
+  // slots, and calls OnTerrainChanged() only if the loaded terrain differs from the current one.
+  serializer::saver &Save(serializer::saver &oo) const;
+  serializer::loader &Load(serializer::loader &ii);
+  friend serializer::saver &operator<<(serializer::saver &oo, const RTSMap &m) { return m.Save(oo); }
+  friend serializer::loader &operator>>(serializer::loader &ii, RTSMap &m) { return m.Load(ii); }
 };
 
 #endif
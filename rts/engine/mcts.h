@@ -0,0 +1,228 @@
+/**
+* Copyright (c) 2017-present, Facebook, Inc.
+* All rights reserved.
+*
+* This source code is licensed under the BSD-style license found in the
+* LICENSE file in the root directory of this source tree. An additional grant
+* of patent rights can be found in the PATENTS file in the same directory.
+*/
+
+#ifndef _MCTS_H_
+#define _MCTS_H_
+
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "../elf/ctpl_stl.h"
+
+struct MCTSOptions {
+    // Search threads, and playouts run by each of them per search.
+    int num_threads = 1;
+    int playouts_per_thread = 100;
+
+    // Exploration constant of PUCT.
+    float c_puct = 1.0;
+
+    // Value counted for an edge taken by a playout which has not backed up yet (a loss is -1).
+    float virtual_loss = -1.0;
+};
+
+// Tree-parallel Monte Carlo tree search (PUCT) over the states of one searching player, who
+// picks one of num_actions actions at every node. Values are in [-1, 1], for the searching player.
+//
+// All threads walk the same tree. A playout adds a virtual loss to each edge it takes until it
+// backs up its value, so the other playouts spread over other branches meanwhile. The first playout
+// to take an edge expands it: it makes the child state with Transition, evaluates it with Evaluate,
+// and playouts reaching the child before that is done wait for it. States are never changed once
+// made, so Transition and Evaluate may read any state on any thread (e.g. to fork it).
+template <typename State>
+class MCTS {
+public:
+    struct Evaluation {
+        float value = 0.0;
+        // Prior of each action from the state. Empty for uniform priors.
+        std::vector<float> priors;
+        // No actions from a terminal state, a playout reaching it just backs up its value.
+        bool terminal = false;
+    };
+
+    // Both are called on the search threads, thread_id is in [0, num_threads). Evaluate is also
+    // called with thread_id 0 on the thread which calls Search, for the root.
+    using Transition = std::function<void (int thread_id, const State &s, int action, State *next)>;
+    using Evaluate = std::function<Evaluation (int thread_id, const State &s)>;
+
+    struct Result {
+        int best_action = 0;
+        // Per action of the root.
+        std::vector<int> visits;
+        std::vector<float> values;
+        int playouts = 0;
+        double usec = 0.0;
+    };
+
+    MCTS(const MCTSOptions &options, int num_actions, Transition transition, Evaluate evaluate)
+        : _options(options), _num_actions(num_actions), _transition(transition), _evaluate(evaluate),
+          _pool(options.num_threads) {
+    }
+
+    const MCTSOptions &GetOptions() const { return _options; }
+
+    // Search from root, the most visited action is the best one.
+    Result Search(State root) {
+        auto start = std::chrono::steady_clock::now();
+        Node node;
+        node.state = std::move(root);
+        set_evaluation(&node, _evaluate(0, node.state));
+
+        Result result;
+        if (! node.terminal) {
+            std::vector<std::future<int>> playouts;
+            for (int i = 0; i < _options.num_threads; ++i) {
+                playouts.push_back(_pool.push([this, &node](int thread_id) {
+                    for (int j = 0; j < _options.playouts_per_thread; ++j) playout(thread_id, &node);
+                    return _options.playouts_per_thread;
+                }));
+            }
+            // Wait for all threads before get() may throw, they use node.
+            for (auto &f : playouts) f.wait();
+            for (auto &f : playouts) result.playouts += f.get();
+        }
+
+        result.visits.resize(_num_actions, 0);
+        result.values.resize(_num_actions, 0.0);
+        for (int a = 0; a < (int)node.edges.size(); ++a) {
+            const Edge &e = node.edges[a];
+            result.visits[a] = e.n;
+            result.values[a] = e.n > 0 ? e.w / e.n : 0.0;
+            if (e.n > result.visits[result.best_action]) result.best_action = a;
+        }
+        result.usec = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+        return result;
+    }
+
+private:
+    struct Node;
+
+    struct Edge {
+        float prior = 0.0;
+        int n = 0;
+        float w = 0.0;
+        int virtual_n = 0;
+        std::unique_ptr<Node> child;
+    };
+
+    struct Node {
+        std::mutex mutex;
+        std::condition_variable cond;
+        bool ready = false;
+
+        State state;
+        bool terminal = false;
+        float value = 0.0;
+        int n = 0;
+        std::vector<Edge> edges;
+    };
+
+    MCTSOptions _options;
+    int _num_actions;
+    Transition _transition;
+    Evaluate _evaluate;
+    ctpl::thread_pool _pool;
+
+    void set_evaluation(Node *node, const Evaluation &eval) {
+        node->value = eval.value;
+        node->terminal = eval.terminal;
+        node->ready = true;
+        if (eval.terminal) return;
+
+        const bool uniform = (int)eval.priors.size() < _num_actions;
+        float sum = 0.0;
+        if (! uniform) {
+            for (int a = 0; a < _num_actions; ++a) sum += eval.priors[a];
+        }
+        node->edges.resize(_num_actions);
+        for (int a = 0; a < _num_actions; ++a) {
+            node->edges[a].prior = uniform || sum <= 0.0 ? 1.0 / _num_actions : eval.priors[a] / sum;
+        }
+    }
+
+    // PUCT, with virtual losses counted as visits of value _options.virtual_loss.
+    // Unvisited edges take the value of their parent.
+    int select(const Node &node) const {
+        const float sqrt_n = std::sqrt((float)node.n + 1);
+        int best = 0;
+        float best_score = 0.0;
+        for (int a = 0; a < (int)node.edges.size(); ++a) {
+            const Edge &e = node.edges[a];
+            const int n = e.n + e.virtual_n;
+            const float q = n > 0 ? (e.w + e.virtual_n * _options.virtual_loss) / n : node.value;
+            const float score = q + _options.c_puct * e.prior * sqrt_n / (1 + n);
+            if (a == 0 || score > best_score) {
+                best = a;
+                best_score = score;
+            }
+        }
+        return best;
+    }
+
+    void expand(int thread_id, const Node &parent, int action, Node *child) {
+        Evaluation eval;
+        try {
+            _transition(thread_id, parent.state, action, &child->state);
+            eval = _evaluate(thread_id, child->state);
+        } catch (...) {
+            // Do not leave other threads waiting for the child.
+            std::lock_guard<std::mutex> lock(child->mutex);
+            child->ready = child->terminal = true;
+            child->cond.notify_all();
+            throw;
+        }
+        std::lock_guard<std::mutex> lock(child->mutex);
+        set_evaluation(child, eval);
+        child->cond.notify_all();
+    }
+
+    void playout(int thread_id, Node *root) {
+        std::vector<std::pair<Node *, int>> path;
+        Node *node = root;
+        float value = 0.0;
+        while (true) {
+            std::unique_lock<std::mutex> lock(node->mutex);
+            node->cond.wait(lock, [node]() { return node->ready; });
+            if (node->terminal) {
+                value = node->value;
+                break;
+            }
+            const int a = select(*node);
+            Edge &e = node->edges[a];
+            e.virtual_n ++;
+            node->n ++;
+            path.emplace_back(node, a);
+            if (e.child == nullptr) {
+                e.child.reset(new Node());
+                Node *child = e.child.get();
+                lock.unlock();
+                // The parent state is not changed once ready, so it is read without the lock.
+                expand(thread_id, *node, a, child);
+                value = child->value;
+                break;
+            }
+            node = e.child.get();
+        }
+
+        for (const auto &p : path) {
+            std::lock_guard<std::mutex> lock(p.first->mutex);
+            Edge &e = p.first->edges[p.second];
+            e.virtual_n --;
+            e.n ++;
+            e.w += value;
+        }
+    }
+};
+
+#endif
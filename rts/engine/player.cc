@@ -9,6 +9,8 @@
 
 #include "player.h"
 #include "unit.h"
+#include <algorithm>
+#include <stdexcept>
 
 template <typename T>
 static bool GetValue(const map< pair<Loc, Loc>, T > &m, const Loc &p1, const Loc &p2, T *value) {
@@ -40,7 +42,7 @@ string Player::Draw() const {
         for (int x = 0; x < _map->GetXSize(); ++x) {
             // Draw the map (only level 0)
             Loc loc = _map->GetLoc(x, y, 0);
-            if ( _fogs[loc].CanSeeTerrain() ) {
+            if ( _visible.Get(loc) ) {
                 ss << (*_map)(loc).type << " ";
             } else {
                 ss << "# ";
@@ -51,32 +53,104 @@ string Player::Draw() const {
     return ss.str();
 }
 
+void Player::update_sight(const Sight &s, int delta) {
+    _map->ForEachInSight(s.loc, s.r, [&](Loc loc) {
+        uint16_t &count = _sight_counts[loc];
+        if (delta > 0) {
+            if (count ++ == 0) _visible.Set(loc);
+        } else {
+            if (-- count == 0) _visible.Unset(loc);
+        }
+    });
+}
+
 void Player::ComputeFOW(const Units &units) {
     // Compute the player's fog of war.
-    // Two approaches, loop on the map (or in the future, viewport [TODO]),
-    // or loop on the units.
-    // [TODO]: We could do better with LocalitySearch.
-    // Clear fogs.
-    for (Fog &f : _fogs) {
-        f.Reset();
+    // Only units that changed cell (or sight range), spawned or died since the last call
+    // are touched (FOW_SIGHT_COUNTS), or trigger a redraw of all sights (FOW_STENCIL).
+    const bool counts = (_fow_mode == FOW_SIGHT_COUNTS);
+    bool changed = false;
+    if (_rebuild_fow) {
+        // First call, or the map was reset/loaded.
+        _visible.Resize(_map->GetPlaneSize());
+        if (counts) _sight_counts.assign(_visible.size(), 0);
+        else _sight_counts = vector<uint16_t>();
+        _sights.clear();
+        _rebuild_fow = false;
+        changed = true;
     }
-    for (auto it = units.begin(); it != units.end(); ++it) {
-        const Unit *u = it->second.get();
-        if (ExtractPlayerId(u->GetId()) == _player_id) {
-            const int vis_r = u->GetProperty()._vis_r;
-            Loc l = _map->GetLoc(u->GetPointF());
-            for (const Loc &loc : _map->GetSight(l, vis_r)) {
-                _fogs[loc].SetClear();
+
+    // Our units are contiguous in units, since the player id is in the top bits of UnitId.
+    // Walk them together with _sights (both sorted by id).
+    _sights_next.clear();
+    auto prev = _sights.begin();
+    for (int i = units.LowerBound(CombinePlayerId(0, _player_id)); i < units.size(); ++i) {
+        if (units.GetPlayerId(i) != _player_id) break;
+        const Unit &u = units.At(i);
+        const Sight s{ units.GetId(i), _map->GetLoc(u.GetPointF()), u.GetProperty()._vis_r };
+
+        // Units that are gone.
+        for (; prev != _sights.end() && prev->id < s.id; ++prev) {
+            if (counts) update_sight(*prev, -1);
+            changed = true;
+        }
+
+        if (prev != _sights.end() && prev->id == s.id) {
+            if (prev->loc != s.loc || prev->r != s.r) {
+                if (counts) {
+                    update_sight(*prev, -1);
+                    update_sight(s, 1);
+                }
+                changed = true;
             }
+            ++ prev;
+        } else {
+            if (counts) update_sight(s, 1);
+            changed = true;
+        }
+        _sights_next.push_back(s);
+    }
+    for (; prev != _sights.end(); ++prev) {
+        if (counts) update_sight(*prev, -1);
+        changed = true;
+    }
+
+    _sights.swap(_sights_next);
+
+    if (! counts && changed) {
+        _visible.Clear();
+        for (const Sight &s : _sights) {
+            _map->ForEachSightRow(s.loc, s.r, [&](Loc lo, Loc hi) { _visible.SetRange(lo, hi); });
         }
     }
 }
 
+void Player::CheckFOW(const Units &units) const {
+    FogMask expected;
+    expected.Resize(_map->GetPlaneSize());
+    for (const Unit &u : units) {
+        if (ExtractPlayerId(u.GetId()) == _player_id) {
+            Loc l = _map->GetLoc(u.GetPointF());
+            _map->ForEachInSight(l, u.GetProperty()._vis_r, [&](Loc loc) { expected.Set(loc); });
+        }
+    }
+    if (expected == _visible) return;
+
+    for (int i = 0; i < expected.size() && i < _visible.size(); ++i) {
+        if (expected.Get(i) != _visible.Get(i)) {
+            throw std::range_error("Incremental FOW of player " + std::to_string(_player_id)
+                    + " differs from the full recompute at " + _map->PrintCoord(i));
+        }
+    }
+    throw std::range_error("Incremental FOW of player " + std::to_string(_player_id)
+            + " has " + std::to_string(_visible.size()) + " cells, expected " + std::to_string(expected.size()));
+}
+
 bool Player::FilterWithFOW(const Unit& u) const {
     if (! _map->IsIn(u.GetPointF())) return false;
     // [TODO]: Could we do better?
     Loc l = _map->GetLoc(u.GetPointF());
-    return _fogs[l].CanSeeUnit();
+    return _visible.Get(l);
 }
 
 string Player::PrintInfo() const {
@@ -84,17 +158,17 @@ string Player::PrintInfo() const {
     ss << "Map ptr = " << _map << endl;
     ss << "Player id = " << _player_id << endl;
     ss << "Resource = " << _resource << endl;
-    ss << "Fog[" << _fogs.size() << "] = ";
-    for (size_t i = 0; i < _fogs.size(); ++i) ss << _fogs[i]._fog << " ";
+    ss << "Fog[" << _visible.size() << "] = ";
+    for (int i = 0; i < _visible.size(); ++i) ss << (_visible.Get(i) ? 0 : 100) << " ";
     ss << endl;
 
     return ss.str();
 }
 
 void Player::update_heuristic(const Loc &p1, const Loc &p2, float value) const {
-    float min_value = get_line_dist(p1, p2);
+    float min_value = get_dist_lower_bound(p1, p2);
     if (value < min_value) value = min_value;
-    UpdateValue(p1, p2, value, &_heuristics);
+    UpdateValue(p1, p2, value, &_heuristics.Mutable());
 }
 
 float Player::get_line_dist(const Loc &p1, const Loc &p2) const {
@@ -105,57 +179,112 @@ float Player::get_line_dist(const Loc &p1, const Loc &p2) const {
     return sqrt(static_cast<float>(dx * dx + dy * dy));
 }
 
+float Player::get_dist_lower_bound(const Loc &p1, const Loc &p2) const {
+    return std::max(get_line_dist(p1, p2), _map->GetDistanceLowerBound(p1, p2));
+}
+
 float Player::get_path_dist_heuristic(const Loc &p1, const Loc &p2) const {
     float dist;
-    if (! GetValue(_heuristics, p1, p2, &dist)) {
-        dist = get_line_dist(p1, p2);
+    if (! GetValue(*_heuristics, p1, p2, &dist)) {
+        dist = get_dist_lower_bound(p1, p2);
     }
     return dist;
 }
 
 bool Player::line_passable(UnitId id, const PointF &s, const PointF &t) const {
-    const RTSMap &m = *_map;
+    return _map->IsLinePassable(s, t, id);
+}
 
-    float dist = sqrt(PointF::L2Sqr(s, t));
-    const int n = static_cast<int>(dist * 10 + 0.5);
+static const float kUnreachable = 1e38;
 
-    PointF v;
-    PointF::Diff(t, s, &v);
-    v /= dist;
+const Player::FlowField &Player::get_flow_field(Tick tick, const Loc &lt) const {
+    static const size_t kMaxFlowFields = 64;
+    const RTSMap &m = *_map;
 
-    Loc ls = m.GetLoc(s);
-    Loc lt = m.GetLoc(t);
+    auto it = _flow_fields.find(lt);
+    if (it == _flow_fields.end()) {
+        if (_flow_fields.size() >= kMaxFlowFields) {
+            // Drop the least recently used one.
+            auto oldest = _flow_fields.begin();
+            for (auto it2 = _flow_fields.begin(); it2 != _flow_fields.end(); ++it2) {
+                if (it2->second.last_used < oldest->second.last_used) oldest = it2;
+            }
+            _flow_fields.erase(oldest);
+        }
+        it = _flow_fields.emplace(lt, FlowField()).first;
+    }
 
-    const float step = dist / n;
+    FlowField &field = it->second;
+    field.last_used = tick;
+    if (field.terrain_version == m.GetTerrainVersion()) return field;
 
-    Loc last_lx = INVALID;
+    // BFS from the target over passable terrain. The target itself may be impassable.
+    const int dx[] = { 1, 0, -1, 0 };
+    const int dy[] = { 0, 1, 0, -1 };
 
-    for (int i = 1; i < n; ++i) {
-        // Check discrete points {1 / n, ..., (n - 1) / n}
-        PointF x(s.x + v.x * step * i, s.y + v.y * step * i);
-        // cout << "LinePassable[" << id << "]: Checking " << x << ". (s, t) = (" << s << ", " << t << ")" << endl;
-        Coord cx = x.ToCoord();
-        Loc lx = m.GetLoc(cx);
-        if (lx == last_lx) continue;
-        last_lx = lx;
+    vector<float> dist(m.GetPlaneSize(), kUnreachable);
+    dist[lt] = 0;
 
-        if (lx != ls && lx != lt) {
-            if (! m.CanPass(x, id)) {
-                // cout << "(" << s << ") -> (" << t << ") line not passable due to (" << x << ")" << endl;
-                return false;
-            }
+    vector<Loc> q(1, lt);
+    for (size_t i = 0; i < q.size(); ++i) {
+        const Coord c = m.GetCoord(q[i]);
+        const float d = dist[q[i]] + 1;
+        for (size_t j = 0; j < sizeof(dx) / sizeof(int); ++j) {
+            Coord next(c.x + dx[j], c.y + dy[j]);
+            if (! m.CanPass(next, INVALID, false)) continue;
+            Loc l_next = m.GetLoc(next);
+            if (dist[l_next] != kUnreachable) continue;
+            dist[l_next] = d;
+            q.push_back(l_next);
         }
     }
-
-    // cout << "(" << s << ") -> (" << t << ") line passable!" << endl;
-    return true;
+    // A new vector, as copies of the player may share the old one.
+    field.terrain_version = m.GetTerrainVersion();
+    field.dist = std::make_shared<vector<float>>(std::move(dist));
+    return field;
 }
 
-/*
-bool Player::line_passable(UnitId id, const PointF &s, const PointF &t) const {
-    return _map->IsLinePassable(s, t);
+bool Player::flow_field_waypoint(Tick tick, UnitId id, const PointF &s, const Loc &lt, Loc *waypoint, float *dist) const {
+    const RTSMap &m = *_map;
+    const vector<float> &field_dist = *get_flow_field(tick, lt).dist;
+
+    Loc l = m.GetLoc(s.ToCoord());
+    if (field_dist[l] == kUnreachable) return false;
+    *dist = field_dist[l];
+
+    const int dx[] = { 1, 0, -1, 0 };
+    const int dy[] = { 0, 1, 0, -1 };
+
+    // Walk down the field. Among equally good steps, take the one closer to lt by a straight
+    // line, so that paths in open areas stay close to the diagonal. Like A*, cells close to s
+    // also have to be free of units.
+    vector<Loc> path(1, l);
+    while (l != lt) {
+        const Coord c = m.GetCoord(l);
+        Loc best = l;
+        for (size_t j = 0; j < sizeof(dx) / sizeof(int); ++j) {
+            Coord next(c.x + dx[j], c.y + dy[j]);
+            if (! m.IsIn(next)) continue;
+            Loc l_next = m.GetLoc(next);
+            if (field_dist[l_next] > field_dist[best]) continue;
+            if (field_dist[l_next] == field_dist[best] && (best == l || get_line_dist(l_next, lt) >= get_line_dist(best, lt))) continue;
+            best = l_next;
+        }
+        l = best;
+        if (l != lt && GetDistanceSquared(s, m.GetCoord(l)) < 4 && ! m.CanPass(m.GetCoord(l), id)) return false;
+        path.push_back(l);
+    }
+
+    // The farthest cell on the path reachable by a straight line.
+    for (size_t i = path.size() - 1; i >= 1; --i) {
+        Coord c = m.GetCoord(path[i]);
+        if (line_passable(id, s, PointF(c.x, c.y))) {
+            *waypoint = path[i];
+            return true;
+        }
+    }
+    return false;
 }
-*/
 
 bool Player::PathPlanning(Tick tick, UnitId id, const PointF &s, const PointF &t, int max_iteration, bool verbose, Coord *first_block, float *dist) const {
     const RTSMap &m = *_map;
@@ -175,8 +304,8 @@ bool Player::PathPlanning(Tick tick, UnitId id, const PointF &s, const PointF &t
     *dist = 1e38;
 
     // Check cache. If the recomputation is fresh, just use it.
-    auto it_cache = _cache.find(make_pair(ls, lt));
-    if (it_cache != _cache.end()) {
+    auto it_cache = _cache->find(make_pair(ls, lt));
+    if (it_cache != _cache->end()) {
         if (tick - it_cache->second.first < 10) {
             Loc loc = it_cache->second.second;
             if (verbose) cout << "Cache hit! Tick: " << tick << " cache timestamp: " << it_cache->second.first << " Loc: " << loc << endl;
@@ -186,16 +315,76 @@ bool Player::PathPlanning(Tick tick, UnitId id, const PointF &s, const PointF &t
             return true;
         } else {
             if (verbose) cout << "Cache out of date! Tick: " << tick << " cache timestamp: " << it_cache->second.first << endl;
-            _cache.erase(it_cache);
+            _cache.Mutable().erase(make_pair(ls, lt));
         }
     }
 
     // Check if the two points are passable by a straight line. (Most common case).
     if (line_passable(id, s, t)) {
-        _cache[make_pair(ls, lt)] = make_pair(tick, INVALID);
+        _cache.Mutable()[make_pair(ls, lt)] = make_pair(tick, INVALID);
+        return true;
+    }
+
+    // Units heading to the same target share its flow field.
+    Loc waypoint;
+    if (m.IsIn(cs) && m.IsIn(ct) && flow_field_waypoint(tick, id, s, lt, &waypoint, dist)) {
+        if (verbose) cout << "Flow field waypoint: " << m.PrintCoord(waypoint) << " dist: " << *dist << endl;
+        *first_block = m.GetCoord(waypoint);
+        _cache.Mutable()[make_pair(ls, lt)] = make_pair(tick, waypoint);
         return true;
     }
 
+    // Otherwise units nearby are in the way, use A* to go around them.
+    return path_planning_astar(tick, id, s, ls, lt, max_iteration, verbose, first_block, dist);
+}
+
+// Flat arrays indexed by loc, reused across searches. A cell's entries are only valid if its
+// stamp equals the current generation, so starting a search costs nothing. The last two slots
+// stand for a target and a start outside the map.
+struct Player::AStarScratch {
+    int plane_size = -1;
+    uint32_t generation = 0;
+    // seen: pushed into the open list. on_path: on the final trajectory.
+    vector<uint32_t> seen, on_path;
+    vector<float> g;
+    vector<Loc> parent;
+    vector<Item> heap;
+    vector<Loc> popped, traj;
+
+    void Start(int size) {
+        if (size != plane_size) {
+            plane_size = size;
+            seen.assign(size + 2, 0);
+            on_path.assign(size + 2, 0);
+            g.resize(size + 2);
+            parent.resize(size + 2);
+            generation = 0;
+        }
+        if (++ generation == 0) {
+            std::fill(seen.begin(), seen.end(), 0);
+            std::fill(on_path.begin(), on_path.end(), 0);
+            generation = 1;
+        }
+        heap.clear();
+        popped.clear();
+        traj.clear();
+    }
+
+    int Slot(const Loc &l, const Loc &lt) const {
+        if (l >= 0 && l < plane_size) return l;
+        return l == lt ? plane_size : plane_size + 1;
+    }
+};
+
+Player::AStarScratch &Player::get_astar_scratch(const RTSMap &m) {
+    static thread_local AStarScratch scratch;
+    scratch.Start(m.GetPlaneSize());
+    return scratch;
+}
+
+bool Player::path_planning_astar(Tick tick, UnitId id, const PointF &s, const Loc &ls, const Loc &lt, int max_iteration, bool verbose, Coord *first_block, float *dist) const {
+    const RTSMap &m = *_map;
+
     // 8 neighbors.
     // const int dx[] = { 1, 0, -1, 0, 1, 1, -1, -1 };
     // const int dy[] = { 0, 1, 0, -1, 1, -1, 1, -1 };
@@ -205,17 +394,21 @@ bool Player::PathPlanning(Tick tick, UnitId id, const PointF &s, const PointF &t
     const int dy[] = { 0, 1, 0, -1 };
     const float dists[] = { 1.0, 1.0, 1.0, 1.0 };
 
-    // All "from" information.
-    // Loc -> Loc_from, dist_so_far.
-    map<Loc, pair<Loc, float> > c_from;
-    vector<Loc> c_popped;
+    // All "from" information lives in the scratch: parent and dist_so_far of every pushed loc.
+    AStarScratch &sc = get_astar_scratch(m);
+    const uint32_t gen = sc.generation;
 
-    // If s and t is not passable by a straight line.
-    priority_queue<Item> q;
+    auto push = [&](float g, float h, const Loc &l, const Loc &l_from) {
+        const int slot = sc.Slot(l, lt);
+        sc.seen[slot] = gen;
+        sc.g[slot] = g;
+        sc.parent[slot] = l_from;
+        sc.heap.emplace_back(g, h, l);
+        std::push_heap(sc.heap.begin(), sc.heap.end());
+    };
 
     float h0 = get_path_dist_heuristic(ls, lt);
-    q.emplace(Item(0.0, h0, ls, INVALID));
-    c_from.emplace(make_pair(ls, make_pair(INVALID, 0.0)));
+    push(0.0, h0, ls, INVALID);
 
     if (verbose) {
         cout << "Initial h0 = " << h0 << endl;
@@ -225,14 +418,14 @@ bool Player::PathPlanning(Tick tick, UnitId id, const PointF &s, const PointF &t
     Loc l = INVALID;
     bool found = false;
 
-    while (!q.empty()) {
-        Item v = q.top();
+    while (! sc.heap.empty()) {
+        std::pop_heap(sc.heap.begin(), sc.heap.end());
+        Item v = sc.heap.back();
+        sc.heap.pop_back();
         // cout << "Poped: " << v.PrintInfo(m) << endl;
 
-        // Save the current node to "from" information.
-        // Only the first occurrence matters (since given the same state, smallest g will come first).
-        c_popped.push_back(v.loc);
-        q.pop();
+        // Each loc is pushed once, with the smallest g known at the time.
+        sc.popped.push_back(v.loc);
 
         // Find the target, stop.
         if (v.loc == lt || iter == max_iteration) {
@@ -251,8 +444,11 @@ bool Player::PathPlanning(Tick tick, UnitId id, const PointF &s, const PointF &t
             Coord next(c_curr.x + dx[i], c_curr.y + dy[i]);
             Loc l_next = m.GetLoc(next);
 
+            // Outside the map only the target itself may be reached.
+            if (l_next != lt && ! m.IsIn(next)) continue;
+
             // If we already push that before, skip.
-            if (c_from.find(l_next) != c_from.end()) continue;
+            if (sc.seen[sc.Slot(l_next, lt)] == gen) continue;
 
             // if we met with impassable location and has not reached the target (lt), skip.
             if (l_next != lt) {
@@ -267,8 +463,7 @@ bool Player::PathPlanning(Tick tick, UnitId id, const PointF &s, const PointF &t
                 cout << "push: l_next = " << l_next << ", next_dist = " << next_dist << ", h = " << h << ", parent_loc = " << v.loc << endl;
             }
 
-            q.emplace(Item(next_dist, h, l_next, v.loc));
-            c_from.emplace(make_pair(l_next, make_pair(v.loc, next_dist)));
+            push(next_dist, h, l_next, v.loc);
         }
         iter ++;
     }
@@ -283,37 +478,24 @@ bool Player::PathPlanning(Tick tick, UnitId id, const PointF &s, const PointF &t
     }
 
     // Then do a backtrace to get the path.
-    vector<Loc> traj;
     // traj[0] is the last part of the trajectory, depending on max_iteration,
     // it might end in the target location, or reach some intermediate location, which is the most promising.
     // traj[-1] is the starting point.
+    vector<Loc> &traj = sc.traj;
     while (l != INVALID) {
-        // cout << "Loc: " << m.GetCoord(l) << endl;
-        auto it = c_from.find(l);
-        if (it == c_from.end()) {
-            cout << "Path-finding error!" << endl;
-            return false;
-        }
-
+        const int slot = sc.Slot(l, lt);
         traj.push_back(l);
-        update_heuristic(l, lt, *dist - it->second.second);
-        l = it->second.first;
-    }
-
-    // Delete trajectory from the map.
-    // cout << " Traj: ";
-    for (const Loc &l : traj) {
-        // cout << "(" << m.GetCoord(l) << ") ";
-        c_from.erase(l);
+        sc.on_path[slot] = gen;
+        update_heuristic(l, lt, *dist - sc.g[slot]);
+        l = sc.parent[slot];
     }
-    // cout << endl;
 
     // For all visited node other than the true solution,
     // their heuristic will be set to be opt + eps - g
-    for (Loc l : c_popped) {
-        auto it = c_from.find(l);
-        if (it != c_from.end()) {
-            update_heuristic(l, lt, (*dist + 1e-5f) - it->second.second);
+    for (Loc l : sc.popped) {
+        const int slot = sc.Slot(l, lt);
+        if (sc.on_path[slot] != gen) {
+            update_heuristic(l, lt, (*dist + 1e-5f) - sc.g[slot]);
         }
     }
 
@@ -323,12 +505,12 @@ bool Player::PathPlanning(Tick tick, UnitId id, const PointF &s, const PointF &t
         Coord waypoint = m.GetCoord(traj[i]);
         if (line_passable(id, s, PointF(waypoint.x, waypoint.y))) {
             *first_block = waypoint;
-            _cache[make_pair(ls, lt)] = make_pair(tick, traj[i]);
+            _cache.Mutable()[make_pair(ls, lt)] = make_pair(tick, traj[i]);
             return true;
         }
     }
     // cout << "PathPlanning. No valid path, leave to local planning" << endl;
-    _cache[make_pair(ls, lt)] = make_pair(tick, INVALID);
+    _cache.Mutable()[make_pair(ls, lt)] = make_pair(tick, INVALID);
 
     return false;
 }
@@ -336,12 +518,12 @@ bool Player::PathPlanning(Tick tick, UnitId id, const PointF &s, const PointF &t
 string Player::PrintHeuristicsCache() const {
     stringstream ss;
     ss << "Heuristics: " << endl;
-    for (auto it = _heuristics.begin(); it != _heuristics.end(); ++it) {
+    for (auto it = _heuristics->begin(); it != _heuristics->end(); ++it) {
         ss << "[" << it->first.first << ", " << it->first.second << "]: " << it->second << endl;
     }
 
     ss << "Cache: " << endl;
-    for (auto it = _cache.begin(); it != _cache.end(); ++it) {
+    for (auto it = _cache->begin(); it != _cache->end(); ++it) {
         ss << "[" << it->first.first << ", " << it->first.second << "]: T " << it->second.first << ": " << it->second.second << endl;
     }
     return ss.str();
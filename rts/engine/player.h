@@ -16,6 +16,7 @@
 #include <queue>
 
 class Unit;
+class Units;
 
 struct Fog {
     // Fog level: 0 no fog, 100 completely invisible.
@@ -28,6 +29,75 @@ struct Fog {
     SERIALIZER(Fog, _fog);
 };
 
+// Visibility of one player, one bit per cell of the map plane. Bit loc is cell loc, so rows
+// are not padded, and each row of a sight diamond is a run of bits set a word at a time.
+class FogMask {
+private:
+    int _size = 0;
+    vector<uint64_t> _bits;
+
+    // Bits [lo, hi] of a word, 0 <= lo <= hi < 64.
+    static uint64_t word_mask(int lo, int hi) { return (~0ULL >> (63 - hi)) & (~0ULL << lo); }
+
+public:
+    int size() const { return _size; }
+    void Resize(int size) { _size = size; _bits.assign((size + 63) / 64, 0); }
+    void Clear() { std::fill(_bits.begin(), _bits.end(), 0); }
+
+    bool Get(Loc loc) const { return (_bits[loc >> 6] >> (loc & 63)) & 1; }
+    void Set(Loc loc) { _bits[loc >> 6] |= 1ULL << (loc & 63); }
+    void Unset(Loc loc) { _bits[loc >> 6] &= ~(1ULL << (loc & 63)); }
+
+    // Set cells [lo, hi].
+    void SetRange(Loc lo, Loc hi) {
+        const int wlo = lo >> 6, whi = hi >> 6;
+        if (wlo == whi) {
+            _bits[wlo] |= word_mask(lo & 63, hi & 63);
+            return;
+        }
+        _bits[wlo] |= word_mask(lo & 63, 63);
+        for (int w = wlo + 1; w < whi; ++w) _bits[w] = ~0ULL;
+        _bits[whi] |= word_mask(0, hi & 63);
+    }
+
+    // out[i] = visible ? value : 0 for cells [begin, begin + n).
+    template <typename T>
+    void Unpack(Loc begin, int n, T value, T *out) const {
+        for (int i = 0; i < n; ++i) {
+            const Loc loc = begin + i;
+            out[i] = value * static_cast<T>((_bits[loc >> 6] >> (loc & 63)) & 1);
+        }
+    }
+
+    friend bool operator==(const FogMask &m1, const FogMask &m2) { return m1._size == m2._size && m1._bits == m2._bits; }
+    friend bool operator!=(const FogMask &m1, const FogMask &m2) { return ! (m1 == m2); }
+
+    // Saved as the vector<Fog> it replaces, so old snapshots still load.
+    friend serializer::saver &operator<<(serializer::saver &oo, const FogMask &m) {
+        vector<Fog> fogs(m._size);
+        for (int i = 0; i < m._size; ++i) {
+            if (m.Get(i)) fogs[i].SetClear();
+        }
+        return oo << fogs;
+    }
+    friend serializer::loader &operator>>(serializer::loader &ii, FogMask &m) {
+        vector<Fog> fogs;
+        ii >> fogs;
+        m.Resize(fogs.size());
+        for (int i = 0; i < m._size; ++i) {
+            if (fogs[i].CanSeeUnit()) m.Set(i);
+        }
+        return ii;
+    }
+};
+
+// How Player::ComputeFOW keeps the FogMask up to date.
+// FOW_SIGHT_COUNTS: count per cell how many units see it, and only update cells around units
+//                   that changed (2 extra bytes per cell).
+// FOW_STENCIL:      when any unit changed, clear the mask and OR every unit's sight diamond
+//                   again a word at a time (no per-cell state, for large maps).
+custom_enum(FOWMode, FOW_SIGHT_COUNTS = 0, FOW_STENCIL);
+
 // PlayerPrivilege, Normal player only see within the Fog of War.
 // KnowAll Player knows everything and can attack objects outside its FOW.
 custom_enum(PlayerPrivilege, PV_NORMAL = 0, PV_KNOW_ALL);
@@ -46,47 +116,78 @@ private:
     // How many resources the player have.
     int _resource;
 
-    // Current fog of war. This containers have the same size as the map.
-    vector<Fog> _fogs;
+    // Current fog of war, one bit per cell of the map.
+    FogMask _visible;
+
+    // Fog of war is updated incrementally. _sights (sorted by id) records the sight each unit
+    // has applied, and in FOW_SIGHT_COUNTS mode _sight_counts[loc] is the number of our units
+    // that see loc. Neither is serialized; _rebuild_fow makes ComputeFOW start from scratch.
+    struct Sight {
+        UnitId id;
+        Loc loc;
+        int r;
+    };
+    FOWMode _fow_mode = FOW_SIGHT_COUNTS;
+    bool _rebuild_fow = true;
+    vector<uint16_t> _sight_counts;
+    vector<Sight> _sights, _sights_next;
 
     // Heuristic function for path-planning.
     // Loc x Loc -> min distance (in discrete space).
-    // If the key is not in _heuristics, then by default it is l2 distance.
-    mutable map< pair<Loc, Loc>, float > _heuristics;
+    // If the key is not in _heuristics, then by default it is get_dist_lower_bound().
+    // Copies of the player (see GameEnv::Fork()) share it until one of them writes it.
+    mutable CowPtr<map< pair<Loc, Loc>, float >> _heuristics;
 
     // Cache for path planning. If the cache is too old, it will recompute.
     // Loc == INVALID: cannot pass / passable by a straight line (In this case, we return first_block = -1.
-    mutable map< pair<Loc, Loc>, pair<Tick, Loc> > _cache;
+    mutable CowPtr<map< pair<Loc, Loc>, pair<Tick, Loc> >> _cache;
+
+    // Flow fields for path planning, keyed by target loc. (*dist)[loc] is the number of
+    // 4-neighbour steps from loc to the target over the terrain (units ignored), or
+    // kUnreachable. Shared by every unit heading to the same target, and rebuilt lazily
+    // once the terrain version changes. dist is never changed once built, so copies of the
+    // player share it. Not serialized.
+    struct FlowField {
+        int terrain_version = -1;
+        Tick last_used = 0;
+        std::shared_ptr<const vector<float>> dist;
+    };
+    mutable unordered_map<Loc, FlowField> _flow_fields;
 
 private:
+    // Open list entry of A*. Each loc is pushed at most once per search, so (cost, g, loc)
+    // orders the items totally and the search is deterministic whatever the heap layout.
     struct Item {
-        float g;
-        float h;
         float cost;
+        float g;
         Loc loc;
-        Loc loc_from;
-        Item(float g, float h, const Loc &loc, const Loc &loc_from)
-            : g(g), h(h), loc(loc), loc_from(loc_from) {
-            cost = g + h;
-        }
+        Item(float g, float h, const Loc &loc) : cost(g + h), g(g), loc(loc) { }
 
+        // Lowest cost first, then lowest g, then highest loc.
         friend bool operator<(const Item &m1, const Item &m2) {
-            if (m1.cost > m2.cost) return true; if (m1.cost < m2.cost) return false;
-            if (m1.g > m2.g) return true; if (m1.g < m2.g) return false;
-            if (m1.loc < m2.loc) return true; if (m1.loc > m2.loc) return false;
-            if (m1.loc_from < m2.loc_from) return true; if (m1.loc_from > m2.loc_from) return false;
-            return true;
+            if (m1.cost != m2.cost) return m1.cost > m2.cost;
+            if (m1.g != m2.g) return m1.g > m2.g;
+            return m1.loc < m2.loc;
         }
 
         string PrintInfo(const RTSMap &m) const {
             stringstream ss;
-            ss << "cost: " << cost << " loc: (" << m.GetCoord(loc) << ") g: " << g << " h: " << h << " from: (" << m.GetCoord(loc_from) << ")";
+            ss << "cost: " << cost << " loc: (" << m.GetCoord(loc) << ") g: " << g;
             return ss.str();
         }
     };
 
+    // Per-thread A* state sized to the map (see player.cc).
+    struct AStarScratch;
+    static AStarScratch &get_astar_scratch(const RTSMap &m);
+
     bool line_passable(UnitId id, const PointF &curr, const PointF &target) const;
     float get_line_dist(const Loc &p1, const Loc &p2) const;
+    // The larger of the line distance and the map's landmark bound; both are admissible.
+    float get_dist_lower_bound(const Loc &p1, const Loc &p2) const;
+
+    // Add (delta = 1) or remove (delta = -1) one unit's sight diamond.
+    void update_sight(const Sight &s, int delta);
 
     // Update the heuristic value.
     void update_heuristic(const Loc &p1, const Loc &p2, float value) const;
@@ -94,21 +195,47 @@ private:
     // Get the heuristic distance from p1 to p2.
     float get_path_dist_heuristic(const Loc &p1, const Loc &p2) const;
 
+    const FlowField &get_flow_field(Tick tick, const Loc &lt) const;
+
+    // Follow the flow field of lt from s, and return the farthest cell on that path that can
+    // be reached from s by a straight line. Returns false if lt cannot be reached over the
+    // terrain, or if units close to s block the path.
+    bool flow_field_waypoint(Tick tick, UnitId id, const PointF &s, const Loc &lt, Loc *waypoint, float *dist) const;
+
+    // Fixed-iteration A* from ls to lt, which also avoids units close to s.
+    bool path_planning_astar(Tick tick, UnitId id, const PointF &s, const Loc &ls, const Loc &lt, int max_iteration, bool verbose, Coord *first_block, float *dist) const;
+
 public:
     Player() : _map(nullptr), _player_id(INVALID), _privilege(PV_NORMAL), _resource(0) {
     }
     Player(const RTSMap& m, int player_id)
         : _map(&m), _player_id(player_id), _privilege(PV_NORMAL), _resource(0) {
-        _fogs.assign(_map->GetPlaneSize(), Fog());
+        _visible.Resize(_map->GetPlaneSize());
     }
 
     const RTSMap& GetMap() const { return *_map; }
-    const RTSMap *ResetMap(const RTSMap *new_map) { auto tmp = _map; _map = new_map; return tmp; }
+    // Flow fields check the terrain version, so they are only dropped for another map.
+    const RTSMap *ResetMap(const RTSMap *new_map) {
+        auto tmp = _map;
+        if (new_map != _map) _flow_fields.clear();
+        _map = new_map;
+        _rebuild_fow = true;
+        return tmp;
+    }
+    // For a copy of the player on a copy of its map with the same terrain (see GameEnv::Fork()),
+    // which keeps the fog of war and the flow fields.
+    void SetMapCopy(const RTSMap *map_copy) { _map = map_copy; }
     PlayerId GetId() const { return _player_id; }
     int GetResource() const { return _resource; }
 
     string Draw() const;
-    void ComputeFOW(const map<UnitId, unique_ptr<Unit> > &units);
+    // Only units that moved to another cell, spawned or died since the last call change the fogs.
+    void ComputeFOW(const Units &units);
+    // Recompute the fog of war from scratch and throw if it differs from the incremental one.
+    void CheckFOW(const Units &units) const;
+    void SetFOWMode(FOWMode mode) { _fow_mode = mode; _rebuild_fow = true; }
+    FOWMode GetFOWMode() const { return _fow_mode; }
+    const FogMask &GetVisibility() const { return _visible; }
     bool FilterWithFOW(const Unit& u) const;
 
     float GetDistanceSquared(const PointF &p, const Coord &c) const {
@@ -133,9 +260,9 @@ public:
         return make_string("p", _player_id, _resource);
     }
 
-    void ClearCache() { _heuristics.clear(); _cache.clear(); _resource = 0; }
+    void ClearCache() { _heuristics.Reset(); _cache.Reset(); _flow_fields.clear(); _resource = 0; }
 
-    bool CanSeeTerrain(Loc loc) const { return _fogs[loc].CanSeeTerrain(); }
+    bool CanSeeTerrain(Loc loc) const { return _visible.Get(loc); }
 
     string PrintInfo() const;
 
@@ -143,9 +270,10 @@ public:
 
     // 24-30 encoding player id.
     static PlayerId ExtractPlayerId(UnitId id) { return (id >> 24); }
+    static UnitId ExtractRawId(UnitId id) { return (id & 0xffffff); }
     static UnitId CombinePlayerId(UnitId raw_id, PlayerId player_id) { return (raw_id & 0xffffff) | (player_id << 24); }
 
-    SERIALIZER(Player, _player_id, _privilege, _resource, _fogs, _heuristics, _cache);
+    SERIALIZER(Player, _player_id, _privilege, _resource, _visible, _heuristics, _cache);
     HASH(Player, _player_id, _privilege, _resource);
 };
 
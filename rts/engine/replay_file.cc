@@ -0,0 +1,255 @@
+/**
+* Copyright (c) 2017-present, Facebook, Inc.
+* All rights reserved.
+*
+* This source code is licensed under the BSD-style license found in the
+* LICENSE file in the root directory of this source tree. An additional grant
+* of patent rights can be found in the PATENTS file in the same directory.
+*/
+
+#include "replay_file.h"
+#include "game_env.h"
+#include "cmd_receiver.h"
+#include <algorithm>
+#include <zlib.h>
+
+static const char kMagic[] = "ELFRPX01";
+static const size_t kMagicSize = sizeof(kMagic) - 1;
+static const size_t kTrailerSize = sizeof(uint64_t) + sizeof(uint32_t) + kMagicSize;
+static const size_t kBlockHeaderSize = 2 * sizeof(uint32_t);
+// Deflate cannot expand data by more than this, so a block that claims more is damaged.
+static const uint64_t kMaxDeflateRatio = 1032;
+
+bool ReplayWriter::Open(const string &filename, int keyframe_interval, int chunk_cmds) {
+    _f.open(filename, std::ios::binary | std::ios::trunc);
+    if (! _f.is_open()) return false;
+    _f.write(kMagic, kMagicSize);
+
+    _index = ReplayIndex();
+    _index.keyframe_interval = keyframe_interval;
+    _chunk_cmds = max(chunk_cmds, 1);
+    _chunk.clear();
+    _chunk_size = 0;
+    return _f.good();
+}
+
+uint64_t ReplayWriter::write_block(const string &raw) {
+    uLongf size = compressBound(raw.size());
+    _buf.resize(size);
+    if (compress2((Bytef *)_buf.data(), &size, (const Bytef *)raw.data(), raw.size(), Z_DEFAULT_COMPRESSION) != Z_OK) {
+        throw std::range_error("ReplayWriter: cannot compress a block of " + std::to_string(raw.size()) + " bytes");
+    }
+    const uint64_t offset = _f.tellp();
+    const uint32_t sizes[2] = { (uint32_t)raw.size(), (uint32_t)size };
+    _f.write((const char *)sizes, sizeof(sizes));
+    _f.write(_buf.data(), size);
+    return offset;
+}
+
+void ReplayWriter::flush_chunk() {
+    if (_chunk_size == 0) return;
+    ReplayIndex::Entry entry;
+    entry.tick = _chunk_tick;
+    entry.first_cmd = _index.num_cmds - _chunk_size;
+    entry.offset = write_block(_chunk);
+    _index.chunks.push_back(entry);
+    _chunk.clear();
+    _chunk_size = 0;
+}
+
+void ReplayWriter::add_cmds(const CmdReceiver &receiver) {
+    const auto &history = receiver.GetCmdHistory();
+    if ((int)history.size() < _index.num_cmds) {
+        throw std::range_error("ReplayWriter: the cmd history of the receiver was cleared");
+    }
+    serializer::saver saver(&_chunk);
+    for (int i = _index.num_cmds; i < (int)history.size(); ++i) {
+        if (_chunk_size == 0) _chunk_tick = receiver.GetTick();
+        saver << history[i];
+        _chunk_size ++;
+        _index.num_cmds ++;
+        if (_chunk_size >= _chunk_cmds) flush_chunk();
+    }
+}
+
+void ReplayWriter::OnTick(const GameEnv &env, const CmdReceiver &receiver) {
+    const Tick tick = receiver.GetTick();
+    add_cmds(receiver);
+
+    const auto &keyframes = _index.keyframes;
+    if (keyframes.empty()) _index.first_tick = tick;
+    if (keyframes.empty() || (_index.keyframe_interval > 0 && tick - keyframes.back().tick >= _index.keyframe_interval)) {
+        flush_chunk();
+        string raw;
+        serializer::saver saver(&raw);
+        env.SaveSnapshot(saver);
+        receiver.SaveCmdReceiver(saver);
+
+        ReplayIndex::Entry entry;
+        entry.tick = tick;
+        entry.first_cmd = _index.num_cmds;
+        entry.offset = write_block(raw);
+        _index.keyframes.push_back(entry);
+    }
+}
+
+bool ReplayWriter::Close(const GameEnv &env, const CmdReceiver &receiver) {
+    add_cmds(receiver);
+    flush_chunk();
+    _index.last_tick = receiver.GetTick();
+    _index.winner = env.GetWinnerId();
+
+    string index;
+    serializer::saver saver(&index);
+    saver << _index;
+    const uint64_t offset = _f.tellp();
+    const uint32_t size = index.size();
+    _f.write(index.data(), index.size());
+    _f.write((const char *)&offset, sizeof(offset));
+    _f.write((const char *)&size, sizeof(size));
+    _f.write(kMagic, kMagicSize);
+
+    const bool ok = _f.good();
+    _f.close();
+    return ok;
+}
+
+// The cmd ranges of the index have to be ordered and within the cmds, since ReadCmds() and
+// LoadKeyframe() rely on them. Offsets are checked by read_block().
+static bool valid_index(const ReplayIndex &index) {
+    if (index.num_cmds < 0) return false;
+    int first_cmd = 0;
+    for (const auto &chunk : index.chunks) {
+        if (chunk.first_cmd < first_cmd || chunk.first_cmd > index.num_cmds) return false;
+        first_cmd = chunk.first_cmd;
+    }
+    for (const auto &keyframe : index.keyframes) {
+        if (keyframe.first_cmd < 0 || keyframe.first_cmd > index.num_cmds) return false;
+    }
+    return true;
+}
+
+bool ReplayReader::IsIndexed(const string &filename) {
+    std::ifstream f(filename, std::ios::binary);
+    char magic[kMagicSize];
+    if (! f.read(magic, kMagicSize)) return false;
+    return std::equal(magic, magic + kMagicSize, kMagic);
+}
+
+bool ReplayReader::Open(const string &filename) {
+    _f.close();
+    _f.clear();
+    _f.open(filename, std::ios::binary);
+    if (! _f.is_open()) return false;
+
+    _f.seekg(0, std::ios::end);
+    const std::streamoff length = _f.tellg();
+    if (length < (std::streamoff)(kMagicSize + kTrailerSize)) return false;
+    const uint64_t trailer = length - kTrailerSize;
+
+    uint64_t offset;
+    uint32_t size;
+    char magic[kMagicSize];
+    _f.seekg(trailer);
+    _f.read((char *)&offset, sizeof(offset));
+    _f.read((char *)&size, sizeof(size));
+    _f.read(magic, kMagicSize);
+    if (! _f || ! std::equal(magic, magic + kMagicSize, kMagic)) return false;
+    // The index has to fit between the blocks and the trailer. Check before allocating, so that
+    // a damaged trailer does not make us allocate gigabytes.
+    if (offset < kMagicSize || offset > trailer || size > trailer - offset) return false;
+    _index_offset = offset;
+
+    _raw.resize(size);
+    _f.seekg(offset);
+    if (! _f.read(_raw.data(), size)) return false;
+
+    _index = ReplayIndex();
+    try {
+        serializer::loader loader(_raw.data(), _raw.size());
+        loader >> _index;
+    } catch (const std::range_error &) {
+        return false;
+    }
+    return valid_index(_index);
+}
+
+void ReplayReader::read_block(uint64_t offset) {
+    const auto bad_block = [offset]() {
+        return std::range_error("ReplayReader: bad block at offset " + std::to_string(offset));
+    };
+    if (offset < kMagicSize || offset > _index_offset || _index_offset - offset < kBlockHeaderSize) throw bad_block();
+
+    uint32_t sizes[2];
+    _f.clear();
+    _f.seekg(offset);
+    if (! _f.read((char *)sizes, sizeof(sizes))) throw bad_block();
+    // The block has to end before the index, and cannot inflate beyond what deflate allows.
+    if (sizes[1] > _index_offset - offset - kBlockHeaderSize || sizes[0] > kMaxDeflateRatio * sizes[1]) throw bad_block();
+
+    _compressed.resize(sizes[1]);
+    if (! _f.read(_compressed.data(), sizes[1])) throw bad_block();
+    uLongf size = sizes[0];
+    _raw.resize(size);
+    if (uncompress((Bytef *)_raw.data(), &size, (const Bytef *)_compressed.data(), _compressed.size()) != Z_OK
+            || size != sizes[0]) {
+        throw bad_block();
+    }
+}
+
+void ReplayReader::ReadCmds(vector<CmdBPtr> *cmds) {
+    cmds->clear();
+    const auto &chunks = _index.chunks;
+    for (size_t i = 0; i < chunks.size(); ++i) {
+        const int end = i + 1 < chunks.size() ? chunks[i + 1].first_cmd : _index.num_cmds;
+        read_block(chunks[i].offset);
+        // Each cmd takes a few bytes at least. This bounds what a damaged index can make us allocate.
+        if ((size_t)(end - chunks[i].first_cmd) > _raw.size()) {
+            throw std::range_error("ReplayReader: chunk " + std::to_string(i) + " is too short for its cmds");
+        }
+        serializer::loader loader(_raw.data(), _raw.size());
+        for (int j = chunks[i].first_cmd; j < end; ++j) {
+            CmdBPtr cmd;
+            loader >> cmd;
+            cmds->push_back(std::move(cmd));
+        }
+    }
+}
+
+int ReplayReader::FindKeyframe(Tick tick) const {
+    const auto &keyframes = _index.keyframes;
+    auto it = std::upper_bound(keyframes.begin(), keyframes.end(), tick,
+        [](Tick t, const ReplayIndex::Entry &e) { return t < e.tick; });
+    return (int)(it - keyframes.begin()) - 1;
+}
+
+void ReplayReader::LoadKeyframe(int i, GameEnv *env, CmdReceiver *receiver) {
+    const auto &keyframe = _index.keyframes[i];
+    read_block(keyframe.offset);
+    serializer::loader loader(_raw.data(), _raw.size());
+    env->LoadSnapshot(loader);
+    receiver->LoadCmdReceiver(loader);
+    // The cmds sent before the keyframe are in its queues already, whatever their tick.
+    receiver->SetNextReplayIdx(keyframe.first_cmd);
+}
+
+bool ReplayReader::Seek(Tick tick, GameEnv *env, CmdReceiver *receiver) {
+    tick = min(tick, _index.last_tick);
+    const int i = FindKeyframe(tick);
+    if (i < 0) return false;
+    LoadKeyframe(i, env, receiver);
+    FastForward(tick, env, receiver);
+    return true;
+}
+
+void ReplayReader::FastForward(Tick tick, GameEnv *env, CmdReceiver *receiver) {
+    // The ticks of RTSGame::MainLoop() with bypass_bot_actions, without the UI and the checks.
+    while (receiver->GetTick() < tick) {
+        receiver->SendCurrentReplay();
+        env->Forward(receiver);
+        receiver->ExecuteDurativeCmds(*env, false);
+        receiver->ExecuteImmediateCmds(env, false);
+        env->ComputeFOW();
+        receiver->IncTick();
+    }
+}
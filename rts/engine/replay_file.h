@@ -0,0 +1,111 @@
+/**
+* Copyright (c) 2017-present, Facebook, Inc.
+* All rights reserved.
+*
+* This source code is licensed under the BSD-style license found in the
+* LICENSE file in the root directory of this source tree. An additional grant
+* of patent rights can be found in the PATENTS file in the same directory.
+*/
+
+#ifndef _REPLAY_FILE_H_
+#define _REPLAY_FILE_H_
+
+#include "cmd.h"
+#include <fstream>
+
+class GameEnv;
+class CmdReceiver;
+
+// Indexed replays (.rpx), one file per game:
+//   "ELFRPX01"
+//   blocks   zlib-compressed, each [raw size][compressed size][bytes] (two uint32_t), of either
+//              cmds:      a chunk of the cmd history, in the order it was sent (binary CmdBPtrs);
+//              keyframe:  GameEnv::SaveSnapshot() + CmdReceiver::SaveCmdReceiver() at the start of a tick.
+//   index    ReplayIndex, binary and not compressed.
+//   trailer  [index offset (uint64_t)][index size (uint32_t)]"ELFRPX01"
+// A keyframe starts a new cmd chunk, and records how many cmds were sent before it: the cmds
+// after that are the ones to replay from it. Opening a file only reads the trailer and the index.
+struct ReplayIndex {
+    struct Entry {
+        Tick tick;
+        uint64_t offset;
+        // Index of the first cmd of a chunk, or of the first cmd to replay from a keyframe.
+        int first_cmd;
+
+        SERIALIZER(Entry, tick, offset, first_cmd);
+    };
+
+    int version = 1;
+    int keyframe_interval = 0;
+    Tick first_tick = 0;
+    Tick last_tick = 0;
+    int num_cmds = 0;
+    PlayerId winner = INVALID;
+    vector<Entry> chunks;
+    vector<Entry> keyframes;
+
+    SERIALIZER(ReplayIndex, version, keyframe_interval, first_tick, last_tick, num_cmds, winner, chunks, keyframes);
+};
+
+// Writes the replay of a game while it runs. Call OnTick() at the start of every tick and
+// Close() once the game is over.
+class ReplayWriter {
+public:
+    // A keyframe every keyframe_interval ticks, and a cmd chunk every chunk_cmds cmds at most.
+    bool Open(const string &filename, int keyframe_interval, int chunk_cmds = 1024);
+    bool IsOpen() const { return _f.is_open(); }
+
+    // Writes the cmds sent since the last call, and a keyframe if one is due.
+    void OnTick(const GameEnv &env, const CmdReceiver &receiver);
+    // Writes the remaining cmds and the index.
+    bool Close(const GameEnv &env, const CmdReceiver &receiver);
+
+private:
+    std::ofstream _f;
+    ReplayIndex _index;
+    int _chunk_cmds = 0;
+    string _chunk;
+    int _chunk_size = 0;
+    Tick _chunk_tick = 0;
+    vector<char> _buf;
+
+    void add_cmds(const CmdReceiver &receiver);
+    void flush_chunk();
+    uint64_t write_block(const string &raw);
+};
+
+// Reads an indexed replay. Not thread-safe, use one reader per thread. Reading a damaged block
+// throws std::range_error.
+class ReplayReader {
+public:
+    static bool IsIndexed(const string &filename);
+
+    // Only reads the index.
+    bool Open(const string &filename);
+    const ReplayIndex &GetIndex() const { return _index; }
+
+    // All the cmds, as CmdReceiver::LoadReplay() takes them.
+    void ReadCmds(vector<CmdBPtr> *cmds);
+
+    // The last keyframe at or before tick, -1 if there is none.
+    int FindKeyframe(Tick tick) const;
+    void LoadKeyframe(int i, GameEnv *env, CmdReceiver *receiver);
+
+    // Restores the game at the start of tick from the last keyframe before it, and plays the
+    // replay loaded in receiver (see CmdReceiver::LoadReplay()) from there up to tick.
+    // Ticks past the end of the replay seek to its last tick.
+    bool Seek(Tick tick, GameEnv *env, CmdReceiver *receiver);
+    // Plays the replay loaded in receiver up to the start of tick.
+    static void FastForward(Tick tick, GameEnv *env, CmdReceiver *receiver);
+
+private:
+    std::ifstream _f;
+    ReplayIndex _index;
+    // Blocks end where the index starts.
+    uint64_t _index_offset = 0;
+    vector<char> _raw, _compressed;
+
+    void read_block(uint64_t offset);
+};
+
+#endif
@@ -36,6 +36,7 @@ void Preload::collect_stats(const GameEnv &env, int player_id, const CmdReceiver
     _result = NOT_READY;
 
     _player_id = player_id;
+    _env = &env;
 
     // Collect ...
     const Units& units = env.GetUnits();
@@ -45,8 +46,8 @@ void Preload::collect_stats(const GameEnv &env, int player_id, const CmdReceiver
     // cout << "Looping over units" << endl << flush;
 
     // Get the information of all other troops.
-    for (auto it = units.begin(); it != units.end(); ++it) {
-        const Unit *u = it->second.get();
+    for (const Unit &unit : units) {
+        const Unit *u = &unit;
         if (u == nullptr) cout << "Unit cannot be nullptr" << endl << flush;
         // cout << "unit: " << u->GetProperty().PrintInfo() << endl << flush;
 
@@ -132,18 +133,25 @@ void Preload::GatherInfo(const GameEnv& env, int player_id, const CmdReceiver &r
     _result = OK;
 }
 
+// Closest unit of _enemy_troops_in_range whose squared distance to p is below max_dist_sqr.
+const Unit *Preload::closest_enemy_in_range(const PointF &p, float max_dist_sqr) const {
+    const UnitFilter filter = UnitFilter::EnemiesOf(_player_id).ExceptType(RESOURCE).VisibleTo(_player_id);
+    // Query slightly farther and apply the exact test below.
+    auto closest = _env->KNearest(p, 1, filter, std::sqrt(max_dist_sqr) + 1e-3);
+    if (closest.empty() || PointF::L2Sqr(closest[0]->GetPointF(), p) >= max_dist_sqr) return nullptr;
+    return closest[0];
+}
+
 const Unit *Preload::EnemyAtResource() {
     if (_enemy_at_resource == nullptr) {
-      float closest = 6.0;
-      _enemy_at_resource = RuleActor::closest_dist(_enemy_troops_in_range, _resource_loc, &closest);
+      _enemy_at_resource = closest_enemy_in_range(_resource_loc, 6.0);
     }
     return _enemy_at_resource;
 }
 
 const Unit *Preload::EnemyAtBase() {
     if (_enemy_at_base == nullptr) {
-      float closest = 4.0;
-      _enemy_at_base = RuleActor::closest_dist(_enemy_troops_in_range, _base_loc, &closest);
+      _enemy_at_base = closest_enemy_in_range(_base_loc, 4.0);
     }
     return _enemy_at_base;
 }
@@ -176,13 +184,15 @@ void RuleActor::batch_store_cmds(const vector<const Unit *> &subset,
     }
 }
 
-bool RuleActor::hit_and_run(const GameEnv &env, const Unit *u, const vector<const Unit*> targets,
+bool RuleActor::hit_and_run(const GameEnv &env, const Unit *u, UnitType target_type,
         AssignedCmds *assigned_cmds) {
     // cout << "Check u " << hex << (void *)u << dec << endl << flush;
 
-    float closest = std::numeric_limits<float>::max();
-    const Unit *closest_target = closest_dist(targets, u->GetPointF(), &closest);
-    if (closest_target != nullptr) {
+    auto nearest = env.KNearest(u->GetPointF(), 1, UnitFilter::EnemiesOf(_player_id).OfType(target_type));
+    if (! nearest.empty()) {
+        const Unit *closest_target = nearest[0];
+        const float closest = PointF::L2Sqr(closest_target->GetPointF(), u->GetPointF());
+        const vector<const Unit*> &targets = _preload.EnemyTroops()[target_type];
         UnitId opponent_target_id = closest_target->GetId();
         if (closest > HitAndRunDist2) {
             store_cmd(u, _A(opponent_target_id), assigned_cmds);
@@ -274,16 +284,16 @@ bool RuleActor::act_per_unit(const GameEnv &env, const Unit *u, const int *state
 
     if (state[STATE_HIT_AND_RUN]) {
         // cout << "Enter hit and run procedure" << endl << flush;
-        auto enemy_troops = _preload.EnemyTroops();
+        const auto& enemy_troops = _preload.EnemyTroops();
         *state_string = "Hit and run";
         if (ut == RANGE_ATTACKER) {
             // cout << "Enemy only have worker" << endl << flush;
             if (enemy_troops[MELEE_ATTACKER].empty() && enemy_troops[RANGE_ATTACKER].empty() && ! enemy_troops[WORKER].empty()) {
-                hit_and_run(env, u, enemy_troops[WORKER], assigned_cmds);
+                hit_and_run(env, u, WORKER, assigned_cmds);
             }
 
             if (! enemy_troops[MELEE_ATTACKER].empty()) {
-                hit_and_run(env, u, enemy_troops[MELEE_ATTACKER], assigned_cmds);
+                hit_and_run(env, u, MELEE_ATTACKER, assigned_cmds);
             }
         }
         if (ut == RANGE_ATTACKER || ut == MELEE_ATTACKER) {
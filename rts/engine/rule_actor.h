@@ -71,6 +71,7 @@ private:
 
     const Unit *_base;
     PlayerId _player_id;
+    const GameEnv *_env;
     int _num_unit_type;
     Result _result;
     const Unit *_enemy_at_resource;
@@ -94,9 +95,10 @@ private:
     }
 
     void collect_stats(const GameEnv &env, int player_id, const CmdReceiver &receiver);
+    const Unit *closest_enemy_in_range(const PointF &p, float max_dist_sqr) const;
 
 public:
-    Preload() : _base(nullptr), _player_id(INVALID), _num_unit_type(0),
+    Preload() : _base(nullptr), _player_id(INVALID), _env(nullptr), _num_unit_type(0),
                 _result(NOT_READY), _enemy_at_resource(nullptr), _enemy_at_base(nullptr) {
     }
 
@@ -143,7 +145,8 @@ protected:
     const CmdReceiver *_receiver;
     Preload _preload;
     PlayerId _player_id;
-    bool hit_and_run(const GameEnv &env, const Unit *u, const vector<const Unit*> targets, AssignedCmds *assigned_cmds);
+    // Hit and run against the closest enemy unit of type target_type.
+    bool hit_and_run(const GameEnv &env, const Unit *u, UnitType target_type, AssignedCmds *assigned_cmds);
     bool store_cmd(const Unit *, CmdBPtr &&cmd, AssignedCmds *m) const;
     bool store_cmd_if_different(const Unit *, CmdBPtr &&cmd, AssignedCmds *m) const;
     void batch_store_cmds(const vector<const Unit *> &subset, const CmdBPtr& cmd, bool preemptive, AssignedCmds *m) const;
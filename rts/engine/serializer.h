@@ -10,14 +10,18 @@
 #ifndef _SERIALIZER_H_
 #define _SERIALIZER_H_
 
+#include <array>
+#include <cstring>
 #include <iomanip>
 #include <iostream>
 #include <functional>
 #include <fstream>
 #include <sstream>
+#include <stdexcept>
 #include <map>
 #include <vector>
 #include <queue>
+#include <type_traits>
 #include <utility>
 #include <unordered_map>
 #include <memory>
@@ -25,28 +29,58 @@
 
 namespace serializer {
 
+// Whether a run of T is saved as its raw bytes in binary mode. Same bytes as saving the items one
+// by one, so it only saves the per-item calls.
+template <typename T>
+struct is_raw : std::integral_constant<bool, std::is_arithmetic<T>::value && ! std::is_same<T, bool>::value> { };
+
 class saver {
 private:
     std::stringstream _oo;
     bool _binary;
+    // If set, binary data is appended to this caller-owned buffer instead of _oo.
+    std::string *_buf = nullptr;
+
+    template <typename T>
+    static void save_items(saver &s, const T *p, int size, std::true_type) {
+        if (s.is_binary()) s.write(p, size * sizeof(T));
+        else save_items(s, p, size, std::false_type());
+    }
+
+    template <typename T>
+    static void save_items(saver &s, const T *p, int size, std::false_type) {
+        for (int i = 0; i < size; ++i) {
+            s << p[i];
+            if (! s.is_binary()) s.get() << " ";
+        }
+    }
 
 public:
     explicit saver(bool isbinary): _binary(isbinary) {}
+    // Binary saver that appends to *buf. Reusing the same buf keeps its capacity, so repeated
+    // snapshots do not allocate.
+    explicit saver(std::string *buf): _binary(true), _buf(buf) {}
     bool write_to_file(const std::string &s) {
         std::ofstream oFile(s, _binary ? std::ios::binary | std::ios::out : std::ios::out);
         if (oFile.is_open()) {
-            oFile << _oo.rdbuf();
+            if (_buf != nullptr) oFile.write(_buf->data(), _buf->size());
+            else oFile << _oo.rdbuf();
             return true;
         }
         return false;
     }
-    std::string get_str() {return _oo.str();}
+    std::string get_str() { return _buf != nullptr ? *_buf : _oo.str(); }
     std::stringstream &get() { return _oo; }
     bool is_binary() const { return _binary; }
 
+    void write(const void *p, size_t n) {
+        if (_buf != nullptr) _buf->append(reinterpret_cast<const char *>(p), n);
+        else _oo.write(reinterpret_cast<const char *>(p), n);
+    }
+
     friend saver &operator<<(saver &s, const int& v) {
         if (s.is_binary()) {
-            s.get().write(reinterpret_cast<const char *>(&v), sizeof(int));
+            s.write(&v, sizeof(int));
         } else {
             s.get() << v;
         }
@@ -55,7 +89,7 @@ public:
 
     friend saver &operator<<(saver &s, const uint64_t& v) {
         if (s.is_binary()) {
-            s.get().write(reinterpret_cast<const char *>(&v), sizeof(uint64_t));
+            s.write(&v, sizeof(uint64_t));
         } else {
             s.get() << v;
         }
@@ -64,7 +98,7 @@ public:
 
     friend saver &operator<<(saver &s, const float& v) {
         if (s.is_binary()) {
-            s.get().write(reinterpret_cast<const char *>(&v), sizeof(float));
+            s.write(&v, sizeof(float));
         } else {
             s.get() << std::setprecision(20) << v;
         }
@@ -73,7 +107,7 @@ public:
 
     friend saver &operator<<(saver &s, const bool& v) {
         if (s.is_binary()) {
-            s.get().write(reinterpret_cast<const char *>(&v), sizeof(bool));
+            s.write(&v, sizeof(bool));
         } else {
             s.get() << v;
         }
@@ -114,7 +148,7 @@ public:
         if (s.is_binary()) {
             int size = v.size();
             s << size;
-            s.get().write(v.c_str(), v.size());
+            s.write(v.data(), v.size());
         } else {
             s.get() << "\"" << v << "\"";
         }
@@ -123,17 +157,38 @@ public:
 
     template <typename T>
     friend saver &operator<<(saver &s, const std::vector<T>& v) {
+        int size = v.size();
+        if (! s.is_binary()) s.get() << " ";
+        s << size;
+        if (! s.is_binary()) s.get() << " ";
+        save_items(s, v.data(), size, is_raw<T>());
+        return s;
+    }
+
+    // std::vector<bool> is packed and has no data(), so its items are saved one by one.
+    friend saver &operator<<(saver &s, const std::vector<bool>& v) {
         int size = v.size();
         if (! s.is_binary()) s.get() << " ";
         s << size;
         if (! s.is_binary()) s.get() << " ";
         for (int i = 0; i < size; ++i) {
-            s << v[i];
+            s << (bool)v[i];
             if (! s.is_binary()) s.get() << " ";
         }
         return s;
     }
 
+    // Same layout as std::vector, so the two are interchangeable in saved states.
+    template <typename T, size_t N>
+    friend saver &operator<<(saver &s, const std::array<T, N>& v) {
+        int size = N;
+        if (! s.is_binary()) s.get() << " ";
+        s << size;
+        if (! s.is_binary()) s.get() << " ";
+        save_items(s, v.data(), size, is_raw<T>());
+        return s;
+    }
+
     template <typename Key, typename T>
     friend saver &operator<<(saver &s, const std::map<Key, T>& m) {
         int size = m.size();
@@ -177,9 +232,26 @@ class loader {
 private:
     std::stringstream _ii;
     bool _binary;
+    // If set, binary data is read from [_pos, _end) instead of _ii.
+    const char *_begin = nullptr;
+    const char *_pos = nullptr;
+    const char *_end = nullptr;
+
+    template <typename T>
+    static void load_items(loader &l, T *p, int size, std::true_type) {
+        if (l.is_binary()) l.read(p, size * sizeof(T));
+        else load_items(l, p, size, std::false_type());
+    }
+
+    template <typename T>
+    static void load_items(loader &l, T *p, int size, std::false_type) {
+        for (int i = 0; i < size; ++i) l >> p[i];
+    }
 
 public:
     explicit loader(bool isbinary) : _binary(isbinary) {}
+    // Binary loader reading from the span [data, data + size), which has to outlive the loader.
+    loader(const char *data, size_t size) : _binary(true), _begin(data), _pos(data), _end(data + size) {}
     bool read_from_file(const std::string &s) {
         std::ifstream iFile(s, _binary ? (std::ios::binary | std::ios::in) : std::ios::in);
         if (iFile.is_open()) {
@@ -191,10 +263,33 @@ public:
     void set_str(const std::string &s) {_ii << s;}
     std::stringstream &get() { return _ii; }
     bool is_binary() const { return _binary; }
+    long tell() { return _begin != nullptr ? _pos - _begin : (long)_ii.tellg(); }
+
+    // Number of items about to be loaded, checked against what is left of a span.
+    int read_size(size_t item_size) {
+        int s;
+        *this >> s;
+        if (s < 0 || (_begin != nullptr && (size_t)s * item_size > (size_t)(_end - _pos))) {
+            throw std::range_error("Bad size " + std::to_string(s) + " at pos " + std::to_string(tell()));
+        }
+        return s;
+    }
+
+    void read(void *p, size_t n) {
+        if (_begin != nullptr) {
+            if (n > (size_t)(_end - _pos)) {
+                throw std::range_error("Read " + std::to_string(n) + " bytes past the end at pos " + std::to_string(tell()));
+            }
+            memcpy(p, _pos, n);
+            _pos += n;
+        } else {
+            _ii.read(reinterpret_cast<char *>(p), n);
+        }
+    }
 
     friend loader &operator>>(loader &l, int& v) {
         if (l.is_binary()) {
-            l.get().read(reinterpret_cast<char *>(&v), sizeof(int));
+            l.read(&v, sizeof(int));
         } else {
             l.get() >> v;
         }
@@ -204,7 +299,7 @@ public:
 
     friend loader &operator>>(loader &l, uint64_t& v) {
         if (l.is_binary()) {
-            l.get().read(reinterpret_cast<char *>(&v), sizeof(uint64_t));
+            l.read(&v, sizeof(uint64_t));
         } else {
             l.get() >> v;
         }
@@ -214,7 +309,7 @@ public:
 
     friend loader &operator>>(loader &l, float& v) {
         if (l.is_binary()) {
-            l.get().read(reinterpret_cast<char *>(&v), sizeof(float));
+            l.read(&v, sizeof(float));
         } else {
             l.get() >> v;
         }
@@ -225,7 +320,7 @@ public:
 
     friend loader &operator>>(loader &l, bool& v) {
         if (l.is_binary()) {
-            l.get().read(reinterpret_cast<char *>(&v), sizeof(bool));
+            l.read(&v, sizeof(bool));
         } else {
             l.get() >> v;
         }
@@ -243,6 +338,7 @@ public:
     friend loader &operator>>(loader &l, p_queue<T>& v) {
         int s;
         l >> s;
+        while (! v.empty()) v.pop();
         for (int i = 0; i < s; ++i) {
             T tmp;
             l >> tmp;
@@ -259,17 +355,9 @@ public:
 
     friend loader &operator>>(loader &l, std::string& v) {
         if (l.is_binary()) {
-            int s;
-            l >> s;
-            // std::cout << "In loader::string: s = " << s << std::endl;
-            if (s > 0) {
-                char *tmp = new char[s];
-                l.get().read(tmp, s);
-                v.assign(tmp, s);
-                delete [] tmp;
-            } else {
-                v = "";
-            }
+            int s = l.read_size(1);
+            v.resize(s);
+            if (s > 0) l.read(&v[0], s);
         } else {
             std::string skip;
             std::getline(l.get(), skip, '"');
@@ -282,16 +370,34 @@ public:
 
     template <typename T>
     friend loader &operator>>(loader &l, std::vector<T>& v) {
-        int s;
-        l >> s;
+        int s = l.read_size(is_raw<T>::value ? sizeof(T) : 1);
         v.clear();
+        v.resize(s);
+        load_items(l, v.data(), s, is_raw<T>());
+        return l;
+    }
+
+    friend loader &operator>>(loader &l, std::vector<bool>& v) {
+        int s = l.read_size(sizeof(bool));
+        v.clear();
+        v.reserve(s);
         for (int i = 0; i < s; ++i) {
-            v.emplace_back(T());
-            l >> v[i];
+            bool b;
+            l >> b;
+            v.push_back(b);
         }
         return l;
     }
 
+    template <typename T, size_t N>
+    friend loader &operator>>(loader &l, std::array<T, N>& v) {
+        int s;
+        l >> s;
+        if (s != (int)N) throw std::range_error("Expected " + std::to_string(N) + " items, got " + std::to_string(s));
+        load_items(l, v.data(), s, is_raw<T>());
+        return l;
+    }
+
     template <typename Key, typename T>
     friend loader &operator>>(loader &l, std::map<Key, T>& m) {
         int s;
@@ -393,6 +499,17 @@ namespace std
             return code;
         }
     };
+
+    template<typename T, size_t N>
+    struct hash<array<T, N>> {
+        uint64_t operator()(const array<T, N>& s) const {
+            uint64_t code = 0;
+            for (const auto &v : s) {
+                serializer::hash_combine(code, v);
+            }
+            return code;
+        }
+    };
 }
 
 #define SERIALIZER(TypeName, ...) \
@@ -474,7 +591,7 @@ class no_such_obj_exception {
             p.reset(obj); \
             p->Load(ii); \
         } else { \
-            std::cout << "\"" << identifier << "\" is not valid! File pos = " << ii.get().tellg() << std::endl; \
+            std::cout << "\"" << identifier << "\" is not valid! File pos = " << ii.tell() << std::endl; \
             throw no_such_obj_exception(); \
         } \
         return ii; \
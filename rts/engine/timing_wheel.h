@@ -0,0 +1,116 @@
+/**
+* Copyright (c) 2017-present, Facebook, Inc.
+* All rights reserved.
+*
+* This source code is licensed under the BSD-style license found in the
+* LICENSE file in the root directory of this source tree. An additional grant
+* of patent rights can be found in the PATENTS file in the same directory.
+*/
+
+#ifndef _TIMING_WHEEL_H_
+#define _TIMING_WHEEL_H_
+
+#include "pq_extend.h"
+#include <algorithm>
+#include <vector>
+
+// Items (e.g. unique_ptr<CmdDurative>) bucketed by the tick they are due, item->tick().
+// There is a bucket for each of the ticks [_now, _now + kNumSlots), items due later wait in _later,
+// and items due before _now are kept in the bucket of _now.
+// Each bucket is a p_queue<T>, so the items due at a tick come out in the same order as from a p_queue<T>.
+template <typename T>
+class TimingWheel {
+public:
+    static const int kNumSlots = 64;
+
+    TimingWheel() : _slots(kNumSlots) { }
+
+    int size() const { return _size; }
+    bool empty() const { return _size == 0; }
+
+    void push(T &&item) {
+        const int t = item->tick();
+        if (t < _now + kNumSlots) slot(std::max(t, _now)).push(std::move(item));
+        else _later.push(std::move(item));
+        _size ++;
+    }
+
+    // Whether any item is due at tick. Ticks normally only go forward.
+    bool HasDue(int tick) {
+        AdvanceTo(tick);
+        return ! slot(_now).empty();
+    }
+    // The first item due, call HasDue first.
+    const T &top() const { return slot(_now).top(); }
+    void pop() {
+        _size --;
+        slot(_now).pop();
+    }
+    T pop_top() {
+        _size --;
+        return slot(_now).pop_top();
+    }
+
+    template <typename F>
+    void ForEach(F f) const {
+        for (const auto &q : _slots) for_each(q, f);
+        for_each(_later, f);
+    }
+
+    // Remove all items.
+    void PopAll(std::vector<T> *items) {
+        for (auto &q : _slots) pop_all(&q, items);
+        pop_all(&_later, items);
+        _size = 0;
+    }
+
+    void clear() {
+        std::vector<T> items;
+        PopAll(&items);
+        _now = 0;
+    }
+
+private:
+    std::vector<p_queue<T>> _slots;
+    p_queue<T> _later;
+    int _now = 0;
+    int _size = 0;
+
+    p_queue<T> &slot(int t) { return _slots[t % kNumSlots]; }
+    const p_queue<T> &slot(int t) const { return _slots[t % kNumSlots]; }
+
+    void AdvanceTo(int tick) {
+        if (tick == _now) return;
+        if (tick < _now || tick - _now >= kNumSlots) {
+            // Rare (reset, load), put everything back.
+            std::vector<T> items;
+            PopAll(&items);
+            _now = tick;
+            for (auto &item : items) push(std::move(item));
+            return;
+        }
+        while (_now < tick) {
+            // Items left in the current bucket are overdue, and move on to the next one.
+            p_queue<T> &curr = slot(_now);
+            _now ++;
+            while (! curr.empty()) slot(_now).push(curr.pop_top());
+            // The bucket of _now - 1 is now the one of _now + kNumSlots - 1.
+            while (! _later.empty() && _later.top()->tick() < _now + kNumSlots) {
+                slot(_now + kNumSlots - 1).push(_later.pop_top());
+            }
+        }
+    }
+
+    template <typename F>
+    static void for_each(const p_queue<T> &q, F f) {
+        if (q.empty()) return;
+        const T *p = &q.top();
+        for (size_t i = 0; i < q.size(); ++i) f(p[i]);
+    }
+
+    static void pop_all(p_queue<T> *q, std::vector<T> *items) {
+        while (! q->empty()) items->push_back(q->pop_top());
+    }
+};
+
+#endif
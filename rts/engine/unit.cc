@@ -8,6 +8,7 @@
 */
 
 #include "unit.h"
+#include <algorithm>
 #include <sstream>
 
 // -----------------------  Unit definition ----------------------
@@ -26,3 +27,91 @@ string Unit::Draw(Tick tick) const {
     // Draw the unit.
     return make_string("c", Player::ExtractPlayerId(_id), _last_p, _p, _type) + " " + _property.Draw(tick);
 }
+
+// -----------------------  Units definition ----------------------
+Units::Units(const Units &units)
+    : _num_slots(units._num_slots), _free_slots(units._free_slots), _slot_of(units._slot_of),
+      _order(units._order), _ids(units._ids), _types(units._types) {
+    // Only the chunks in use. Add() allocates the rest.
+    const int num_chunks = (_num_slots + kChunkSize - 1) >> kChunkBits;
+    _chunks.reserve(num_chunks);
+    for (int i = 0; i < num_chunks; ++i) {
+        _chunks.emplace_back(new Unit[kChunkSize]);
+        std::copy(units._chunks[i].get(), units._chunks[i].get() + kChunkSize, _chunks.back().get());
+    }
+}
+
+void Units::clear() {
+    // Keep the chunks for the next game.
+    _num_slots = 0;
+    _free_slots.clear();
+    _slot_of.clear();
+    _order.clear();
+    _ids.clear();
+    _types.clear();
+}
+
+Unit *Units::Add(const Unit &unit) {
+    const UnitId id = unit.GetId();
+    if (id < 0 || slot_of(id) >= 0) return nullptr;
+
+    int s;
+    if (! _free_slots.empty()) {
+        s = _free_slots.back();
+        _free_slots.pop_back();
+    } else {
+        s = _num_slots ++;
+        if ((s >> kChunkBits) == (int)_chunks.size()) _chunks.emplace_back(new Unit[kChunkSize]);
+    }
+    slot(s) = unit;
+
+    const UnitId raw = Player::ExtractRawId(id);
+    if (raw >= (int)_slot_of.size()) _slot_of.resize(raw + 1, -1);
+    _slot_of[raw] = s;
+
+    // New units usually have the largest id of their player, so this is close to the end.
+    const int i = LowerBound(id);
+    _order.insert(_order.begin() + i, s);
+    _ids.insert(_ids.begin() + i, id);
+    _types.insert(_types.begin() + i, unit.GetUnitType());
+    return &slot(s);
+}
+
+bool Units::Remove(UnitId id) {
+    const int s = slot_of(id);
+    if (s < 0) return false;
+
+    const int i = LowerBound(id);
+    _order.erase(_order.begin() + i);
+    _ids.erase(_ids.begin() + i);
+    _types.erase(_types.begin() + i);
+
+    _slot_of[Player::ExtractRawId(id)] = -1;
+    _free_slots.push_back(s);
+    return true;
+}
+
+serializer::saver &Units::Save(serializer::saver &oo) const {
+    const int n = size();
+    if (! oo.is_binary()) oo.get() << " ";
+    oo << n;
+    if (! oo.is_binary()) oo.get() << " ";
+    for (int i = 0; i < n; ++i) {
+        oo << std::pair<UnitId, const Unit &>(_ids[i], At(i));
+        if (! oo.is_binary()) oo.get() << " ";
+    }
+    return oo;
+}
+
+serializer::loader &Units::Load(serializer::loader &ii) {
+    int n;
+    ii >> n;
+    clear();
+    for (int i = 0; i < n; ++i) {
+        UnitId id;
+        Unit unit;
+        ii >> id >> unit;
+        Add(unit);
+    }
+    return ii;
+}
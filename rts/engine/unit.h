@@ -13,6 +13,7 @@
 #include "player.h"
 #include "map.h"
 #include "cmd.h"
+#include <algorithm>
 #include <initializer_list>
 #include <assert.h>
 
@@ -62,6 +63,94 @@ public:
 
 STD_HASH(Unit);
 
-typedef map<UnitId, unique_ptr<Unit> > Units;
+// ---------------------------------------------------- Units ----------------------------------------------
+// Slot map of all units, iterated in increasing UnitId order.
+// Units are stored in fixed-size chunks that never move, so a Unit * stays valid until the unit
+// is removed, and the slots of removed units are reused. The slot of a unit is found by its raw id.
+// Ids and types are also kept in dense arrays, in iteration order, for scans that only need them.
+class Units {
+public:
+  template <typename S, typename U>
+  class Iter {
+  public:
+    Iter(S *units, int i) : _units(units), _i(i) { }
+    U &operator *() const { return _units->At(_i); }
+    U *operator ->() const { return &_units->At(_i); }
+    Iter &operator ++() { ++ _i; return *this; }
+    bool operator ==(const Iter &it) const { return _i == it._i; }
+    bool operator !=(const Iter &it) const { return _i != it._i; }
+
+  private:
+    S *_units;
+    int _i;
+  };
+  typedef Iter<Units, Unit> iterator;
+  typedef Iter<const Units, const Unit> const_iterator;
+
+  Units() { }
+  // Copies the units, e.g. for GameEnv::Fork(). Pointers to units of the copy are valid as above.
+  Units(const Units &units);
+  Units &operator=(const Units &) = delete;
+
+  int size() const { return _order.size(); }
+  bool empty() const { return _order.empty(); }
+  void clear();
+
+  // The i-th unit in iteration order, 0 <= i < size().
+  Unit &At(int i) { return slot(_order[i]); }
+  const Unit &At(int i) const { return slot(_order[i]); }
+  UnitId GetId(int i) const { return _ids[i]; }
+  UnitType GetUnitType(int i) const { return _types[i]; }
+  PlayerId GetPlayerId(int i) const { return Player::ExtractPlayerId(_ids[i]); }
+
+  // Index of the first unit whose id is not less than id.
+  int LowerBound(UnitId id) const { return std::lower_bound(_ids.begin(), _ids.end(), id) - _ids.begin(); }
+
+  // Return nullptr if there is no such unit.
+  Unit *Find(UnitId id) { const int s = slot_of(id); return s < 0 ? nullptr : &slot(s); }
+  const Unit *Find(UnitId id) const { const int s = slot_of(id); return s < 0 ? nullptr : &slot(s); }
+
+  // Add a copy of unit. Return nullptr if its id is already taken.
+  Unit *Add(const Unit &unit);
+  bool Remove(UnitId id);
+
+  iterator begin() { return iterator(this, 0); }
+  iterator end() { return iterator(this, size()); }
+  const_iterator begin() const { return const_iterator(this, 0); }
+  const_iterator end() const { return const_iterator(this, size()); }
+
+  // Same format as map<UnitId, unique_ptr<Unit>>, which Units replaced.
+  serializer::saver &Save(serializer::saver &oo) const;
+  serializer::loader &Load(serializer::loader &ii);
+  friend serializer::saver &operator<<(serializer::saver &oo, const Units &units) { return units.Save(oo); }
+  friend serializer::loader &operator>>(serializer::loader &ii, Units &units) { return units.Load(ii); }
+
+private:
+  static const int kChunkBits = 6;
+  static const int kChunkSize = 1 << kChunkBits;
+
+  vector<unique_ptr<Unit[]> > _chunks;
+  int _num_slots = 0;
+  vector<int> _free_slots;
+
+  // Raw id -> slot, -1 if the unit is gone.
+  vector<int> _slot_of;
+
+  // Slot, id and type of each unit, sorted by id.
+  vector<int> _order;
+  vector<UnitId> _ids;
+  vector<UnitType> _types;
+
+  Unit &slot(int s) { return _chunks[s >> kChunkBits][s & (kChunkSize - 1)]; }
+  const Unit &slot(int s) const { return _chunks[s >> kChunkBits][s & (kChunkSize - 1)]; }
+
+  int slot_of(UnitId id) const {
+      if (id < 0) return -1;
+      const UnitId raw = Player::ExtractRawId(id);
+      if (raw >= (int)_slot_of.size()) return -1;
+      const int s = _slot_of[raw];
+      return s >= 0 && slot(s).GetId() == id ? s : -1;
+  }
+};
 
 #endif
@@ -52,6 +52,7 @@ inline void init_enums() {
     _init_Level();
     _init_AIState();
     _init_PlayerPrivilege();
+    _init_FOWMode();
     _init_CDType();
 }
 
@@ -28,8 +28,8 @@ bool CmdFlagSetHandicap::run(GameEnv *env, CmdReceiver*) {
     }
     const int _player_id = 0;
     Units &units = env->GetUnits();
-    for (auto it = units.begin(); it != units.end(); ++it) {
-        Unit *u = it->second.get();
+    for (Unit &unit : units) {
+        Unit *u = &unit;
         if  (u->GetPlayerId() == _player_id) {
             // increase movement speed, attack and health by 20% * _level
             UnitProperty &p = u->GetProperty();
@@ -12,10 +12,14 @@
 #include "../engine/unit.h"
 
 void AIBase::save_structured_state(const GameEnv &env, ExtGame *game) const {
-    game->tick = _receiver->GetTick();
+    extract_features(env, _receiver->GetTick(), _player_id, game);
+}
+
+void AIBase::extract_features(const GameEnv &env, Tick tick, PlayerId player_id, ExtGame *game) {
+    game->tick = tick;
     game->winner = env.GetWinnerId();
     game->terminated = env.GetTermination();
-    game->player_id = _player_id;
+    game->player_id = player_id;
 
     const int n_type = env.GetGameDef().GetNumUnitType();
     const int n_additional = 2;
@@ -43,7 +47,7 @@ void AIBase::save_structured_state(const GameEnv &env, ExtGame *game) const {
     // Extra data.
     game->ai_start_tick = 0;
 
-    auto unit_iter = env.GetUnitIterator(_player_id);
+    auto unit_iter = env.GetUnitIterator(player_id);
     float total_hp_ratio = 0.0;
 
     int myworker = 0;
@@ -65,7 +69,7 @@ void AIBase::save_structured_state(const GameEnv &env, ExtGame *game) const {
 
         total_hp_ratio += hp_level;
 
-        if (u.GetPlayerId() == _player_id) {
+        if (u.GetPlayerId() == player_id) {
             if (t == WORKER) myworker += 1;
             else if (t == MELEE_ATTACKER || t == RANGE_ATTACKER) mytroop += 1;
             else if (t == BARRACKS) mybarrack += 1;
@@ -79,14 +83,14 @@ void AIBase::save_structured_state(const GameEnv &env, ExtGame *game) const {
     mybarrack = min(mybarrack, 1);
 
     for (int i = 0; i < env.GetNumOfPlayers(); ++i) {
-        if (_player_id != INVALID && _player_id != i) continue;
+        if (player_id != INVALID && player_id != i) continue;
         const auto &player = env.GetPlayer(i);
         quantized_r[i] = min(int(player.GetResource() / resource_grid), res_pt - 1);
         game->resources[i][quantized_r[i]] = 1.0;
     }
 
-    if (_player_id != INVALID) {
-        const int c = _OFFSET(n_type + n_additional + quantized_r[_player_id], 0, 0);
+    if (player_id != INVALID) {
+        const int c = _OFFSET(n_type + n_additional + quantized_r[player_id], 0, 0);
         std::fill(game->features.begin() + c, game->features.begin() + c + m.GetXSize() * m.GetYSize(), 1.0);
     }
 
@@ -94,7 +98,7 @@ void AIBase::save_structured_state(const GameEnv &env, ExtGame *game) const {
     int winner = env.GetWinnerId();
 
     if (winner != INVALID) {
-        if (winner == _player_id) game->last_reward = 1.0;
+        if (winner == player_id) game->last_reward = 1.0;
         else game->last_reward = -1.0;
     }
 }
@@ -204,3 +208,143 @@ bool HitAndRunAI::on_act(const GameEnv &env) {
         return _mc_rule_actor.ActByState(e, _state, s, assigned_cmds);
     });
 }
+
+bool GlobalActionAI::on_act(const GameEnv &env) {
+    return gather_decide(env, [&](const GameEnv &e, string *s, AssignedCmds *assigned_cmds) {
+        return _mc_rule_actor.ActByState(e, _state, s, assigned_cmds);
+    });
+}
+
+///////////////////////////// MCTS AI ////////////////////////////////
+static MCTSOptions mcts_options(int num_threads, int playouts_per_thread) {
+    MCTSOptions options;
+    options.num_threads = num_threads;
+    options.playouts_per_thread = playouts_per_thread;
+    return options;
+}
+
+// Run num_ticks ticks of a forked game as RTSGame::StepInPlace() does, bots[i] plays player i.
+static PlayerId step_game(MCTSAI::Game *g, const std::vector<std::unique_ptr<AI>> &bots, int num_ticks) {
+    GameEnv &env = *g->env;
+    CmdReceiver &receiver = *g->receiver;
+    for (int i = 0; i < num_ticks; ++i) {
+        for (const auto &bot : bots) bot->Act(env);
+        env.Forward(&receiver);
+        receiver.ExecuteDurativeCmds(env, false);
+        receiver.ExecuteImmediateCmds(&env, false);
+        env.ComputeFOW();
+        PlayerId winner_id = env.GetGameDef().CheckWinner(env, false);
+        if (winner_id != INVALID) {
+            env.SetWinnerId(winner_id);
+            env.SetTermination();
+            return winner_id;
+        }
+        receiver.IncTick();
+    }
+    return INVALID;
+}
+
+MCTSAI::MCTSAI(PlayerId id, int frame_skip, CmdReceiver *receiver, AIComm *ai_comm,
+    int num_threads, int playouts_per_thread, int rollout_ticks)
+    : AIBase(id, frame_skip, receiver, ai_comm),
+      _search(mcts_options(num_threads, playouts_per_thread), NUM_AISTATE,
+          [this](int, const Game &g, int action, Game *next) { transition(g, action, next); },
+          [this](int thread_id, const Game &g) { return evaluate(thread_id, g); }),
+      _rollout_ticks(rollout_ticks), _num_playouts(0), _search_usec(0.0) {
+    if (ai_comm != nullptr) {
+        for (int i = 0; i < num_threads; ++i) _leaf_comms.emplace_back(ai_comm->Spawn(i));
+    }
+}
+
+AI *MCTSAI::default_policy(PlayerId id, CmdReceiver *receiver) const {
+    AI *ai = _factory ? _factory(_frame_skip) : new SimpleAI(INVALID, _frame_skip, nullptr);
+    if (ai == nullptr) throw std::range_error("MCTSAI: the factory made no default policy!");
+    ai->SetId(id);
+    ai->SetCmdReceiver(receiver);
+    return ai;
+}
+
+void MCTSAI::transition(const Game &g, int action, Game *next) const {
+    next->env = g.env->Fork();
+    next->receiver = g.receiver->Fork();
+
+    std::vector<std::unique_ptr<AI>> bots;
+    for (PlayerId i = 0; i < next->env->GetNumOfPlayers(); ++i) {
+        if (i != _player_id) {
+            bots.emplace_back(default_policy(i, next->receiver.get()));
+            continue;
+        }
+        // SetId() and SetCmdReceiver() also set up the rule actor.
+        bots.emplace_back(new GlobalActionAI(INVALID, _frame_skip, nullptr, action));
+        bots.back()->SetId(i);
+        bots.back()->SetCmdReceiver(next->receiver.get());
+    }
+    step_game(next, bots, _frame_skip);
+}
+
+MCTSAI::Search::Evaluation MCTSAI::evaluate(int thread_id, const Game &g) const {
+    Search::Evaluation eval;
+    PlayerId winner_id = g.env->GetWinnerId();
+    if (winner_id != INVALID) {
+        eval.value = winner_id == _player_id ? 1.0 : -1.0;
+        eval.terminal = true;
+        return eval;
+    }
+
+    if (! _leaf_comms.empty()) {
+        AIComm *comm = _leaf_comms[thread_id].get();
+        comm->Prepare();
+        extract_features(*g.env, g.receiver->GetTick(), _player_id, comm->GetData());
+        if (comm->SendDataWaitReply()) {
+            const Reply &reply = comm->newest().reply;
+            eval.value = reply.value;
+            // A reply with fewer probabilities than actions (e.g., a default one) leaves the priors
+            // empty, i.e., uniform.
+            if ((int)reply.action_probs.size() >= NUM_AISTATE) {
+                eval.priors.assign(reply.action_probs.begin(), reply.action_probs.begin() + NUM_AISTATE);
+            }
+            return eval;
+        }
+        // No reply (e.g., the context is stopping), fall back to a rollout.
+    }
+
+    Game rollout;
+    rollout.env = g.env->Fork();
+    rollout.receiver = g.receiver->Fork();
+    std::vector<std::unique_ptr<AI>> bots;
+    for (PlayerId i = 0; i < rollout.env->GetNumOfPlayers(); ++i) {
+        bots.emplace_back(default_policy(i, rollout.receiver.get()));
+    }
+    winner_id = step_game(&rollout, bots, _rollout_ticks);
+    if (winner_id != INVALID) {
+        eval.value = winner_id == _player_id ? 1.0 : -1.0;
+        return eval;
+    }
+
+    float hp_mine = 0.0, hp_total = 0.0;
+    auto unit_iter = rollout.env->GetUnitIterator(INVALID);
+    while (! unit_iter.end()) {
+        const Unit &u = *unit_iter;
+        hp_total += u.GetProperty()._hp;
+        if (u.GetPlayerId() == _player_id) hp_mine += u.GetProperty()._hp;
+        ++ unit_iter;
+    }
+    eval.value = hp_total > 0 ? 2 * hp_mine / hp_total - 1 : 0.0;
+    return eval;
+}
+
+bool MCTSAI::on_act(const GameEnv &env) {
+    Game root;
+    root.env = env.Fork();
+    root.receiver = _receiver->Fork();
+    _last_search = _search.Search(std::move(root));
+    _num_playouts += _last_search.playouts;
+    _search_usec += _last_search.usec;
+
+    _state.resize(NUM_AISTATE);
+    std::fill(_state.begin(), _state.end(), 0);
+    _state[_last_search.best_action] = 1;
+    return gather_decide(env, [&](const GameEnv &e, string *s, AssignedCmds *assigned_cmds) {
+        return _mc_rule_actor.ActByState(e, _state, s, assigned_cmds);
+    });
+}
@@ -10,6 +10,7 @@
 #pragma once
 
 #include "../engine/ai.h"
+#include "../engine/mcts.h"
 #include "python_options.h"
 #include "mc_rule_actor.h"
 
@@ -20,6 +21,8 @@ class AIBase : public AIWithComm<AIComm, ExtGame> {
 protected:
     // Feature extraction.
     void save_structured_state(const GameEnv &env, ExtGame *game) const override;
+    // The same for a game which is not the one of _receiver (e.g. a fork searched by MCTSAI).
+    static void extract_features(const GameEnv &env, Tick tick, PlayerId player_id, ExtGame *game);
 
 public:
     AIBase() { }
@@ -116,3 +119,65 @@ public:
 
     SERIALIZER_DERIVED(HitAndRunAI, AIBase, _state);
 };
+
+// Plays one ACTION_GLOBAL action (a one-hot AIState, as TrainedAI2 does for a reply) every time it acts.
+class GlobalActionAI : public AIBase {
+private:
+    MCRuleActor _mc_rule_actor;
+    bool on_act(const GameEnv &env) override;
+    RuleActor *rule_actor() override { return &_mc_rule_actor; }
+
+public:
+    GlobalActionAI(PlayerId id, int frame_skip, CmdReceiver *receiver, int action)
+        : AIBase(id, frame_skip, receiver) {
+        _state.resize(NUM_AISTATE, 0);
+        _state[action] = 1;
+    }
+};
+
+// MCTS AI for MiniRTS. Every time it acts, it searches the ACTION_GLOBAL actions with
+// tree-parallel MCTS over forks of the game (GameEnv::Fork()), and plays the most visited one.
+// An edge of the tree plays its action for frame_skip ticks, while the opponent plays the default
+// policy made by the factory (SetFactory(), SimpleAI if not set). Leaves are evaluated
+//   with ai_comm: by the network. Each search thread sends the features of its leaves through its
+//     own AIComm child (thread ids [0, num_threads), see ContextOptions::max_num_threads), so the
+//     collectors batch the leaves of all threads of all games. The reply gives the value (V) and
+//     the priors of the actions (pi).
+//   without ai_comm: by a rollout, where both players play the default policy for rollout_ticks
+//     ticks. The value is +1/-1 if the game ends, otherwise the share of hit points of each side.
+// The search does not know the max tick of the game.
+class MCTSAI : public AIBase {
+public:
+    struct Game {
+        std::unique_ptr<GameEnv> env;
+        std::unique_ptr<CmdReceiver> receiver;
+    };
+    using Search = MCTS<Game>;
+
+    MCTSAI(PlayerId id, int frame_skip, CmdReceiver *receiver, AIComm *ai_comm,
+        int num_threads, int playouts_per_thread, int rollout_ticks = 200);
+
+    // Totals over all searches so far.
+    int64_t GetNumPlayouts() const { return _num_playouts; }
+    double GetSearchSeconds() const { return _search_usec * 1e-6; }
+    const Search::Result &GetLastSearch() const { return _last_search; }
+
+private:
+    MCRuleActor _mc_rule_actor;
+    Search _search;
+    int _rollout_ticks;
+    std::vector<std::unique_ptr<AIComm>> _leaf_comms;
+
+    int64_t _num_playouts;
+    double _search_usec;
+    Search::Result _last_search;
+
+    bool on_act(const GameEnv &env) override;
+    RuleActor *rule_actor() override { return &_mc_rule_actor; }
+    // Leaves are sent by _leaf_comms, not by Act().
+    bool need_structured_state(Tick) const override { return false; }
+
+    AI *default_policy(PlayerId id, CmdReceiver *receiver) const;
+    void transition(const Game &g, int action, Game *next) const;
+    Search::Evaluation evaluate(int thread_id, const Game &g) const;
+};
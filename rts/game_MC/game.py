@@ -21,14 +21,16 @@ class Loader:
             call_from = self,
             define_args = [
                 ("handicap_level", 0),
+                ("replay_keyframe_interval", dict(type=int, default=0, help="If > 0, save indexed replays (.rpx) with a keyframe every that many ticks")),
                 ("latest_start", 1000),
                 ("latest_start_decay", 0.7),
                 ("fs_ai", 50),
                 ("fs_opponent", 50),
-                ("ai_type", dict(type=str, choices=["AI_SIMPLE", "AI_HIT_AND_RUN", "AI_NN", "AI_FLAG_NN", "AI_TD_NN"], default="AI_NN")),
+                ("ai_type", dict(type=str, choices=["AI_SIMPLE", "AI_HIT_AND_RUN", "AI_NN", "AI_MCTS_VALUE", "AI_FLAG_NN", "AI_TD_NN"], default="AI_NN")),
                 ("opponent_type", dict(type=str, choices=["AI_SIMPLE", "AI_HIT_AND_RUN", "AI_FLAG_SIMPLE", "AI_TD_BUILT_IN"], default="AI_SIMPLE")),
                 ("max_tick", dict(type=int, default=30000, help="Maximal tick")),
                 ("mcts_threads", 64),
+                ("mcts_rollout_per_thread", 50),
                 ("seed", 0),
                 ("simple_ratio", -1),
                 ("ratio_change", 0),
@@ -43,6 +45,10 @@ class Loader:
 
         co = minirts.ContextOptions()
         self.context_args.initialize(co)
+        if args.ai_type == "AI_MCTS_VALUE":
+            # Each MCTS search thread sends its leaves with its own query id. Leaves are not steps
+            # of the game, so use them with --actor_only.
+            co.max_num_threads = args.mcts_threads
 
         opt = minirts.Options()
         opt.seed = args.seed
@@ -58,9 +64,10 @@ class Loader:
         opt.latest_start = args.latest_start
         opt.latest_start_decay = args.latest_start_decay
         opt.mcts_threads = args.mcts_threads
-        opt.mcts_rollout_per_thread = 50
+        opt.mcts_rollout_per_thread = args.mcts_rollout_per_thread
         opt.max_tick = args.max_tick
         opt.handicap_level = args.handicap_level
+        opt.replay_keyframe_interval = args.replay_keyframe_interval
         opt.simple_ratio = args.simple_ratio
         opt.ratio_change = args.ratio_change
         # opt.output_filename = b"simulators.txt"
@@ -114,13 +114,13 @@ bool MCRuleActor::ActByState(const GameEnv &env, const vector<int>& state, strin
         if (enemy_troops[MELEE_ATTACKER].empty() && enemy_troops[RANGE_ATTACKER].empty() && ! enemy_troops[WORKER].empty()) {
             // cout << "Enemy only have worker" << endl << flush;
             for (const Unit *u : my_troops[RANGE_ATTACKER]) {
-                hit_and_run(env, u, enemy_troops[WORKER], assigned_cmds);
+                hit_and_run(env, u, WORKER, assigned_cmds);
             }
         }
         if (! enemy_troops[MELEE_ATTACKER].empty()) {
             // cout << "Enemy only have malee attacker" << endl << flush;
             for (const Unit *u : my_troops[RANGE_ATTACKER]) {
-                hit_and_run(env, u, enemy_troops[MELEE_ATTACKER], assigned_cmds);
+                hit_and_run(env, u, MELEE_ATTACKER, assigned_cmds);
             }
         }
         if (! enemy_troops[RANGE_ATTACKER].empty()) {
@@ -78,11 +78,14 @@ struct PythonOptions {
     int game_name;
     int handicap_level;
 
+    // If > 0, save the replays as indexed ones (.rpx) with a keyframe every replay_keyframe_interval ticks.
+    int replay_keyframe_interval;
+
     PythonOptions()
       : simulation_type(ST_NORMAL), ai_type(AI_SIMPLE), backup_ai_type(AI_SIMPLE), opponent_ai_type(AI_SIMPLE),
         frame_skip_ai(1), frame_skip_opponent(1), simple_ratio(1.0), ratio_change(0.0), latest_start(0),
         latest_start_decay(0.9), max_tick(30000), seed(0), mcts_threads(1), mcts_rollout_per_thread(1),
-        game_name(0), handicap_level(0) {
+        game_name(0), handicap_level(0), replay_keyframe_interval(0) {
     }
 
     void Print() const {
@@ -98,9 +101,10 @@ struct PythonOptions {
         std::cout << "Output_prompt_filename: \"" << output_filename << "\"" << std::endl;
         std::cout << "Cmd_dumper_prefix: \"" << cmd_dumper_prefix << "\"" << std::endl;
         std::cout << "Save_replay_prefix: \"" << save_replay_prefix << "\"" << std::endl;
+        std::cout << "Replay keyframe interval: " << replay_keyframe_interval << std::endl;
     }
 
-    REGISTER_PYBIND_FIELDS(simulation_type, ai_type, backup_ai_type, opponent_ai_type, frame_skip_ai, frame_skip_opponent, output_filename, cmd_dumper_prefix, save_replay_prefix, simple_ratio, ratio_change, latest_start, latest_start_decay, max_tick, seed, mcts_threads, mcts_rollout_per_thread, game_name, handicap_level);
+    REGISTER_PYBIND_FIELDS(simulation_type, ai_type, backup_ai_type, opponent_ai_type, frame_skip_ai, frame_skip_opponent, output_filename, cmd_dumper_prefix, save_replay_prefix, simple_ratio, ratio_change, latest_start, latest_start_decay, max_tick, seed, mcts_threads, mcts_rollout_per_thread, game_name, handicap_level, replay_keyframe_interval);
 };
 
 struct ExtGame {
@@ -16,7 +16,7 @@
 
 typedef TrainedAI2 TrainAIType;
 static AI *get_ai(int game_idx, int frame_skip, int ai_type, int backup_ai_type,
-    const PythonOptions &options, GC::AIComm *input_ai_comm, bool use_ai_comm = false /*, int *opponent_ai_type = INVALID*/) {
+    const PythonOptions &options, GC::AIComm *input_ai_comm, bool use_ai_comm = false, int opponent_ai_type = AI_INVALID) {
     AIComm *ai_comm = use_ai_comm ? input_ai_comm : nullptr;
 
     switch (ai_type) {
@@ -26,19 +26,20 @@ static AI *get_ai(int game_idx, int frame_skip, int ai_type, int backup_ai_type,
            return new HitAndRunAI(INVALID, frame_skip, nullptr, ai_comm);
        case AI_NN:
            return new TrainAIType(INVALID, frame_skip, nullptr, ai_comm, get_ai(game_idx, frame_skip, backup_ai_type, AI_INVALID, options, input_ai_comm));
-       /*case AI_MCTS_VALUE:
+       case AI_MCTS_VALUE:
        {
-           AI *ai = new MCTS_VALUE_AI(INVALID, frame_skip, nullptr, ai_comm, options.mcts_threads, options.mcts_rollout_per_thread);
+           // Leaves are evaluated by the network through ai_comm, which needs ContextOptions::max_num_threads >= mcts_threads.
+           AI *ai = new MCTSAI(INVALID, frame_skip, nullptr, ai_comm, options.mcts_threads, options.mcts_rollout_per_thread);
            switch (opponent_ai_type) {
                case AI_SIMPLE:
-                   ai->SetFactory([&](int r) -> AI* { return new SimpleAI(INVALID, r, nullptr, nullptr);});
+                   ai->SetFactory([](int r) -> AI* { return new SimpleAI(INVALID, r, nullptr, nullptr);});
                    break;
                case AI_HIT_AND_RUN:
-                   ai->SetFactory([&](int r) -> AI* { return new HitAndRunAI(INVALID, r, nullptr, nullptr);});
+                   ai->SetFactory([](int r) -> AI* { return new HitAndRunAI(INVALID, r, nullptr, nullptr);});
                    break;
            }
            return ai;
-       }*/
+       }
        default:
            throw std::range_error("Unknown ai_type! ai_type: " + std::to_string(ai_type) +
                    " backup_ai_type: " + std::to_string(backup_ai_type) + " use_ai_comm: " + std::to_string(use_ai_comm));
@@ -53,11 +54,12 @@ void WrapperCallbacks::GlobalInit() {
 
 void WrapperCallbacks::OnGameOptions(RTSGameOptions *rts_options) {
     rts_options->handicap_level = _options.handicap_level;
+    rts_options->replay_keyframe_interval = _options.replay_keyframe_interval;
 }
 
 void WrapperCallbacks::OnGameInit(RTSGame *game) {
     _opponent = get_ai(INVALID, _options.frame_skip_opponent, _options.opponent_ai_type, AI_INVALID, _options, _ai_comm);
-    _ai = get_ai(_game_idx, _options.frame_skip_ai, _options.ai_type, _options.backup_ai_type, _options, _ai_comm, true/*, _options.opponent_ai_type*/);
+    _ai = get_ai(_game_idx, _options.frame_skip_ai, _options.ai_type, _options.backup_ai_type, _options, _ai_comm, true, _options.opponent_ai_type);
 
     // AI at position 0
     game->AddBot(_ai);
@@ -9,8 +9,19 @@
 
 #include "td_rule_actor.h"
 
+// Each tower attacks the closest enemy attacker whose squared distance is within its attack range.
+void TDRuleActor::attack_closest_attackers(const GameEnv &env, const vector<const Unit *> &towers, AssignedCmds *assigned_cmds) {
+    const UnitFilter filter = UnitFilter::EnemiesOf(_player_id).OfType(TOWER_ATTACKER);
+    for (const Unit *u : towers) {
+        const float att_r = u->GetProperty()._att_r;
+        auto nearest = env.KNearest(u->GetPointF(), 1, filter, std::sqrt(std::max(att_r, 0.0f)) + 1e-3);
+        if (! nearest.empty() && PointF::L2Sqr(nearest[0]->GetPointF(), u->GetPointF()) <= att_r) {
+            store_cmd(u, _A(nearest[0]->GetId()), assigned_cmds);
+        }
+    }
+}
+
 bool TDRuleActor::TowerDefenseActByState(const GameEnv &env, int state, AssignedCmds *assigned_cmds) {
-    const auto &enemy_troops = _preload.EnemyTroops();
     const auto &my_troops = _preload.MyTroops();
     int tower_price = env.GetGameDef().unit(TOWER).GetUnitCost();
     if (my_troops[TOWER_BASE].empty()) {
@@ -22,20 +33,11 @@ bool TDRuleActor::TowerDefenseActByState(const GameEnv &env, int state, Assigned
         int y = state % 20;
         store_cmd(base, CmdDPtr(new CmdBuildTower(INVALID, PointF(x, y), tower_price, _player_id)), assigned_cmds);
     }
-    auto targets = enemy_troops[TOWER_ATTACKER];
-    for (const Unit *u : my_troops[TOWER]) {
-        float closest = std::numeric_limits<float>::max();
-        const Unit *closest_target = closest_dist(targets, u->GetPointF(), &closest);
-        if (closest_target != nullptr && closest <= u->GetProperty()._att_r) {
-            UnitId opponent_target_id = closest_target->GetId();
-            store_cmd(u, _A(opponent_target_id), assigned_cmds);
-        }
-    }
+    attack_closest_attackers(env, my_troops[TOWER], assigned_cmds);
     return true;
 }
 
 bool TDRuleActor::ActTowerDefenseSimple(const GameEnv &env, AssignedCmds *assigned_cmds) {
-    const auto &enemy_troops = _preload.EnemyTroops();
     const auto &my_troops = _preload.MyTroops();
     int tower_price = env.GetGameDef().unit(TOWER).GetUnitCost();
     if (my_troops[TOWER_BASE].empty()) {
@@ -48,15 +50,7 @@ bool TDRuleActor::ActTowerDefenseSimple(const GameEnv &env, AssignedCmds *assign
             store_cmd(base, CmdDPtr(new CmdBuildTower(INVALID, p, tower_price, _player_id)), assigned_cmds);
         }
     }
-    auto targets = enemy_troops[TOWER_ATTACKER];
-    for (const Unit *u : my_troops[TOWER]) {
-        float closest = std::numeric_limits<float>::max();
-        const Unit *closest_target = closest_dist(targets, u->GetPointF(), &closest);
-        if (closest_target != nullptr && closest <= u->GetProperty()._att_r) {
-            UnitId opponent_target_id = closest_target->GetId();
-            store_cmd(u, _A(opponent_target_id), assigned_cmds);
-        }
-    }
+    attack_closest_attackers(env, my_troops[TOWER], assigned_cmds);
     return true;
 }
 
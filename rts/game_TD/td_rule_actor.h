@@ -15,6 +15,9 @@
 #include "cmd_specific.gen.h"
 
 class TDRuleActor : public RuleActor {
+private:
+    void attack_closest_attackers(const GameEnv &env, const vector<const Unit *> &towers, AssignedCmds *assigned_cmds);
+
 public:
     TDRuleActor(){ }
     // Act by a state array, used by Capture the flag    // Act by a state array, used by Tower defense